@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <dirent.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
@@ -10,9 +11,14 @@
 #include <sys/stat.h>
 #include <pthread.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include "transcoding.h"
+#include "metrics.h"
+#include <libavutil/time.h>
 //#include "trans.h"
 
 
@@ -23,13 +29,31 @@
 #define STDOUT  1
 #define STDERR  2
 #define BLOCK_SIZE 1024
+/* queued packets/frames a session may hold before it fails instead of
+ * growing until the OOM killer picks a child */
+#define SESSION_MEM_BUDGET "256M"
+/* the same for all sessions together; the children are separate processes,
+ * so their own process budget only ever sees one session */
+#define SERVER_MEM_BUDGET (2048LL << 20)
+/* H.264 sources within these limits are remuxed instead of re-encoded */
+#define COPY_PROFILES    "Constrained Baseline,Baseline,Main,High"
+#define COPY_MAX_LEVEL   "41"
+#define COPY_MAX_BITRATE "8M"
+
+/* directory the request path is resolved against, see main() */
+static const char *media_root = "/mnt/hgfs/web/c++/ffmpeg-transocding/build";
+/* NUMA placement policy for sessions (least, rr or a node), NULL for none */
+static const char *placement;
+static int node_sessions[NUMA_MAX_NODES];
+/* shared with the children, which charge it through a per-child budget */
+static MemBudget *server_budget;
 
 void accept_request(void *);
 /*void bad_request(int);
 void cat(int, FILE *);
 void cannot_execute(int);*/
 void error_die(const char *);
-void execute_cgi(int, const char *, const char *, const char *);
+void execute_cgi(int, const char *, const char *, const char *, MetricsSession *);
 int get_line(int, char *, int);
 //void headers(int, const char *);
 void not_found(int);
@@ -37,14 +61,86 @@ void not_found(int);
 int startup(u_short *);
 void unimplemented(int);
 
+/* a budget in anonymous shared memory stays common to the children forked
+ * after it is allocated, the gcc atomics on it work across processes */
+static MemBudget *shared_budget_alloc(const char *name, int64_t limit, MemBudget *parent)
+{
+    MemBudget *b = mmap(NULL, sizeof(*b), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (b == MAP_FAILED)
+        return NULL;
+    b->name   = name;
+    b->limit  = limit;
+    b->parent = parent;
+    atomic_init(&b->used, 0);
+    atomic_init(&b->peak, 0);
+    return b;
+}
+
+/* a child killed by a signal never released what it had queued */
+static void shared_budget_free(MemBudget **b)
+{
+    if (!*b)
+        return;
+    mem_budget_release(*b, atomic_load(&(*b)->used));
+    munmap(*b, sizeof(**b));
+    *b = NULL;
+}
+
+/* the child is forked from a threaded server: drop the listening socket,
+ * other clients and other sessions' pipes so they close when their owner
+ * closes them */
+static void close_inherited_fds(int keep)
+{
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *d;
+    int fd;
+
+    if (!dir) {
+        for (fd = STDERR + 1; fd < 1024; fd++)
+            if (fd != keep)
+                close(fd);
+        return;
+    }
+    while ((d = readdir(dir))) {
+        fd = atoi(d->d_name);
+        if (fd > STDERR && fd != keep && fd != dirfd(dir))
+            close(fd);
+    }
+    closedir(dir);
+}
+
+/* feed complete lines of the child's -progress output to the session metrics */
+static int read_progress(int fd, char *line, int *len, MetricsSession *session)
+{
+    char buffer[256];
+    int i, ret;
+
+    ret = read(fd, buffer, sizeof(buffer));
+    for (i = 0; i < ret; i++) {
+        if (buffer[i] == '\n') {
+            line[*len] = '\0';
+            metrics_session_progress(session, line);
+            *len = 0;
+        } else if (*len < 127) {
+            line[(*len)++] = buffer[i];
+        }
+    }
+    return ret;
+}
+
 void execute_cgi(int client, const char *path,
-        const char *method, const char *query_string)
+        const char *method, const char *query_string, MetricsSession *session)
 {
     char buf[1024];
     int ret;
     int pfds[2];
+    int progress_pfds[2];
     int status;
     pid_t pid;
+    int node = -1;
+    MemBudget *child_budget = NULL;
     FILE *fp = fopen( "./build/output-pipe.txt", "wb" );
     printf("transcoding start ...\n");
 
@@ -52,16 +148,47 @@ void execute_cgi(int client, const char *path,
         cannot_execute(client);
         return;
     }
+    if (pipe(progress_pfds) < 0) {
+        close(pfds[0]);
+        close(pfds[1]);
+        cannot_execute(client);
+        return;
+    }
+
+    /* chosen here rather than in the child so least-loaded sees the
+     * sessions this server already placed */
+    if (placement && (node = numa_pick_node(placement, node_sessions)) >= 0)
+        __sync_fetch_and_add(&node_sessions[node], 1);
+    if (server_budget)
+        child_budget = shared_budget_alloc("child", 0, server_budget);
 
     pid = fork();
+    metrics_session_fork(session, pid);
     if(pid < 0){
+        close(pfds[0]);
+        close(pfds[1]);
+        close(progress_pfds[0]);
+        close(progress_pfds[1]);
+        if (node >= 0)
+            __sync_fetch_and_sub(&node_sessions[node], 1);
+        shared_budget_free(&child_budget);
         cannot_execute(client);
         return;
     }else if(pid == 0){
+        char progress_url[32];
+        char node_str[16];
         char *argv[] = {
+            "cffmpeg",
             "-y",
             "-i",
             path,
+            "-progress",
+            progress_url,
+            "-mem_budget",
+            SESSION_MEM_BUDGET,
+            "-auto_threads",
+            /* copy-only jobs planned by -copy_if_compatible skip the pipeline */
+            "-fast_remux",
             "-f",
             "mpegts",
             /*"mp4",
@@ -69,31 +196,77 @@ void execute_cgi(int client, const char *path,
             "flag_keyframe+empty_moov",*/
             "-c:v",
             "libx264",
-            "pipe:"
+            "-copy_if_compatible:v",
+            "-copy_profiles:v",
+            COPY_PROFILES,
+            "-copy_max_level:v",
+            COPY_MAX_LEVEL,
+            "-copy_max_bitrate:v",
+            COPY_MAX_BITRATE,
+            "pipe:",
+            /* optional placement, kept last so it can be cut off */
+            "-numa_node",
+            node_str,
         };
         int argc = sizeof(argv)/sizeof(argv[0]);
+        snprintf(progress_url, sizeof(progress_url), "pipe:%d", progress_pfds[1]);
+        snprintf(node_str, sizeof(node_str), "%d", node);
+        if (node < 0)
+            argc -= 2;
         dup2(pfds[1], STDOUT);
-        close(pfds[0]);
+        close_inherited_fds(progress_pfds[1]);
+        mem_budget_process.parent = child_budget;
         av_log_set_level(AV_LOG_ERROR);
         run_transcoding(argc, argv, NULL, NULL);
         /*av_log_set_level(AV_LOG_ERROR);
         create_trans_task(path, "pipe:");*/
         return ;
     }else{
-        
+        struct pollfd fds[2];
+        struct rusage ru;
+        char line[128];
+        int line_len = 0;
+
         write_ts_header(client);
         close(pfds[1]);
+        close(progress_pfds[1]);
         size_t bytes;
         char buffer[BLOCK_SIZE];
 
-        while ((ret = read(pfds[0], buffer, sizeof(buffer))) > 0){
-            send(client, buffer, ret, 0);
-            fwrite(buffer, sizeof(char), ret, fp);
+        fds[0].fd = pfds[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = progress_pfds[0];
+        fds[1].events = POLLIN;
+        while (poll(fds, 2, -1) > 0) {
+            if (fds[1].revents &&
+                read_progress(progress_pfds[0], line, &line_len, session) <= 0)
+                fds[1].fd = -1;
+            if (fds[0].revents) {
+                if ((ret = read(pfds[0], buffer, sizeof(buffer))) <= 0)
+                    break;
+                /* a client hanging up must not SIGPIPE the whole server;
+                 * closing our end of the pipe stops the child instead */
+                if (send(client, buffer, ret, MSG_NOSIGNAL) < 0)
+                    break;
+                metrics_session_sent(session, ret);
+                if (fp)
+                    fwrite(buffer, sizeof(char), ret, fp);
+            }
         }
         shutdown(client, SHUT_RDWR);
         close(pfds[0]);
+        close(progress_pfds[0]);
+
+        if (wait4(pid, &status, 0, &ru) == pid)
+            metrics_session_exit(session, &ru);
+        else
+            metrics_session_exit(session, NULL);
+        if (node >= 0)
+            __sync_fetch_and_sub(&node_sessions[node], 1);
+        shared_budget_free(&child_budget);
     }
-    fclose(fp);
+    if (fp)
+        fclose(fp);
 
 
 
@@ -111,7 +284,10 @@ void accept_request(void *arg)
     size_t i, j;
     struct stat st;
     char *query_string = NULL;
+    int64_t start_time = av_gettime_relative();
+    MetricsSession *session;
 
+    metrics_worker_start();
     numchars = get_line(client, buf, sizeof(buf));
     i = 0; j = 0;
     while (!ISspace(buf[i]) && (i < sizeof(method) - 1))
@@ -123,7 +299,10 @@ void accept_request(void *arg)
     method[i] = '\0';
 
     if (!strcasecmp(method, "GET") == 0){
+        metrics_connection_dequeued();
         unimplemented(client);
+        close(client);
+        metrics_worker_stop();
         return;
     }
 
@@ -147,18 +326,29 @@ void accept_request(void *arg)
         query_string++;
     }
 
+    metrics_connection_dequeued();
+    if (!strcmp(url, "/metrics")) {
+        metrics_serve(client);
+        close(client);
+        metrics_worker_stop();
+        return;
+    }
+
     //sprintf(path, "http://v-livegrab-static.huya.com%s", url);
-    sprintf(path, "/mnt/hgfs/web/c++/ffmpeg-transocding/build%s", url);
+    snprintf(path, sizeof(path), "%s%s", media_root, url);
     /*//判断文件是否存在
     if (stat(path, &st) == -1) {
         not_found(client);
     }
     */
 
-    printf("method=%s, query_string=%s, path=%s\n", method, *query_string, path);
-    execute_cgi(client, path, method, query_string);
+    printf("method=%s, query_string=%s, path=%s\n", method, query_string, path);
+    session = metrics_session_begin(start_time);
+    execute_cgi(client, path, method, query_string, session);
+    metrics_session_end(session);
 
     close(client);
+    metrics_worker_stop();
 }
 
 int startup(u_short *port)
@@ -192,7 +382,8 @@ int startup(u_short *port)
     return(httpd);
 }
 
-int main(void)
+/* cffmpeg [port [media_root [placement]]], placement as for -numa_node or none */
+int main(int argc, char **argv)
 {
 
     int server_sock = -1;
@@ -202,6 +393,22 @@ int main(void)
     socklen_t  client_name_len = sizeof(client_name);
     pthread_t newthread;
 
+    if (argc > 1)
+        port = atoi(argv[1]);
+    if (argc > 2)
+        media_root = argv[2];
+    if (argc > 3 && strcmp(argv[3], "none")) {
+        placement = argv[3];
+        if (numa_pick_node(placement, node_sessions) < 0) {
+            fprintf(stderr, "invalid placement %s, expected least, rr, none or a node "
+                    "below %d\n", placement, numa_nb_nodes());
+            exit(1);
+        }
+    }
+
+    metrics_init();
+    if (!(server_budget = shared_budget_alloc("server", SERVER_MEM_BUDGET, NULL)))
+        fprintf(stderr, "cannot share a memory budget, sessions are only limited one by one\n");
     server_sock = startup(&port);
     printf("httpd running on port %d\n", port);
 
@@ -213,8 +420,13 @@ int main(void)
         if (client_sock == -1)
             error_die("accept");
         /* accept_request(&client_sock); */
-        if (pthread_create(&newthread , NULL, (void *)accept_request, (void *)(intptr_t)client_sock) != 0)
+        metrics_connection_queued();
+        if (pthread_create(&newthread , NULL, (void *)accept_request, (void *)(intptr_t)client_sock) != 0) {
             perror("pthread_create");
+            metrics_connection_dequeued();
+            close(client_sock);
+        } else
+            pthread_detach(newthread);
     }
 
     close(server_sock);
@@ -290,8 +502,8 @@ void write_ts_header(int client){
     send(client, buf, strlen(buf), 0);
     sprintf(buf, "Connection: keep-alive\r\n");
     send(client, buf, strlen(buf), 0);
-    send(client, buf, strlen(buf), 0);
     sprintf(buf, "\r\n");
+    send(client, buf, strlen(buf), 0);
 }
 
 void not_found(int client)
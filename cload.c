@@ -0,0 +1,434 @@
+/*
+ * Load generator for the cffmpeg streaming server.
+ *
+ * Opens N concurrent GET streams against a local cffmpeg, started evenly
+ * over a ramp-up period, and reports per stream time-to-first-byte,
+ * sustained throughput, stalls and errors. A share of the clients can be
+ * made slow readers to exercise back-pressure on the transcoding children.
+ *
+ * cload [-H host] [-p port] [-u /path] [-c streams] [-R rampup_s]
+ *       [-s slow_share] [-S slow_bytes_per_s] [-T stall_ms] [-l limit_s]
+ *       [-g media_root] [-d seconds] [-o results.json]
+ *
+ * With -g, a testsrc/sine clip is generated into media_root (unless it
+ * already exists) and -u defaults to it, so the whole run stays on
+ * localhost: start "cffmpeg <port> <media_root>" with the same root.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <libavdevice/avdevice.h>
+#include <libavutil/avstring.h>
+#include <libavutil/log.h>
+#include <libavutil/time.h>
+
+#include "transcoding.h"
+
+enum LoadError {
+    LOAD_OK,
+    LOAD_ERR_CONNECT,
+    LOAD_ERR_SEND,
+    LOAD_ERR_STATUS,        ///< response was not "HTTP/1.x 200"
+    LOAD_ERR_NO_DATA,       ///< closed before the first byte of the body
+    LOAD_ERR_RESET,         ///< recv() error after the stream started
+    LOAD_ERR_NB
+};
+
+static const char *const load_error_names[LOAD_ERR_NB] = {
+    [LOAD_OK]          = "ok",
+    [LOAD_ERR_CONNECT] = "connect",
+    [LOAD_ERR_SEND]    = "send",
+    [LOAD_ERR_STATUS]  = "status",
+    [LOAD_ERR_NO_DATA] = "no_data",
+    [LOAD_ERR_RESET]   = "reset",
+};
+
+typedef struct LoadStream {
+    int index;
+    int slow;
+    int started;
+    pthread_t thread;
+
+    int64_t start;          ///< connect() time, av_gettime_relative()
+    int64_t ttfb;           ///< time to the first body byte, -1 if none
+    int64_t duration;       ///< first body byte to end of stream
+    uint64_t bytes;
+    int stalls;
+    int64_t stall_time;
+    enum LoadError error;
+    int sys_errno;
+} LoadStream;
+
+static const char *load_host = "127.0.0.1";
+static int load_port = 4000;
+static char load_path[256];
+static int load_streams = 8;
+static double load_rampup = 5.0;
+static double load_slow_share;
+static int load_slow_rate = 64 * 1024;
+static int load_stall_ms = 1000;
+static double load_limit;
+static const char *media_root;
+static int media_duration = 30;
+static const char *load_output;
+
+static int64_t load_epoch;
+
+static int load_connect(void)
+{
+    struct sockaddr_in addr;
+    int fd;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(load_port);
+    if (inet_pton(AF_INET, load_host, &addr.sin_addr) != 1 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Wait up to the stall threshold for data. Every timeout is one stall, a
+ * stall lasts until data arrives again.
+ *
+ * @return >0 if readable, 0 if the time limit of the run was hit, <0 on error
+ */
+static int wait_readable(LoadStream *s, int fd)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int64_t stall_start = 0;
+    int ret;
+
+    for (;;) {
+        if (load_limit > 0 && av_gettime_relative() - load_epoch > load_limit * 1000000)
+            return 0;
+        ret = poll(&pfd, 1, load_stall_ms);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            return ret;
+        if (ret > 0)
+            break;
+        if (!stall_start) {
+            stall_start = av_gettime_relative() - load_stall_ms * 1000LL;
+            s->stalls++;
+        }
+    }
+    if (stall_start)
+        s->stall_time += av_gettime_relative() - stall_start;
+    return 1;
+}
+
+static void *load_stream_thread(void *arg)
+{
+    LoadStream *s = arg;
+    char buf[16384], request[512];
+    int64_t first_byte = 0, now;
+    int header_done = 0, header_len = 0, fd, ret;
+    char header[1024];
+
+    s->ttfb  = -1;
+    s->start = av_gettime_relative();
+    if ((fd = load_connect()) < 0) {
+        s->error     = LOAD_ERR_CONNECT;
+        s->sys_errno = errno;
+        return NULL;
+    }
+
+    snprintf(request, sizeof(request),
+             "GET %s HTTP/1.1\r\nHost: %s:%d\r\nUser-Agent: cload\r\n\r\n",
+             load_path, load_host, load_port);
+    if (send(fd, request, strlen(request), MSG_NOSIGNAL) < 0) {
+        s->error     = LOAD_ERR_SEND;
+        s->sys_errno = errno;
+        close(fd);
+        return NULL;
+    }
+
+    for (;;) {
+        if ((ret = wait_readable(s, fd)) <= 0) {
+            if (ret < 0) {
+                s->error     = LOAD_ERR_RESET;
+                s->sys_errno = errno;
+            }
+            break;
+        }
+        /* slow readers read small chunks so the pacing below stays smooth */
+        ret = recv(fd, buf, s->slow ? FFMIN((int)sizeof(buf), load_slow_rate / 10 + 1) : sizeof(buf), 0);
+        if (ret < 0) {
+            s->error     = first_byte ? LOAD_ERR_RESET : LOAD_ERR_NO_DATA;
+            s->sys_errno = errno;
+            break;
+        }
+        if (!ret) {
+            if (!header_done)
+                s->error = LOAD_ERR_STATUS;
+            else if (!first_byte)
+                s->error = LOAD_ERR_NO_DATA;
+            break;
+        }
+
+        if (!header_done) {
+            int n = FFMIN(ret, (int)sizeof(header) - 1 - header_len);
+            char *end;
+
+            memcpy(header + header_len, buf, n);
+            header_len += n;
+            header[header_len] = '\0';
+            if (!(end = strstr(header, "\r\n\r\n"))) {
+                if (header_len == sizeof(header) - 1) {
+                    s->error = LOAD_ERR_STATUS;
+                    break;
+                }
+                continue;
+            }
+            if (strncmp(header, "HTTP/1.", 7) || strncmp(header + 8, " 200", 4)) {
+                s->error = LOAD_ERR_STATUS;
+                break;
+            }
+            header_done = 1;
+            /* whatever followed the header in this read is body */
+            ret = header_len - (end + 4 - header);
+            if (!ret)
+                continue;
+        }
+
+        now = av_gettime_relative();
+        if (!first_byte) {
+            first_byte = now;
+            s->ttfb    = now - s->start;
+        }
+        s->bytes += ret;
+
+        /* a slow reader consumes at most load_slow_rate bytes/s, the kernel
+         * buffers fill up and the server's send() blocks */
+        if (s->slow) {
+            int64_t due = first_byte + s->bytes * 1000000 / load_slow_rate;
+            if (due > now)
+                av_usleep(due - now);
+        }
+    }
+
+    if (first_byte)
+        s->duration = av_gettime_relative() - first_byte;
+    close(fd);
+    return NULL;
+}
+
+static int generate_media(const char *path)
+{
+    char video[128], audio[128];
+    char *argv[] = {
+        "cload", "-y",
+        "-f", "lavfi", "-i", video,
+        "-f", "lavfi", "-i", audio,
+        "-c:v", "libx264", "-preset", "veryfast", "-pix_fmt", "yuv420p",
+        "-c:a", "aac",
+        "-shortest",
+        (char *)path,
+    };
+    int status;
+    pid_t pid;
+
+    snprintf(video, sizeof(video), "testsrc=size=1280x720:rate=25:duration=%d", media_duration);
+    snprintf(audio, sizeof(audio), "sine=frequency=1000:sample_rate=48000:duration=%d", media_duration);
+
+    /* run_transcoding() ends with exit_program() */
+    if ((pid = fork()) < 0)
+        return -1;
+    if (!pid) {
+        av_log_set_level(AV_LOG_ERROR);
+        avdevice_register_all();
+        run_transcoding(FF_ARRAY_ELEMS(argv), argv, NULL, NULL);
+        exit(1);
+    }
+    if (waitpid(pid, &status, 0) != pid)
+        return -1;
+    return WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -1;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_summary(LoadStream *streams, int nb)
+{
+    int64_t *ttfb;
+    int errors[LOAD_ERR_NB] = { 0 };
+    int i, nb_ttfb = 0, stalls = 0, stalled_streams = 0;
+    double throughput = 0, min_throughput = -1;
+
+    if (nb <= 0)
+        return;
+    ttfb = calloc((size_t)nb, sizeof(*ttfb));
+
+    for (i = 0; i < nb; i++) {
+        LoadStream *s = &streams[i];
+        errors[s->error]++;
+        stalls += s->stalls;
+        stalled_streams += s->stalls > 0;
+        if (s->ttfb >= 0 && ttfb)
+            ttfb[nb_ttfb++] = s->ttfb;
+        if (s->duration > 0) {
+            double bps = s->bytes * 8.0 / (s->duration / 1000000.0);
+            throughput += bps;
+            if (!s->slow && (min_throughput < 0 || bps < min_throughput))
+                min_throughput = bps;
+        }
+    }
+
+    printf("streams: %d, ok: %d\n", nb, errors[LOAD_OK]);
+    for (i = 1; i < LOAD_ERR_NB; i++)
+        if (errors[i])
+            printf("  error %-8s %d\n", load_error_names[i], errors[i]);
+    if (nb_ttfb) {
+        qsort(ttfb, nb_ttfb, sizeof(*ttfb), cmp_int64);
+        printf("ttfb ms: p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+               ttfb[nb_ttfb / 2] / 1000.0, ttfb[nb_ttfb * 9 / 10] / 1000.0,
+               ttfb[nb_ttfb * 99 / 100] / 1000.0, ttfb[nb_ttfb - 1] / 1000.0);
+    }
+    printf("throughput: total %.0f kbit/s, slowest full-speed stream %.0f kbit/s\n",
+           throughput / 1000, FFMAX(min_throughput, 0) / 1000);
+    printf("stalls: %d in %d streams (threshold %d ms)\n", stalls, stalled_streams, load_stall_ms);
+    free(ttfb);
+}
+
+static void write_results(LoadStream *streams, int nb)
+{
+    FILE *f = fopen(load_output, "w");
+    int i;
+
+    if (!f) {
+        perror(load_output);
+        return;
+    }
+    fprintf(f, "{\"streams\":%d,\"rampup_s\":%.1f,\"stall_ms\":%d,\"results\":[\n",
+            nb, load_rampup, load_stall_ms);
+    for (i = 0; i < nb; i++) {
+        LoadStream *s = &streams[i];
+        fprintf(f, "{\"index\":%d,\"slow\":%d,\"start_ms\":%.1f,\"ttfb_ms\":%.1f,"
+                "\"duration_s\":%.3f,\"bytes\":%"PRIu64",\"kbps\":%.1f,"
+                "\"stalls\":%d,\"stall_ms\":%.1f,\"error\":\"%s\",\"errno\":%d}%s\n",
+                s->index, s->slow, (s->start - load_epoch) / 1000.0,
+                s->ttfb >= 0 ? s->ttfb / 1000.0 : -1.0, s->duration / 1000000.0,
+                s->bytes, s->duration > 0 ? s->bytes * 8.0 / s->duration * 1000 : 0.0,
+                s->stalls, s->stall_time / 1000.0, load_error_names[s->error],
+                s->sys_errno, i == nb - 1 ? "" : ",");
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    LoadStream *streams;
+    int i, opt, slow = 0;
+
+    while ((opt = getopt(argc, argv, "H:p:u:c:R:s:S:T:l:g:d:o:")) != -1) {
+        switch (opt) {
+        case 'H': load_host       = optarg;       break;
+        case 'p': load_port       = atoi(optarg); break;
+        case 'u': av_strlcpy(load_path, optarg, sizeof(load_path)); break;
+        case 'c': load_streams    = atoi(optarg); break;
+        case 'R': load_rampup     = atof(optarg); break;
+        case 's': load_slow_share = atof(optarg); break;
+        case 'S': load_slow_rate  = atoi(optarg); break;
+        case 'T': load_stall_ms   = atoi(optarg); break;
+        case 'l': load_limit      = atof(optarg); break;
+        case 'g': media_root      = optarg;       break;
+        case 'd': media_duration  = atoi(optarg); break;
+        case 'o': load_output     = optarg;       break;
+        default:
+            fprintf(stderr, "usage: %s [-H host] [-p port] [-u /path] [-c streams] [-R rampup_s] "
+                    "[-s slow_share] [-S slow_bytes_per_s] [-T stall_ms] [-l limit_s] "
+                    "[-g media_root] [-d seconds] [-o results.json]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (load_streams <= 0 || load_slow_rate <= 0 || load_stall_ms <= 0) {
+        fprintf(stderr, "streams, slow rate and stall threshold must be positive\n");
+        return 2;
+    }
+
+    if (media_root) {
+        char name[64], file[512];
+        struct stat st;
+
+        snprintf(name, sizeof(name), "/cload_%ds.mp4", media_duration);
+        snprintf(file, sizeof(file), "%s%s", media_root, name);
+        if (stat(file, &st) < 0) {
+            fprintf(stderr, "generating %s\n", file);
+            if (generate_media(file) < 0) {
+                fprintf(stderr, "failed to generate %s\n", file);
+                unlink(file);
+                return 1;
+            }
+        }
+        if (!load_path[0])
+            av_strlcpy(load_path, name, sizeof(load_path));
+    }
+    if (!load_path[0]) {
+        fprintf(stderr, "no stream path, use -u or -g\n");
+        return 2;
+    }
+
+    if (!(streams = calloc(load_streams, sizeof(*streams))))
+        return 1;
+
+    load_epoch = av_gettime_relative();
+    for (i = 0; i < load_streams; i++) {
+        LoadStream *s = &streams[i];
+        int64_t due = load_epoch + (int64_t)(load_rampup * 1000000 * i / load_streams);
+        int64_t now = av_gettime_relative();
+
+        if (due > now)
+            av_usleep(due - now);
+
+        s->index = i;
+        /* spread slow readers evenly over the ramp */
+        s->slow  = (int)((i + 1) * load_slow_share) > slow;
+        slow    += s->slow;
+        if (pthread_create(&s->thread, NULL, load_stream_thread, s)) {
+            s->error     = LOAD_ERR_CONNECT;
+            s->sys_errno = EAGAIN;
+            s->ttfb      = -1;
+        } else
+            s->started = 1;
+    }
+    for (i = 0; i < load_streams; i++)
+        if (streams[i].started)
+            pthread_join(streams[i].thread, NULL);
+
+    print_summary(streams, load_streams);
+    if (load_output)
+        write_results(streams, load_streams);
+
+    for (i = 0; i < load_streams; i++)
+        if (streams[i].error != LOAD_OK) {
+            free(streams);
+            return 1;
+        }
+    free(streams);
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "cmdutils.h"
 #include "config.h"
+#include "ffmpeg_arena.h"
 
 static void (*program_exit)(int ret);
 AVDictionary *sws_dict;
@@ -249,7 +250,7 @@ static void init_parse_context(OptionParseContext *octx, const OptionGroupDef *g
     memset(octx, 0, sizeof(*octx));
 
     octx->nb_groups = nb_groups;
-    octx->groups    = av_mallocz_array(octx->nb_groups, sizeof(*octx->groups));
+    octx->groups    = session_realloc_array(NULL, 0, octx->nb_groups, sizeof(*octx->groups));
     if (!octx->groups)
         exit_program(1);
 
@@ -304,7 +305,7 @@ void *grow_array(void *array, int elem_size, int *size, int new_size)
         exit_program(1);
     }
     if (*size < new_size) {
-        uint8_t *tmp = av_realloc_array(array, new_size, elem_size);
+        uint8_t *tmp = session_realloc_array(array, *size, new_size, elem_size);
         if (!tmp) {
             av_log(NULL, AV_LOG_ERROR, "Could not alloc buffer.\n");
             exit_program(1);
@@ -332,7 +333,7 @@ static int write_option(void *optctx, const OptionDef *po, const char *opt,
 
         dstcount = (int *)(so + 1);
         *so = grow_array(*so, sizeof(**so), dstcount, *dstcount + 1);
-        str = av_strdup(p ? p + 1 : "");
+        str = session_strdup(p ? p + 1 : "");
         if (!str)
             return AVERROR(ENOMEM);
         (*so)[*dstcount - 1].specifier = str;
@@ -341,8 +342,9 @@ static int write_option(void *optctx, const OptionDef *po, const char *opt,
 
     if (po->flags & OPT_STRING) {
         char *str;
-        str = av_strdup(arg);
-        av_freep(dst);
+        /* globals outlive the session arena, only per-file options use it */
+        str = po->flags & (OPT_OFFSET | OPT_SPEC) ? session_strdup(arg) : av_strdup(arg);
+        session_freep(dst);
         if (!str)
             return AVERROR(ENOMEM);
         *(char **)dst = str;
@@ -668,7 +670,7 @@ void uninit_parse_context(OptionParseContext *octx)
         OptionGroupList *l = &octx->groups[i];
 
         for (j = 0; j < l->nb_groups; j++) {
-            av_freep(&l->groups[j].opts);
+            session_freep(&l->groups[j].opts);
             av_dict_free(&l->groups[j].codec_opts);
             av_dict_free(&l->groups[j].format_opts);
             av_dict_free(&l->groups[j].resample_opts);
@@ -676,12 +678,12 @@ void uninit_parse_context(OptionParseContext *octx)
             av_dict_free(&l->groups[j].sws_dict);
             av_dict_free(&l->groups[j].swr_opts);
         }
-        av_freep(&l->groups);
+        session_freep(&l->groups);
     }
-    av_freep(&octx->groups);
+    session_freep(&octx->groups);
 
-    av_freep(&octx->cur_group.opts);
-    av_freep(&octx->global_opts.opts);
+    session_freep(&octx->cur_group.opts);
+    session_freep(&octx->global_opts.opts);
 
     uninit_opts();
 }
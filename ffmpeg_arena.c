@@ -0,0 +1,182 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+
+#include "ffmpeg_arena.h"
+
+#define ARENA_ALIGN 16
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    size_t last;        ///< offset of the most recent allocation
+    /* keep data[] aligned on 32-bit hosts too */
+    uint64_t data[];
+} ArenaBlock;
+
+struct Arena {
+    ArenaBlock *head;   ///< current block, older blocks follow
+    size_t block_size;
+    ArenaStats stats;
+};
+
+Arena *session_arena;
+
+Arena *arena_alloc(size_t block_size)
+{
+    Arena *arena = av_mallocz(sizeof(*arena));
+
+    if (!arena)
+        return NULL;
+    arena->block_size = FFMAX(block_size, 4096);
+    return arena;
+}
+
+void arena_free(Arena **parena)
+{
+    Arena *arena = *parena;
+    ArenaBlock *b, *next;
+
+    if (!arena)
+        return;
+    for (b = arena->head; b; b = next) {
+        next = b->next;
+        av_free(b);
+    }
+    av_freep(parena);
+}
+
+static ArenaBlock *new_block(Arena *arena, size_t min_size)
+{
+    size_t size = FFMAX(arena->block_size, FFALIGN(min_size, ARENA_ALIGN));
+    ArenaBlock *b;
+
+    if (size > SIZE_MAX - sizeof(*b))
+        return NULL;
+    if (!(b = av_malloc(sizeof(*b) + size)))
+        return NULL;
+    b->next = arena->head;
+    b->size = size;
+    b->used = 0;
+    b->last = 0;
+    arena->head = b;
+    arena->stats.reserved += size;
+    arena->stats.nb_blocks++;
+    return b;
+}
+
+void *arena_mallocz(Arena *arena, size_t size)
+{
+    ArenaBlock *b = arena->head;
+    size_t aligned = FFALIGN(FFMAX(size, 1), ARENA_ALIGN);
+    uint8_t *p;
+
+    if (aligned < size)
+        return NULL;
+    if (!b || b->size - b->used < aligned) {
+        if (!(b = new_block(arena, aligned)))
+            return NULL;
+    }
+    p = (uint8_t *)b->data + b->used;
+    b->last  = b->used;
+    b->used += aligned;
+    arena->stats.allocs++;
+    arena->stats.used += aligned;
+    memset(p, 0, size);
+    return p;
+}
+
+void *arena_realloc_array(Arena *arena, void *ptr, size_t old_nmemb,
+                          size_t nmemb, size_t size)
+{
+    ArenaBlock *b = arena->head;
+    size_t old_size, new_size;
+    void *p;
+
+    if (size && nmemb > SIZE_MAX / size)
+        return NULL;
+    old_size = old_nmemb * size;
+    new_size = nmemb * size;
+
+    /* arrays grown one element at a time usually are the latest allocation */
+    if (ptr && b && (uint8_t *)ptr == (uint8_t *)b->data + b->last) {
+        size_t aligned = FFALIGN(FFMAX(new_size, 1), ARENA_ALIGN);
+        if (aligned >= new_size && b->last + aligned <= b->size) {
+            arena->stats.used += aligned - (b->used - b->last);
+            b->used = b->last + aligned;
+            if (new_size > old_size)
+                memset((uint8_t *)ptr + old_size, 0, new_size - old_size);
+            return ptr;
+        }
+    }
+
+    if (!(p = arena_mallocz(arena, new_size)))
+        return NULL;
+    if (ptr)
+        memcpy(p, ptr, FFMIN(old_size, new_size));
+    return p;
+}
+
+char *arena_strdup(Arena *arena, const char *s)
+{
+    size_t len;
+    char *p;
+
+    if (!s)
+        return NULL;
+    len = strlen(s) + 1;
+    if ((p = arena_mallocz(arena, len)))
+        memcpy(p, s, len);
+    return p;
+}
+
+int arena_owns(const Arena *arena, const void *ptr)
+{
+    const ArenaBlock *b;
+
+    for (b = arena->head; b; b = b->next)
+        if ((const uint8_t *)ptr >= (const uint8_t *)b->data &&
+            (const uint8_t *)ptr <  (const uint8_t *)b->data + b->size)
+            return 1;
+    return 0;
+}
+
+void arena_get_stats(const Arena *arena, ArenaStats *stats)
+{
+    *stats = arena->stats;
+}
+
+void *session_mallocz(size_t size)
+{
+    if (!session_arena)
+        return av_mallocz(size);
+    return arena_mallocz(session_arena, size);
+}
+
+void *session_realloc_array(void *ptr, size_t old_nmemb, size_t nmemb, size_t size)
+{
+    /* arrays started before the arena existed stay on the heap */
+    if (!session_arena || (ptr && !arena_owns(session_arena, ptr)))
+        return av_realloc_array(ptr, nmemb, size);
+    return arena_realloc_array(session_arena, ptr, old_nmemb, nmemb, size);
+}
+
+char *session_strdup(const char *s)
+{
+    if (!session_arena)
+        return av_strdup(s);
+    return arena_strdup(session_arena, s);
+}
+
+void session_freep(void *arg)
+{
+    void **ptr = arg;
+
+    if (session_arena && *ptr && arena_owns(session_arena, *ptr))
+        *ptr = NULL;
+    else
+        av_freep(arg);
+}
@@ -0,0 +1,63 @@
+#ifndef FFMPEG_ARENA_H
+#define FFMPEG_ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump allocator for state that lives exactly as long as a transcode
+ * session: parsed options, specifier arrays and the setup structures built
+ * from them. Individual frees are no-ops, the whole arena is released at
+ * once when the session ends, so a long-running server does not fragment
+ * its heap with thousands of small per-job allocations.
+ */
+
+typedef struct Arena Arena;
+
+typedef struct ArenaStats {
+    size_t allocs;      ///< number of allocations served
+    size_t used;        ///< bytes handed out, including alignment
+    size_t reserved;    ///< bytes in blocks obtained from av_malloc()
+    int nb_blocks;
+} ArenaStats;
+
+Arena *arena_alloc(size_t block_size);
+void arena_free(Arena **arena);
+
+/**
+ * @return zeroed memory aligned for any option value, NULL on failure
+ */
+void *arena_mallocz(Arena *arena, size_t size);
+
+/**
+ * Resize an array allocated from the arena. The last allocation of the
+ * current block grows in place, anything else is copied.
+ */
+void *arena_realloc_array(Arena *arena, void *ptr, size_t old_nmemb,
+                          size_t nmemb, size_t size);
+
+char *arena_strdup(Arena *arena, const char *s);
+
+/**
+ * @return non-zero if ptr points into one of the arena's blocks
+ */
+int arena_owns(const Arena *arena, const void *ptr);
+
+void arena_get_stats(const Arena *arena, ArenaStats *stats);
+
+/**
+ * Arena of the running session, set up by run_transcoding(). When it is
+ * NULL the session_* helpers behave like their av_* counterparts.
+ */
+extern Arena *session_arena;
+
+void *session_mallocz(size_t size);
+void *session_realloc_array(void *ptr, size_t old_nmemb, size_t nmemb, size_t size);
+char *session_strdup(const char *s);
+
+/**
+ * av_freep() for memory that may come from the session arena, which is
+ * only released with the arena itself.
+ */
+void session_freep(void *ptr);
+
+#endif
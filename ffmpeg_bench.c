@@ -0,0 +1,205 @@
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+
+#include "ffmpeg_bench.h"
+
+static const char *const bench_stage_names[BENCH_NB] = {
+    [BENCH_DEMUX]  = "demux",
+    [BENCH_DECODE] = "decode",
+    [BENCH_FILTER] = "filter",
+    [BENCH_ENCODE] = "encode",
+    [BENCH_BSF]    = "bsf",
+    [BENCH_MUX]    = "mux",
+};
+
+static const char *const bench_perf_names[BENCH_PERF_NB] = {
+    [BENCH_PERF_CYCLES]           = "cycles",
+    [BENCH_PERF_INSTRUCTIONS]     = "instructions",
+    [BENCH_PERF_CACHE_MISSES]     = "cache_misses",
+    [BENCH_PERF_CONTEXT_SWITCHES] = "context_switches",
+};
+
+static int perf_fds[BENCH_PERF_NB] = { -1, -1, -1, -1 };
+
+const char *bench_stage_name(enum BenchStage stage)
+{
+    if ((unsigned)stage >= BENCH_NB)
+        return "unknown";
+    return bench_stage_names[stage];
+}
+
+void bench_record(BenchStats *stats, enum BenchStage stage, int64_t usec)
+{
+    BenchHistogram *h;
+    int bucket;
+
+    if (!stats || (unsigned)stage >= BENCH_NB)
+        return;
+    if (usec < 0)
+        usec = 0;
+
+    h = &stats->stage[stage];
+    if (usec >= INT64_C(1) << (BENCH_HIST_BUCKETS - 2))
+        bucket = BENCH_HIST_BUCKETS - 1;
+    else
+        bucket = usec ? av_log2(usec) + 1 : 0;
+
+    h->count++;
+    h->total += usec;
+    if (usec > h->max)
+        h->max = usec;
+    h->buckets[bucket]++;
+}
+
+#ifdef __linux__
+static int perf_open(uint32_t type, uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.read_format    = PERF_FORMAT_GROUP;
+    attr.disabled       = group_fd < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+#endif
+
+int bench_perf_init(void)
+{
+#ifdef __linux__
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[BENCH_PERF_NB] = {
+        [BENCH_PERF_CYCLES]           = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES       },
+        [BENCH_PERF_INSTRUCTIONS]     = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS     },
+        [BENCH_PERF_CACHE_MISSES]     = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES     },
+        [BENCH_PERF_CONTEXT_SWITCHES] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    };
+    int i;
+
+    for (i = 0; i < BENCH_PERF_NB; i++) {
+        perf_fds[i] = perf_open(events[i].type, events[i].config, i ? perf_fds[0] : -1);
+        if (perf_fds[i] < 0) {
+            int ret = AVERROR(errno);
+            av_log(NULL, AV_LOG_WARNING, "Cannot open %s perf counter: %s\n",
+                   bench_perf_names[i], av_err2str(ret));
+            bench_perf_uninit();
+            return ret;
+        }
+    }
+
+    /* one syscall starts and reads the whole group */
+    ioctl(perf_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return 0;
+#else
+    return AVERROR(ENOSYS);
+#endif
+}
+
+void bench_perf_uninit(void)
+{
+    int i;
+
+    for (i = 0; i < BENCH_PERF_NB; i++) {
+        if (perf_fds[i] >= 0)
+            close(perf_fds[i]);
+        perf_fds[i] = -1;
+    }
+}
+
+int bench_perf_read(uint64_t v[BENCH_PERF_NB])
+{
+    /* PERF_FORMAT_GROUP layout: nr followed by one value per event */
+    uint64_t buf[1 + BENCH_PERF_NB];
+    int i;
+
+    if (perf_fds[0] < 0)
+        return AVERROR(EINVAL);
+    if (read(perf_fds[0], buf, sizeof(buf)) != sizeof(buf))
+        return AVERROR(EIO);
+
+    for (i = 0; i < BENCH_PERF_NB; i++)
+        v[i] = buf[1 + i];
+    return 0;
+}
+
+void bench_record_perf(BenchStats *stats, enum BenchStage stage,
+                       const uint64_t delta[BENCH_PERF_NB])
+{
+    int i;
+
+    if (!stats || (unsigned)stage >= BENCH_NB)
+        return;
+    for (i = 0; i < BENCH_PERF_NB; i++)
+        stats->stage[stage].perf[i] += delta[i];
+}
+
+uint64_t bench_percentile(const BenchHistogram *h, double p)
+{
+    uint64_t target, seen = 0;
+    int i;
+
+    if (!h->count)
+        return 0;
+
+    target = FFMAX(1, (uint64_t)(p * h->count + 0.5));
+    for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target)
+            return FFMIN(i ? UINT64_C(1) << i : 1, h->max);
+    }
+    return h->max;
+}
+
+void bench_print_json(AVBPrint *bp, const BenchStats *stats)
+{
+    int i, j, first = 1;
+
+    av_bprintf(bp, "{");
+    for (i = 0; i < BENCH_NB; i++) {
+        const BenchHistogram *h = &stats->stage[i];
+        int last;
+
+        if (!h->count)
+            continue;
+
+        for (last = BENCH_HIST_BUCKETS - 1; last > 0 && !h->buckets[last]; last--)
+            ;
+
+        av_bprintf(bp, "%s\"%s\":{\"count\":%"PRIu64",\"total_us\":%"PRIu64","
+                   "\"avg_us\":%.1f,\"p50_us\":%"PRIu64",\"p90_us\":%"PRIu64","
+                   "\"p99_us\":%"PRIu64",\"max_us\":%"PRIu64",\"log2_buckets\":[",
+                   first ? "" : ",", bench_stage_name(i), h->count, h->total,
+                   (double)h->total / h->count,
+                   bench_percentile(h, 0.50), bench_percentile(h, 0.90),
+                   bench_percentile(h, 0.99), h->max);
+        for (j = 0; j <= last; j++)
+            av_bprintf(bp, "%s%"PRIu64, j ? "," : "", h->buckets[j]);
+        av_bprintf(bp, "]");
+        if (perf_fds[0] >= 0) {
+            for (j = 0; j < BENCH_PERF_NB; j++)
+                av_bprintf(bp, ",\"%s\":%"PRIu64, bench_perf_names[j], h->perf[j]);
+            av_bprintf(bp, ",\"ipc\":%.3f", h->perf[BENCH_PERF_CYCLES] ?
+                       (double)h->perf[BENCH_PERF_INSTRUCTIONS] / h->perf[BENCH_PERF_CYCLES] : 0.0);
+        }
+        av_bprintf(bp, "}");
+        first = 0;
+    }
+    av_bprintf(bp, "}");
+}
@@ -0,0 +1,85 @@
+#ifndef FFMPEG_BENCH_H
+#define FFMPEG_BENCH_H
+
+#include <stdint.h>
+
+#include <libavutil/bprint.h>
+
+enum BenchStage {
+    BENCH_DEMUX,
+    BENCH_DECODE,
+    BENCH_FILTER,
+    BENCH_ENCODE,
+    BENCH_BSF,
+    BENCH_MUX,
+    BENCH_NB
+};
+
+enum BenchPerfCounter {
+    BENCH_PERF_CYCLES,
+    BENCH_PERF_INSTRUCTIONS,
+    BENCH_PERF_CACHE_MISSES,
+    BENCH_PERF_CONTEXT_SWITCHES,
+    BENCH_PERF_NB
+};
+
+/* bucket 0 counts samples below 1us, bucket i samples in [2^(i-1), 2^i) us,
+ * the last bucket collects everything above ~67s */
+#define BENCH_HIST_BUCKETS 28
+
+typedef struct BenchHistogram {
+    uint64_t count;
+    uint64_t total;         ///< sum of all samples in microseconds
+    uint64_t max;
+    uint64_t buckets[BENCH_HIST_BUCKETS];
+    uint64_t perf[BENCH_PERF_NB];   ///< hardware counter totals, with -benchmark_perf
+} BenchHistogram;
+
+typedef struct BenchStats {
+    BenchHistogram stage[BENCH_NB];
+} BenchStats;
+
+const char *bench_stage_name(enum BenchStage stage);
+
+/**
+ * Add one latency sample (in microseconds) to the histogram of a stage.
+ * This only touches a few counters and is safe to call per packet.
+ */
+void bench_record(BenchStats *stats, enum BenchStage stage, int64_t usec);
+
+/**
+ * @return the upper bound in microseconds of the bucket holding the
+ *         given percentile (0.0 - 1.0) of the samples
+ */
+uint64_t bench_percentile(const BenchHistogram *h, double p);
+
+/**
+ * Open the perf_event_open() counter group for the calling thread.
+ * Only the thread driving the transcode loop is counted: time a stage
+ * spends waiting on codec or filter worker threads shows up in its wall
+ * time and context switches, the workers' own cycles are not included.
+ *
+ * @return 0 on success, a negative AVERROR if the counters are unavailable
+ */
+int bench_perf_init(void);
+void bench_perf_uninit(void);
+
+/**
+ * Read the current counter values into v.
+ *
+ * @return 0 on success, <0 if the counters are not open
+ */
+int bench_perf_read(uint64_t v[BENCH_PERF_NB]);
+
+/**
+ * Add counter deltas to the totals of a stage.
+ */
+void bench_record_perf(BenchStats *stats, enum BenchStage stage,
+                       const uint64_t delta[BENCH_PERF_NB]);
+
+/**
+ * Append the non-empty stages of stats as a JSON object to bp.
+ */
+void bench_print_json(AVBPrint *bp, const BenchStats *stats);
+
+#endif
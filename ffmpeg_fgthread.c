@@ -0,0 +1,335 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/threadmessage.h>
+
+#include "transcoding.h"
+#include "ffmpeg_fgthread.h"
+
+typedef struct FgThreadMessage {
+    int input;
+    AVFrame *frame;     ///< NULL for EOF
+} FgThreadMessage;
+
+struct FilterGraphThread {
+    FilterGraph *fg;
+    pthread_t thread;
+    int thread_started;
+    AVThreadMessageQueue *in;
+    AVThreadMessageQueue **out;     ///< one per graph output
+    int *out_eof;
+    atomic_int *frame_size;         ///< one per graph output, -1 until the encoder is open
+    int *frame_size_set;            ///< the executor applied frame_size
+    atomic_int *failed_requests;    ///< one per graph input
+    atomic_int queued;              ///< messages not completely filtered yet
+    atomic_int status;              ///< AVERROR_EOF or error once finished
+    AVFrame *frame;
+};
+
+static void free_frame_msg(void *msg)
+{
+    av_frame_free(&((FgThreadMessage *)msg)->frame);
+}
+
+static void free_frame(void *msg)
+{
+    av_frame_free((AVFrame **)msg);
+}
+
+/* move everything the buffersinks hold to the output queues */
+static int drain_sinks(FilterGraphThread *t)
+{
+    FilterGraph *fg = t->fg;
+    int i, ret;
+
+    for (i = 0; i < fg->nb_outputs; i++) {
+        if (t->out_eof[i])
+            continue;
+        while ((ret = av_buffersink_get_frame_flags(fg->outputs[i]->filter, t->frame,
+                                                    AV_BUFFERSINK_FLAG_NO_REQUEST)) >= 0) {
+            AVFrame *f = av_frame_alloc();
+
+            if (!f)
+                return AVERROR(ENOMEM);
+            av_frame_move_ref(f, t->frame);
+            /* blocks until the main thread reaps, fails when stopped */
+            if ((ret = av_thread_message_queue_send(t->out[i], &f, 0)) < 0) {
+                av_frame_free(&f);
+                return ret;
+            }
+            loop_event_signal();
+        }
+        if (ret == AVERROR_EOF) {
+            t->out_eof[i] = 1;
+            av_thread_message_queue_set_err_recv(t->out[i], AVERROR_EOF);
+            loop_event_signal();
+        } else if (ret != AVERROR(EAGAIN)) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/* Apply the frame sizes of the encoders opened since the last call. The
+ * buffersinks keep frames as they get them, so no frame may reach one
+ * before its size is set: the graph does not run while any is unknown. */
+static int frame_sizes_pending(FilterGraphThread *t)
+{
+    FilterGraph *fg = t->fg;
+    int i, pending = 0;
+
+    for (i = 0; i < fg->nb_outputs; i++) {
+        int frame_size;
+
+        if (t->frame_size_set[i])
+            continue;
+        frame_size = atomic_load(&t->frame_size[i]);
+        if (frame_size < 0) {
+            pending = 1;
+            continue;
+        }
+        if (frame_size)
+            av_buffersink_set_frame_size(fg->outputs[i]->filter, frame_size);
+        t->frame_size_set[i] = 1;
+    }
+    return pending;
+}
+
+/* what the main thread did with avfilter_graph_request_oldest() and
+ * reap_filters() between two packets, until the graph needs input */
+static int run_graph(FilterGraphThread *t)
+{
+    int ret;
+
+    if ((ret = drain_sinks(t)) < 0)
+        return ret;
+    while ((ret = avfilter_graph_request_oldest(t->fg->graph)) >= 0)
+        if ((ret = drain_sinks(t)) < 0)
+            return ret;
+    if (ret == AVERROR_EOF && (ret = drain_sinks(t)) >= 0)
+        ret = AVERROR_EOF;
+    return ret;
+}
+
+static void *fg_thread_main(void *arg)
+{
+    FilterGraphThread *t = arg;
+    FilterGraph *fg = t->fg;
+    FgThreadMessage msg;
+    int i, ret, pending;
+
+    /* frames queued up while the graph was configured come first */
+    ret = frame_sizes_pending(t) ? 0 : run_graph(t);
+    for (;;) {
+        if (ret < 0 && ret != AVERROR(EAGAIN)) {
+            if (ret != AVERROR_EOF && ret != AVERROR_EXIT)
+                av_log(NULL, AV_LOG_ERROR, "Error while filtering in filtergraph #%d: %s\n",
+                       fg->index, av_err2str(ret));
+            for (i = 0; i < fg->nb_outputs; i++)
+                av_thread_message_queue_set_err_recv(t->out[i], ret);
+            atomic_store(&t->status, ret);
+            atomic_fetch_sub(&t->queued, 1);
+            loop_event_signal();
+            break;
+        }
+
+        for (i = 0; i < fg->nb_inputs; i++)
+            atomic_store(&t->failed_requests[i],
+                         av_buffersrc_get_nb_failed_requests(fg->inputs[i]->filter));
+        atomic_fetch_sub(&t->queued, 1);
+        loop_event_signal();
+
+        if (av_thread_message_queue_recv(t->in, &msg, 0) < 0)
+            break;
+        /* until the sizes are known the input waits in the buffersrcs */
+        pending = frame_sizes_pending(t);
+        ret = 0;
+        if (msg.input >= 0) {
+            ret = av_buffersrc_add_frame_flags(fg->inputs[msg.input]->filter, msg.frame,
+                                               pending ? 0 : AV_BUFFERSRC_FLAG_PUSH);
+            av_frame_free(&msg.frame);
+        }
+        if (ret >= 0 || ret == AVERROR_EOF)
+            ret = pending ? 0 : run_graph(t);
+    }
+    return NULL;
+}
+
+int fg_thread_start(FilterGraph *fg)
+{
+    FilterGraphThread *t = av_mallocz(sizeof(*t));
+    int i, ret = AVERROR(ENOMEM);
+
+    if (!t)
+        return ret;
+    t->fg = fg;
+    fg->thread = t;
+    if (!(t->out             = av_mallocz_array(fg->nb_outputs, sizeof(*t->out))) ||
+        !(t->out_eof         = av_mallocz_array(fg->nb_outputs, sizeof(*t->out_eof))) ||
+        !(t->frame_size      = av_mallocz_array(fg->nb_outputs, sizeof(*t->frame_size))) ||
+        !(t->frame_size_set  = av_mallocz_array(fg->nb_outputs, sizeof(*t->frame_size_set))) ||
+        !(t->failed_requests = av_mallocz_array(fg->nb_inputs, sizeof(*t->failed_requests))) ||
+        !(t->frame           = av_frame_alloc()))
+        goto fail;
+
+    if ((ret = av_thread_message_queue_alloc(&t->in, FG_THREAD_QUEUE_SIZE * fg->nb_inputs,
+                                             sizeof(FgThreadMessage))) < 0)
+        goto fail;
+    av_thread_message_queue_set_free_func(t->in, free_frame_msg);
+    for (i = 0; i < fg->nb_outputs; i++) {
+        OutputStream *ost = fg->outputs[i]->ost;
+
+        /* an open encoder had its frame size set by configure_filtergraph() */
+        if (ost && !ost->initialized && ost->enc &&
+            ost->enc->type == AVMEDIA_TYPE_AUDIO &&
+            !(ost->enc->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE))
+            atomic_store(&t->frame_size[i], -1);
+        else
+            t->frame_size_set[i] = 1;
+        if ((ret = av_thread_message_queue_alloc(&t->out[i], FG_THREAD_QUEUE_SIZE,
+                                                 sizeof(AVFrame *))) < 0)
+            goto fail;
+        av_thread_message_queue_set_free_func(t->out[i], free_frame);
+    }
+
+    atomic_store(&t->queued, 1);
+    if ((ret = pthread_create(&t->thread, NULL, fg_thread_main, t))) {
+        ret = AVERROR(ret);
+        goto fail;
+    }
+    t->thread_started = 1;
+    return 0;
+fail:
+    av_log(NULL, AV_LOG_ERROR, "Could not start the thread of filtergraph #%d: %s\n",
+           fg->index, av_err2str(ret));
+    fg_thread_free(fg);
+    return ret;
+}
+
+void fg_thread_free(FilterGraph *fg)
+{
+    FilterGraphThread *t = fg->thread;
+    int i;
+
+    if (!t)
+        return;
+    if (t->in) {
+        av_thread_message_queue_set_err_recv(t->in, AVERROR_EXIT);
+        for (i = 0; i < fg->nb_outputs; i++)
+            if (t->out[i])
+                av_thread_message_queue_set_err_send(t->out[i], AVERROR_EXIT);
+        if (t->thread_started)
+            pthread_join(t->thread, NULL);
+        av_thread_message_flush(t->in);
+        av_thread_message_queue_free(&t->in);
+    }
+    for (i = 0; t->out && i < fg->nb_outputs; i++) {
+        if (t->out[i])
+            av_thread_message_flush(t->out[i]);
+        av_thread_message_queue_free(&t->out[i]);
+    }
+    av_freep(&t->out);
+    av_freep(&t->out_eof);
+    av_freep(&t->frame_size);
+    av_freep(&t->frame_size_set);
+    av_freep(&t->failed_requests);
+    av_frame_free(&t->frame);
+    av_freep(&fg->thread);
+}
+
+static int input_index(FilterGraph *fg, InputFilter *ifilter)
+{
+    int i;
+
+    for (i = 0; i < fg->nb_inputs; i++)
+        if (fg->inputs[i] == ifilter)
+            return i;
+    return -1;
+}
+
+int fg_thread_send(InputFilter *ifilter, AVFrame *frame, int flags)
+{
+    FilterGraphThread *t = ifilter->graph->thread;
+    FgThreadMessage msg = { input_index(ifilter->graph, ifilter), NULL };
+    int ret;
+
+    if ((ret = atomic_load(&t->status)) < 0)
+        return ret == AVERROR_EOF ? 0 : ret;
+    if (frame) {
+        if (!(msg.frame = av_frame_alloc()))
+            return AVERROR(ENOMEM);
+        if ((ret = av_frame_ref(msg.frame, frame)) < 0) {
+            av_frame_free(&msg.frame);
+            return ret;
+        }
+    }
+
+    atomic_fetch_add(&t->queued, 1);
+    ret = av_thread_message_queue_send(t->in, &msg, AV_THREAD_MESSAGE_NONBLOCK);
+    if (ret < 0) {
+        atomic_fetch_sub(&t->queued, 1);
+        av_frame_free(&msg.frame);
+        return ret;
+    }
+    if (frame && !(flags & AV_BUFFERSRC_FLAG_KEEP_REF))
+        av_frame_unref(frame);
+    return 0;
+}
+
+int fg_thread_receive(OutputFilter *ofilter, AVFrame *frame)
+{
+    FilterGraph *fg = ofilter->graph;
+    AVFrame *f;
+    int i, ret;
+
+    for (i = 0; i < fg->nb_outputs; i++)
+        if (fg->outputs[i] == ofilter)
+            break;
+    if (i == fg->nb_outputs)
+        return AVERROR(EINVAL);
+
+    ret = av_thread_message_queue_recv(fg->thread->out[i], &f, AV_THREAD_MESSAGE_NONBLOCK);
+    if (ret < 0)
+        return ret;
+    av_frame_move_ref(frame, f);
+    av_frame_free(&f);
+    return 0;
+}
+
+int fg_thread_poll(FilterGraph *fg)
+{
+    FilterGraphThread *t = fg->thread;
+    int status = atomic_load(&t->status);
+
+    if (status < 0)
+        return status;
+    return atomic_load(&t->queued) ? AVERROR(EAGAIN) : 0;
+}
+
+void fg_thread_set_frame_size(OutputFilter *ofilter, int frame_size)
+{
+    FilterGraph *fg = ofilter->graph;
+    FgThreadMessage msg = { -1, NULL };
+    int i;
+
+    for (i = 0; i < fg->nb_outputs; i++)
+        if (fg->outputs[i] == ofilter)
+            break;
+    if (i == fg->nb_outputs)
+        return;
+    atomic_store(&fg->thread->frame_size[i], frame_size);
+    /* wake the executor to run the graph; with the queue full it wakes
+     * for the queued input anyway */
+    atomic_fetch_add(&fg->thread->queued, 1);
+    if (av_thread_message_queue_send(fg->thread->in, &msg, AV_THREAD_MESSAGE_NONBLOCK) < 0)
+        atomic_fetch_sub(&fg->thread->queued, 1);
+}
+
+int fg_thread_failed_requests(InputFilter *ifilter)
+{
+    FilterGraph *fg = ifilter->graph;
+
+    return atomic_load(&fg->thread->failed_requests[input_index(fg, ifilter)]);
+}
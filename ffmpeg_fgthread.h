@@ -0,0 +1,74 @@
+#ifndef FFMPEG_FGTHREAD_H
+#define FFMPEG_FGTHREAD_H
+
+#include <libavutil/frame.h>
+
+/*
+ * Executor thread for one complex filtergraph. The main thread queues
+ * decoded frames for the graph's inputs, the executor pushes them into the
+ * buffersrcs, runs the graph until it needs more input and queues what the
+ * buffersinks produce, so independent -filter_complex graphs filter on
+ * separate cores while decoding, encoding and muxing stay on the main
+ * thread. While the executor runs it owns the AVFilterGraph; the main
+ * thread only touches it again after fg_thread_free().
+ */
+
+struct FilterGraph;
+struct InputFilter;
+struct OutputFilter;
+
+typedef struct FilterGraphThread FilterGraphThread;
+
+/* frames queued per graph input and per graph output */
+#define FG_THREAD_QUEUE_SIZE 8
+
+/**
+ * Hand the configured graph to a new executor thread, stored in fg->thread.
+ */
+int fg_thread_start(struct FilterGraph *fg);
+
+/**
+ * Stop the executor and drop the frames still queued. The graph is not
+ * freed.
+ */
+void fg_thread_free(struct FilterGraph *fg);
+
+/**
+ * Queue a frame for a graph input, NULL to signal EOF. Like
+ * av_buffersrc_add_frame_flags() the frame is moved unless flags contain
+ * AV_BUFFERSRC_FLAG_KEEP_REF.
+ *
+ * @return AVERROR(EAGAIN) if the input queue is full, the frame is left
+ *         untouched then
+ */
+int fg_thread_send(struct InputFilter *ifilter, AVFrame *frame, int flags);
+
+/**
+ * Take a filtered frame of a graph output without blocking.
+ *
+ * @return 0 on success, AVERROR(EAGAIN) if none is queued, AVERROR_EOF
+ *         once the output has ended
+ */
+int fg_thread_receive(struct OutputFilter *ofilter, AVFrame *frame);
+
+/**
+ * @return AVERROR(EAGAIN) while queued input is being filtered,
+ *         AVERROR_EOF or an error once the graph has finished, else 0:
+ *         the graph waits for input
+ */
+int fg_thread_poll(struct FilterGraph *fg);
+
+/**
+ * Set the frame size of an audio output once its encoder is open. The
+ * executor does not run the graph before every such output has one, so
+ * no frame reaches a buffersink before it batches to the encoder's size.
+ */
+void fg_thread_set_frame_size(struct OutputFilter *ofilter, int frame_size);
+
+/**
+ * Buffersrc failed requests of a graph input, as of the last time the
+ * executor became idle. The input with most of them is the one to feed.
+ */
+int fg_thread_failed_requests(struct InputFilter *ifilter);
+
+#endif
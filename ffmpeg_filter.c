@@ -393,6 +393,8 @@ int filtergraph_is_simple(FilterGraph *fg)
 static void cleanup_filtergraph(FilterGraph *fg)
 {
     int i;
+    /* the executor thread still uses the filters until it is joined */
+    fg_thread_free(fg);
     for (i = 0; i < fg->nb_outputs; i++)
         fg->outputs[i]->filter = (AVFilterContext *)NULL;
     for (i = 0; i < fg->nb_inputs; i++)
@@ -1050,6 +1052,17 @@ int configure_filtergraph(FilterGraph *fg)
         fg->graph->nb_threads = filter_complex_nbthreads;
     }
 
+    if (auto_threads && fg->graph->nb_threads <= 0 && fg->nb_inputs)
+        fg->graph->nb_threads = thread_tune_filter(fg->inputs[0]->height, auto_threads_jobs);
+
+    if (thread_pool_session) {
+        fg->graph->opaque  = thread_pool_session;
+        fg->graph->execute = thread_pool_filter_execute;
+        /* without the internal threading nobody fills in a default */
+        if (fg->graph->nb_threads <= 0)
+            fg->graph->nb_threads = thread_pool_nb_threads();
+    }
+
     if ((ret = avfilter_graph_parse2(fg->graph, graph_desc, &inputs, &outputs)) < 0)
         goto fail;
 
@@ -1137,6 +1150,7 @@ int configure_filtergraph(FilterGraph *fg)
         while (av_fifo_size(fg->inputs[i]->frame_queue)) {
             AVFrame *tmp;
             av_fifo_generic_read(fg->inputs[i]->frame_queue, &tmp, sizeof(tmp), NULL);
+            mem_budget_release(&mem_budget_session, mem_frame_size(tmp));
             ret = av_buffersrc_add_frame(fg->inputs[i]->filter, tmp);
             av_frame_free(&tmp);
             if (ret < 0)
@@ -1166,6 +1180,12 @@ int configure_filtergraph(FilterGraph *fg)
         }
     }
 
+    /* reap the new outputs even if no frame is pushed before the next reap */
+    fg->pending = 1;
+
+    /* from here on only the executor touches the graph */
+    if (!simple && filter_complex_parallel && (ret = fg_thread_start(fg)) < 0)
+        goto fail;
     return 0;
 
 fail:
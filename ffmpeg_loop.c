@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/time.h>
+
+#include "ffmpeg_loop.h"
+
+static const int latency_bounds_us[LOOP_LATENCY_BUCKETS - 1] = {
+    100, 250, 500, 1000, 2000, 5000, 10000, 20000,
+};
+
+/* [0] is waited on, [1] written to; the same eventfd on Linux */
+static int event_fds[2] = { -1, -1 };
+static LoopStats stats;
+
+int loop_event_init(void)
+{
+    if (event_fds[0] >= 0)
+        return 0;
+#ifdef __linux__
+    event_fds[0] = event_fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fds[0] < 0)
+        return AVERROR(errno);
+#else
+    if (pipe(event_fds) < 0)
+        return AVERROR(errno);
+    fcntl(event_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(event_fds[1], F_SETFL, O_NONBLOCK);
+#endif
+    return 0;
+}
+
+void loop_event_uninit(void)
+{
+    if (event_fds[1] != event_fds[0] && event_fds[1] >= 0)
+        close(event_fds[1]);
+    if (event_fds[0] >= 0)
+        close(event_fds[0]);
+    event_fds[0] = event_fds[1] = -1;
+}
+
+void loop_event_signal(void)
+{
+    uint64_t one = 1;
+    int fd = event_fds[1];
+
+    if (fd < 0)
+        return;
+    /* only fails when a wakeup is pending already */
+    if (write(fd, &one, fd == event_fds[0] ? sizeof(one) : 1) < 0)
+        return;
+}
+
+static void drain(void)
+{
+    uint64_t buf[8];
+
+    while (read(event_fds[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
+int loop_event_wait(int64_t deadline)
+{
+    struct pollfd pfd = { event_fds[0], POLLIN };
+    int64_t start = av_gettime_relative();
+    int64_t timeout = FFMAX(deadline - start, 0);
+    int ret;
+
+    stats.waits++;
+    if (pfd.fd < 0) {
+        av_usleep(timeout);
+        ret = 0;
+    } else {
+#ifdef __linux__
+        struct timespec ts = { timeout / 1000000, timeout % 1000000 * 1000 };
+        ret = ppoll(&pfd, 1, &ts, NULL);
+#else
+        ret = poll(&pfd, 1, (timeout + 999) / 1000);
+#endif
+        if (ret > 0) {
+            drain();
+            stats.wakeups++;
+        }
+        /* EINTR is a signal, which also is a reason to look again */
+        ret = ret != 0;
+    }
+    stats.wait_us += av_gettime_relative() - start;
+    return ret;
+}
+
+void loop_record_latency(int64_t late_us)
+{
+    int i;
+
+    late_us = FFMAX(late_us, 0);
+    for (i = 0; i < LOOP_LATENCY_BUCKETS - 1; i++)
+        if (late_us <= latency_bounds_us[i])
+            break;
+    stats.latency[i]++;
+    stats.latency_max_us  = FFMAX(stats.latency_max_us, late_us);
+    stats.latency_sum_us += late_us;
+    stats.latency_count++;
+}
+
+void loop_get_stats(LoopStats *s)
+{
+    *s = stats;
+}
+
+void loop_print_json(AVBPrint *bp)
+{
+    int i;
+
+    av_bprintf(bp, "{\"waits\":%"PRIu64",\"wakeups\":%"PRIu64",\"wait_us\":%"PRIu64","
+               "\"latency_max_us\":%"PRId64",\"latency_avg_us\":%.1f,\"latency_buckets\":{",
+               stats.waits, stats.wakeups, stats.wait_us, stats.latency_max_us,
+               stats.latency_count ? (double)stats.latency_sum_us / stats.latency_count : 0.0);
+    for (i = 0; i < LOOP_LATENCY_BUCKETS; i++) {
+        if (i < LOOP_LATENCY_BUCKETS - 1)
+            av_bprintf(bp, "%s\"%d\":%"PRIu64, i ? "," : "", latency_bounds_us[i], stats.latency[i]);
+        else
+            av_bprintf(bp, ",\"inf\":%"PRIu64, stats.latency[i]);
+    }
+    av_bprintf(bp, "}}");
+}
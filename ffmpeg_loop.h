@@ -0,0 +1,60 @@
+#ifndef FFMPEG_LOOP_H
+#define FFMPEG_LOOP_H
+
+#include <stdint.h>
+
+#include <libavutil/bprint.h>
+
+/*
+ * Wakeup source of the transcode loop. When no output can make progress
+ * the loop blocks here until the next known deadline, e.g. the next packet
+ * of a -re input becoming due, or until something signals new work, instead
+ * of sleeping a fixed interval.
+ */
+
+#define LOOP_LATENCY_BUCKETS 9
+
+typedef struct LoopStats {
+    uint64_t waits;
+    uint64_t wakeups;       ///< waits ended by loop_event_signal()
+    uint64_t wait_us;       ///< total time spent blocked
+    /**
+     * How late work was picked up after it became due, e.g. a paced input
+     * packet read after its presentation time, in buckets of up to 0.1,
+     * 0.25, 0.5, 1, 2, 5, 10, 20 ms and above.
+     */
+    uint64_t latency[LOOP_LATENCY_BUCKETS];
+    int64_t latency_max_us;
+    uint64_t latency_sum_us;
+    uint64_t latency_count;
+} LoopStats;
+
+int loop_event_init(void);
+void loop_event_uninit(void);
+
+/**
+ * Wake the loop. Async-signal-safe and callable from any thread.
+ */
+void loop_event_signal(void);
+
+/**
+ * Block until loop_event_signal() is called or until deadline, in
+ * av_gettime_relative() time, has passed.
+ *
+ * @return 1 if woken by a signal, 0 on timeout
+ */
+int loop_event_wait(int64_t deadline);
+
+/**
+ * Record how late work that became due at a known time was picked up.
+ */
+void loop_record_latency(int64_t late_us);
+
+void loop_get_stats(LoopStats *stats);
+
+/**
+ * Append the stats as a JSON object.
+ */
+void loop_print_json(AVBPrint *bp);
+
+#endif
@@ -0,0 +1,61 @@
+#include <libavutil/buffer.h>
+
+#include "ffmpeg_mem.h"
+
+MemBudget mem_budget_process = { .name = "process" };
+MemBudget mem_budget_session = { .name = "session", .parent = &mem_budget_process };
+
+int mem_budget_charge(MemBudget *b, int64_t bytes)
+{
+    int over = 0;
+
+    for (; b; b = b->parent) {
+        long long used = atomic_fetch_add(&b->used, bytes) + bytes;
+        long long peak = atomic_load(&b->peak);
+
+        while (used > peak && !atomic_compare_exchange_weak(&b->peak, &peak, used))
+            ;
+        if (b->limit > 0 && used > b->limit)
+            over = 1;
+    }
+    return over;
+}
+
+void mem_budget_release(MemBudget *b, int64_t bytes)
+{
+    for (; b; b = b->parent)
+        atomic_fetch_add(&b->used, -bytes);
+}
+
+const MemBudget *mem_budget_exceeded(const MemBudget *b)
+{
+    for (; b; b = b->parent)
+        if (b->limit > 0 && atomic_load(&((MemBudget *)b)->used) > b->limit)
+            return b;
+    return NULL;
+}
+
+int64_t mem_packet_size(const AVPacket *pkt)
+{
+    int64_t size = sizeof(*pkt);
+    int i;
+
+    size += pkt->buf ? pkt->buf->size : pkt->size;
+    for (i = 0; i < pkt->side_data_elems; i++)
+        size += pkt->side_data[i].size;
+    return size;
+}
+
+int64_t mem_frame_size(const AVFrame *frame)
+{
+    int64_t size = sizeof(*frame);
+    int i;
+
+    for (i = 0; i < FF_ARRAY_ELEMS(frame->buf) && frame->buf[i]; i++)
+        size += frame->buf[i]->size;
+    for (i = 0; i < frame->nb_extended_buf; i++)
+        size += frame->extended_buf[i]->size;
+    for (i = 0; i < frame->nb_side_data; i++)
+        size += frame->side_data[i]->size;
+    return size;
+}
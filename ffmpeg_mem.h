@@ -0,0 +1,54 @@
+#ifndef FFMPEG_MEM_H
+#define FFMPEG_MEM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+
+/*
+ * Byte accounting for packets and frames parked in queues: the muxing
+ * queues waiting for the output header, the filter input queues waiting
+ * for a complete graph and trans2's segment packet lists. Budgets form a
+ * chain, a charge against the session budget also counts against the
+ * process budget, and a limit of 0 only accounts without limiting.
+ */
+
+typedef struct MemBudget {
+    const char *name;
+    int64_t limit;              ///< bytes, 0 for no limit
+    atomic_llong used;
+    atomic_llong peak;
+    struct MemBudget *parent;
+} MemBudget;
+
+/* shared by every session and thread of the process; a server forking one
+ * process per session, like cffmpeg, chains it to a budget in shared memory */
+extern MemBudget mem_budget_process;
+/* the transcode session of run_transcoding(), parent is the process budget */
+extern MemBudget mem_budget_session;
+
+/**
+ * Account bytes against the budget and all its parents.
+ *
+ * @return 1 if the budget or one of its parents is over its limit
+ *         afterwards, 0 otherwise
+ */
+int mem_budget_charge(MemBudget *b, int64_t bytes);
+
+void mem_budget_release(MemBudget *b, int64_t bytes);
+
+/**
+ * @return the budget of the chain that is over its limit, NULL if none is
+ */
+const MemBudget *mem_budget_exceeded(const MemBudget *b);
+
+/**
+ * Bytes held by a queued packet or frame: the struct, the payload and the
+ * side data. Shared buffers are counted in full for every reference.
+ */
+int64_t mem_packet_size(const AVPacket *pkt);
+int64_t mem_frame_size(const AVFrame *frame);
+
+#endif
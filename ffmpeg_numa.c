@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+
+#include "ffmpeg_numa.h"
+
+#ifdef __linux__
+
+/* from linux/mempolicy.h, which userspace headers do not always ship */
+#define MPOL_PREFERRED 1
+
+typedef struct NumaNode {
+    int id;                     ///< kernel node number
+    cpu_set_t cpus;
+} NumaNode;
+
+static NumaNode nodes[NUMA_MAX_NODES];
+static int nb_nodes;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+static int rr_next = -1;
+
+static int parse_cpulist(const char *list, cpu_set_t *set)
+{
+    const char *p = list;
+
+    CPU_ZERO(set);
+    while (*p && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+
+        if (end == p || first < 0)
+            return AVERROR(EINVAL);
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return AVERROR(EINVAL);
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++)
+            CPU_SET(first, set);
+        p = end;
+        if (*p == ',')
+            p++;
+        else if (*p && *p != '\n')
+            return AVERROR(EINVAL);
+    }
+    return 0;
+}
+
+static void load_topology(void)
+{
+    DIR *dir = opendir("/sys/devices/system/node");
+    struct dirent *e;
+
+    while (dir && (e = readdir(dir)) && nb_nodes < NUMA_MAX_NODES) {
+        char path[300], list[4096];
+        FILE *f;
+        int id;
+
+        if (sscanf(e->d_name, "node%d", &id) != 1)
+            continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", e->d_name);
+        if (!(f = fopen(path, "r")))
+            continue;
+        if (fgets(list, sizeof(list), f) &&
+            parse_cpulist(list, &nodes[nb_nodes].cpus) >= 0 &&
+            CPU_COUNT(&nodes[nb_nodes].cpus)) {
+            nodes[nb_nodes].id = id;
+            nb_nodes++;
+        }
+        fclose(f);
+    }
+    if (dir)
+        closedir(dir);
+}
+
+int numa_nb_nodes(void)
+{
+    pthread_once(&topology_once, load_topology);
+    return FFMAX(nb_nodes, 1);
+}
+
+/* busy and total jiffies per node since boot */
+static int read_node_times(unsigned long long *busy, unsigned long long *total)
+{
+    char line[512];
+    FILE *f = fopen("/proc/stat", "r");
+    int i;
+
+    if (!f)
+        return AVERROR(errno);
+    memset(busy,  0, nb_nodes * sizeof(*busy));
+    memset(total, 0, nb_nodes * sizeof(*total));
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long v[8] = { 0 }, sum = 0;
+        int cpu, j;
+
+        if (sscanf(line, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu", &cpu,
+                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) < 5)
+            continue;
+        for (j = 0; j < 8; j++)
+            sum += v[j];
+        for (i = 0; i < nb_nodes; i++)
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &nodes[i].cpus)) {
+                busy[i]  += sum - v[3] - v[4];    /* minus idle and iowait */
+                total[i] += sum;
+            }
+    }
+    fclose(f);
+    return 0;
+}
+
+static int least_busy_node(void)
+{
+    unsigned long long busy0[NUMA_MAX_NODES], total0[NUMA_MAX_NODES];
+    unsigned long long busy1[NUMA_MAX_NODES], total1[NUMA_MAX_NODES];
+    double best_load = 2;
+    int i, best = 0;
+
+    if (read_node_times(busy0, total0) < 0)
+        return 0;
+    usleep(50000);
+    if (read_node_times(busy1, total1) < 0)
+        return 0;
+    for (i = 0; i < nb_nodes; i++) {
+        unsigned long long t = total1[i] - total0[i];
+        double load = t ? (double)(busy1[i] - busy0[i]) / t : 0;
+
+        if (load < best_load) {
+            best_load = load;
+            best = i;
+        }
+    }
+    return best;
+}
+
+int numa_pick_node(const char *policy, const int *sessions)
+{
+    int i, n = numa_nb_nodes();
+    char *end;
+    long node;
+
+    if (!strcmp(policy, "rr")) {
+        /* sessions started as separate processes spread by pid */
+        __sync_bool_compare_and_swap(&rr_next, -1, getpid() & INT_MAX);
+        return (unsigned)__sync_fetch_and_add(&rr_next, 1) % n;
+    }
+    if (!strcmp(policy, "least")) {
+        int best = 0;
+
+        if (!sessions)
+            return nb_nodes > 1 ? least_busy_node() : 0;
+        for (i = 1; i < n; i++)
+            if (sessions[i] < sessions[best])
+                best = i;
+        return best;
+    }
+
+    node = strtol(policy, &end, 10);
+    if (end == policy || *end || node < 0 || node >= n)
+        return AVERROR(EINVAL);
+    return node;
+}
+
+int numa_bind_node(int node)
+{
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1] = { 0 };
+    int id;
+
+    /* no topology in sysfs, nothing to bind to */
+    if (numa_nb_nodes() && !nb_nodes)
+        return 0;
+    if (node < 0 || node >= nb_nodes)
+        return AVERROR(EINVAL);
+
+    if (sched_setaffinity(0, sizeof(nodes[node].cpus), &nodes[node].cpus) < 0)
+        return AVERROR(errno);
+
+    /* preferred rather than bound: a full node spills over instead of
+     * failing allocations */
+    id = nodes[node].id;
+    if (id < NUMA_MAX_NODES) {
+        mask[id / (8 * sizeof(unsigned long))] |= 1UL << (id % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, NUMA_MAX_NODES + 1) < 0)
+            av_log(NULL, AV_LOG_WARNING, "Could not prefer memory of NUMA node %d: %s\n",
+                   id, strerror(errno));
+    }
+    return 0;
+}
+
+int numa_bind_cpus(const char *cpulist)
+{
+    cpu_set_t set;
+    int ret;
+
+    if ((ret = parse_cpulist(cpulist, &set)) < 0)
+        return ret;
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        return AVERROR(errno);
+    return 0;
+}
+
+#else
+
+int numa_nb_nodes(void)
+{
+    return 1;
+}
+
+int numa_pick_node(const char *policy, const int *sessions)
+{
+    return 0;
+}
+
+int numa_bind_node(int node)
+{
+    return 0;
+}
+
+int numa_bind_cpus(const char *cpulist)
+{
+    return AVERROR(ENOSYS);
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef FFMPEG_NUMA_H
+#define FFMPEG_NUMA_H
+
+/*
+ * Placement of a session on one NUMA node: its threads are pinned to the
+ * node's CPUs and its memory is preferably allocated from the node, so
+ * frame buffers stay local to the cores working on them. The topology is
+ * read from sysfs; on other systems, or hosts with a single node, every
+ * call is a successful no-op.
+ */
+
+#define NUMA_MAX_NODES 64
+
+/**
+ * @return number of NUMA nodes with CPUs, at least 1
+ */
+int numa_nb_nodes(void);
+
+/**
+ * Choose a node for a new session.
+ *
+ * @param policy "rr" for round-robin, "least" for the node with the lowest
+ *               load, or a node index
+ * @param sessions sessions currently placed on each node, used as the load
+ *                 by "least" when not NULL; otherwise the CPU usage of the
+ *                 node's cores is sampled
+ * @return node index, <0 on an invalid policy
+ */
+int numa_pick_node(const char *policy, const int *sessions);
+
+/**
+ * Pin the calling thread, and every thread it starts afterwards, to the
+ * CPUs of a node, and make the node the preferred one for its memory.
+ */
+int numa_bind_node(int node);
+
+/**
+ * Pin the calling thread and its future threads to a CPU list such as
+ * "0-7,16-23".
+ */
+int numa_bind_cpus(const char *cpulist);
+
+#endif
@@ -2,6 +2,8 @@
 #include "transcoding.h"
 #include "cmdutils.h"
 #include "ffmpeg_opt.h"
+#include "ffmpeg_trace.h"
+#include "remux.h"
 
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
@@ -93,9 +95,17 @@ int audio_volume      = 256;
 int audio_sync_method = 0;
 int video_sync_method = VSYNC_AUTO;
 float frame_drop_threshold = 0;
+int drop_predict = 0;
+int preview_mode = 0;
+int smart_cut = 0;
+int fast_remux = 0;
 int do_deinterlace    = 0;
 int do_benchmark      = 1;    //默认值 int do_benchmark      = 0; 
 int do_benchmark_all  = 0;
+int do_benchmark_perf = 0;
+char *benchmark_filename;
+int use_frame_pool    = 0;
+int frame_pool_hugepages = 0;
 int do_hex_dump       = 0;
 int do_pkt_dump       = 0;
 int copy_ts           = 0;
@@ -111,6 +121,13 @@ int frame_bits_per_raw_sample = 0;
 float max_error_rate  = 2.0/3;
 int filter_nbthreads = 0;
 int filter_complex_nbthreads = 0;
+int filter_complex_parallel = 0;
+int reinit_prescale   = 0;
+int thread_pool_size  = 0;
+int auto_threads      = 0;
+int auto_threads_jobs = 0;
+char *numa_placement  = NULL;
+char *cpu_set_list    = NULL;
 int vstats_version = 2;
 
 
@@ -957,6 +974,9 @@ const OptionDef options[] = {
     { "itsoffset",      HAS_ARG | OPT_TIME | OPT_OFFSET |
                         OPT_EXPERT | OPT_INPUT,                      { .off = OFFSET(input_ts_offset) },
         "set the input ts offset", "time_off" },
+    { "record_packets", HAS_ARG | OPT_STRING | OPT_OFFSET |
+                        OPT_EXPERT | OPT_INPUT,                      { .off = OFFSET(record_packets) },
+        "record the demuxed packets to a trace for replay with -f pkttrace", "filename" },
     { "itsscale",       HAS_ARG | OPT_DOUBLE | OPT_SPEC |
                         OPT_EXPERT | OPT_INPUT,                      { .off = OFFSET(ts_scale) },
         "set the input ts scale", "scale" },
@@ -973,6 +993,22 @@ const OptionDef options[] = {
         "add timings for benchmarking" },
     { "benchmark_all",  OPT_BOOL | OPT_EXPERT,                       { &do_benchmark_all },
       "add timings for each task" },
+    { "benchmark_file", HAS_ARG | OPT_STRING | OPT_EXPERT,           { &benchmark_filename },
+      "write the -benchmark_all stage histograms as JSON to file", "filename" },
+    { "benchmark_perf", OPT_BOOL | OPT_EXPERT,                       { &do_benchmark_perf },
+      "add hardware performance counters to the -benchmark_all stages" },
+    { "frame_pool",     OPT_BOOL | OPT_EXPERT,                       { &use_frame_pool },
+      "allocate decoded frames from a shared size-class buffer pool" },
+    { "frame_pool_hugepages", OPT_BOOL | OPT_EXPERT,                 { &frame_pool_hugepages },
+      "back large frame pool buffers with huge pages (implies -frame_pool)" },
+    { "mem_budget",     HAS_ARG | OPT_INT64 | OPT_EXPERT,            { &mem_budget_session.limit },
+      "limit the bytes of packets and frames queued by the session, 0 for no limit", "bytes" },
+    { "mem_budget_process", HAS_ARG | OPT_INT64 | OPT_EXPERT,        { &mem_budget_process.limit },
+      "limit the bytes of packets and frames queued by the whole process", "bytes" },
+    { "trace",          HAS_ARG | OPT_STRING | OPT_EXPERT,           { &trace_filename },
+      "write per-frame pipeline spans as Chrome trace-event JSON to file", "filename" },
+    { "trace_sample",   HAS_ARG | OPT_INT | OPT_EXPERT,              { &trace_sample_interval },
+      "trace one input packet out of every n", "n" },
     { "progress",       HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_progress },
       "write program-readable progress information", "url" },
     { "stdin",          OPT_BOOL | OPT_EXPERT,                       { &stdin_interaction },
@@ -993,6 +1029,18 @@ const OptionDef options[] = {
         "video sync method", "" },
     { "frame_drop_threshold", HAS_ARG | OPT_FLOAT | OPT_EXPERT,      { &frame_drop_threshold },
         "frame drop threshold", "" },
+    { "drop_predict",   OPT_BOOL | OPT_EXPERT,                       { &drop_predict },
+        "when -r lowers the frame rate, skip decoding non-reference frames and "
+        "filtering frames that the rate conversion would drop" },
+    { "preview",        OPT_BOOL | OPT_EXPERT,                       { &preview_mode },
+        "trade quality for speed for preview and proxy renditions: decoder "
+        "shortcuts, fast_bilinear scaling and the fastest x264/x265 preset" },
+    { "fast_remux",     OPT_BOOL | OPT_EXPERT,                       { &fast_remux },
+        "remux a session that only copies streams without the transcoding pipeline, "
+        "when it uses no option the remuxer does not carry over" },
+    { "smart_cut",      OPT_BOOL | OPT_EXPERT,                       { &smart_cut },
+        "cut the -ss/-t range of the first video stream by copying whole GOPs "
+        "and re-encoding only the partial ones at the cut points (MPEG-TS output)" },
     { "adrift_threshold", HAS_ARG | OPT_FLOAT | OPT_EXPERT,          { &audio_drift_threshold },
         "audio drift threshold", "threshold" },
     { "copyts",         OPT_BOOL | OPT_EXPERT,                       { &copy_ts },
@@ -1020,6 +1068,15 @@ const OptionDef options[] = {
         "copy initial non-keyframes" },
     { "copypriorss",    OPT_INT | HAS_ARG | OPT_EXPERT | OPT_SPEC | OPT_OUTPUT,   { .off = OFFSET(copy_prior_start) },
         "copy or discard frames before start time" },
+    { "copy_if_compatible", OPT_BOOL | OPT_EXPERT | OPT_SPEC | OPT_OUTPUT, { .off = OFFSET(copy_if_compatible) },
+        "copy the stream instead of encoding it when the source already has the "
+        "encoder's codec and stays within the -copy_* limits" },
+    { "copy_profiles",  HAS_ARG | OPT_STRING | OPT_EXPERT | OPT_SPEC | OPT_OUTPUT, { .off = OFFSET(copy_profiles) },
+        "comma-separated profile names the source may have for -copy_if_compatible", "profiles" },
+    { "copy_max_level", HAS_ARG | OPT_INT | OPT_EXPERT | OPT_SPEC | OPT_OUTPUT, { .off = OFFSET(copy_max_levels) },
+        "highest codec level the source may have for -copy_if_compatible", "level" },
+    { "copy_max_bitrate", HAS_ARG | OPT_INT64 | OPT_EXPERT | OPT_SPEC | OPT_OUTPUT, { .off = OFFSET(copy_max_bitrates) },
+        "highest bitrate the source may have for -copy_if_compatible", "bitrate" },
     { "frames",         OPT_INT64 | HAS_ARG | OPT_SPEC | OPT_OUTPUT, { .off = OFFSET(max_frames) },
         "set the number of frames to output", "number" },
     { "tag",            OPT_STRING | HAS_ARG | OPT_SPEC |
@@ -1041,10 +1098,27 @@ const OptionDef options[] = {
         "read stream filtergraph description from a file", "filename" },
     { "reinit_filter",  HAS_ARG | OPT_INT | OPT_SPEC | OPT_INPUT,    { .off = OFFSET(reinit_filters) },
         "reinit filtergraph on input parameter changes", "" },
+    { "reinit_prescale", OPT_BOOL | OPT_EXPERT,                      { &reinit_prescale },
+        "on video size or format changes, scale frames to the configured filtergraph "
+        "input instead of reinitializing the filtergraph" },
     { "filter_complex", HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_filter_complex },
         "create a complex filtergraph", "graph_description" },
     { "filter_complex_threads", HAS_ARG | OPT_INT,                   { &filter_complex_nbthreads },
         "number of threads for -filter_complex" },
+    { "filter_complex_parallel", OPT_BOOL | OPT_EXPERT,              { &filter_complex_parallel },
+        "run each -filter_complex graph on its own thread" },
+    { "thread_pool",    HAS_ARG | OPT_INT | OPT_EXPERT,              { &thread_pool_size },
+        "run filter slice threads on a process-wide pool of n threads and split "
+        "the pool among the codecs, -1 for one thread per core", "n" },
+    { "auto_threads",   OPT_BOOL | OPT_EXPERT,                       { &auto_threads },
+        "pick video codec and filter threads from frame size, codec and machine load" },
+    { "auto_threads_jobs", HAS_ARG | OPT_INT | OPT_EXPERT,           { &auto_threads_jobs },
+        "number of jobs sharing the machine, for -auto_threads", "n" },
+    { "numa_node",      HAS_ARG | OPT_STRING | OPT_EXPERT,           { &numa_placement },
+        "pin the session to a NUMA node and prefer its memory: "
+        "a node index, least (least busy) or rr (round-robin)", "node" },
+    { "cpu_set",        HAS_ARG | OPT_STRING | OPT_EXPERT,           { &cpu_set_list },
+        "pin the session to a list of CPUs", "cpulist" },
     { "lavfi",          HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_filter_complex },
         "create a complex filtergraph", "graph_description" },
     { "filter_complex_script", HAS_ARG | OPT_EXPERT,                 { .func_arg = opt_filter_complex_script },
@@ -1613,7 +1687,7 @@ static void add_input_streams(OptionsContext *o, AVFormatContext *ic)
     for (i = 0; i < ic->nb_streams; i++) {
         AVStream *st = ic->streams[i];
         AVCodecParameters *par = st->codecpar;
-        InputStream *ist = av_mallocz(sizeof(*ist));
+        InputStream *ist = session_mallocz(sizeof(*ist));
         char *framerate = NULL, *hwaccel = NULL, *hwaccel_device = NULL;
         char *hwaccel_output_format = NULL;
         char *codec_tag = NULL;
@@ -1791,6 +1865,38 @@ static void add_input_streams(OptionsContext *o, AVFormatContext *ic)
     }
 }
 
+/* -smart_cut reopens the input by name and picks the streams and codecs
+ * itself, so options it would silently ignore are refused up front */
+static void check_smart_cut_options(OptionsContext *o, const char *filename, int is_input)
+{
+    const char *opt = NULL;
+
+    if (!smart_cut)
+        return;
+    if (is_input) {
+        if (o->format || av_dict_count(o->g->format_opts))
+            opt = "Demuxer and protocol";
+        else if (av_dict_count(o->g->codec_opts) || o->nb_codec_names)
+            opt = "Decoder";
+    } else if (o->nb_stream_maps || o->nb_audio_channel_maps) {
+        opt = "Stream mapping";
+    } else if (o->nb_codec_names || o->nb_qscale || o->nb_presets ||
+               av_dict_count(o->g->codec_opts)) {
+        opt = "Codec";
+    } else if (o->nb_metadata || o->nb_metadata_map || o->chapters_input_file != INT_MAX) {
+        opt = "Metadata";
+    } else if (o->nb_filters || o->nb_filter_scripts || o->nb_bitstream_filters) {
+        opt = "Filter";
+    } else if (av_dict_count(o->g->format_opts)) {
+        opt = "Muxer";
+    }
+    if (opt) {
+        av_log(NULL, AV_LOG_FATAL, "%s options for '%s' are not supported with -smart_cut, "
+               "which only takes -ss, -t and -to\n", opt, filename);
+        exit_program(1);
+    }
+}
+
 static int open_input_file(OptionsContext *o, const char *filename)
 {
     
@@ -1807,6 +1913,7 @@ static int open_input_file(OptionsContext *o, const char *filename)
     char *    data_codec_name = NULL;
     int scan_all_pmts_set = 0;
 
+    check_smart_cut_options(o, filename, 1);
     if (o->format) {
         if (!(file_iformat = av_find_input_format(o->format))) {
             av_log(NULL, AV_LOG_FATAL, "Unknown input format: '%s'\n", o->format);
@@ -1973,7 +2080,7 @@ static int open_input_file(OptionsContext *o, const char *filename)
     av_dump_format(ic, nb_input_files, filename, 0);
 
     GROW_ARRAY(input_files, nb_input_files);
-    f = av_mallocz(sizeof(*f));
+    f = session_mallocz(sizeof(*f));
     if (!f)
         exit_program(1);
     input_files[nb_input_files - 1] = f;
@@ -1994,6 +2101,14 @@ static int open_input_file(OptionsContext *o, const char *filename)
     f->thread_queue_size = o->thread_queue_size > 0 ? o->thread_queue_size : 8;
 #endif
 
+    if (o->record_packets) {
+        ret = pkttrace_writer_open(&f->pkttrace, o->record_packets, ic);
+        if (ret < 0) {
+            print_error(o->record_packets, ret);
+            exit_program(1);
+        }
+    }
+
     /* check if all codec options have been used */
     unused_opts = strip_specifiers(o->g->codec_opts);
     for (i = f->ist_index; i < nb_input_streams; i++) {
@@ -2094,6 +2209,77 @@ static int get_preset_file_2(const char *preset_name, const char *codec_name, AV
     return ret;
 }
 
+/*
+ * Whether the source of a stream can be copied instead of encoded with the
+ * selected encoder: same codec, within the -copy_* limits, and no option
+ * given for the stream that needs decoded frames or tunes the encoder.
+ */
+static int source_matches_target(OptionsContext *o, AVFormatContext *oc,
+                                 OutputStream *ost, int source_index)
+{
+    AVStream *st = ost->st;
+    const AVCodecParameters *par;
+    InputStream *ist;
+    const char *profiles = NULL, *name;
+    char *str = NULL;
+    AVDictionary *enc_opts;
+    int64_t max_bitrate = 0, bitrate;
+    int max_level = 0, val = 0, nb_enc_opts;
+    double qscale = -1;
+
+    if (source_index < 0 || !ost->enc)
+        return 0;
+    ist = input_streams[source_index];
+    par = ist->st->codecpar;
+    if (par->codec_id != ost->enc->id || o->start_time != AV_NOPTS_VALUE)
+        return 0;
+
+    MATCH_PER_STREAM_OPT(filters,             str, str, oc, st);
+    MATCH_PER_STREAM_OPT(filter_scripts,      str, str, oc, st);
+    MATCH_PER_STREAM_OPT(frame_sizes,         str, str, oc, st);
+    MATCH_PER_STREAM_OPT(frame_rates,         str, str, oc, st);
+    MATCH_PER_STREAM_OPT(frame_pix_fmts,      str, str, oc, st);
+    MATCH_PER_STREAM_OPT(frame_aspect_ratios, str, str, oc, st);
+    MATCH_PER_STREAM_OPT(forced_key_frames,   str, str, oc, st);
+    MATCH_PER_STREAM_OPT(sample_fmts,         str, str, oc, st);
+    MATCH_PER_STREAM_OPT(audio_sample_rate,   i,   val, oc, st);
+    MATCH_PER_STREAM_OPT(audio_channels,      i,   val, oc, st);
+    if (str || val)
+        return 0;
+
+    /* -b, -crf, -preset and the like would be silently ignored by a copy */
+    enc_opts = filter_codec_opts(o->g->codec_opts, ost->enc->id, oc, st, ost->enc);
+    av_dict_set(&enc_opts, "threads", NULL, 0);
+    nb_enc_opts = av_dict_count(enc_opts);
+    av_dict_free(&enc_opts);
+    MATCH_PER_STREAM_OPT(presets, str, str, oc, st);
+    MATCH_PER_STREAM_OPT(qscale,  dbl, qscale, oc, st);
+    if (nb_enc_opts || str || qscale >= 0) {
+        av_log(NULL, AV_LOG_INFO, "Output stream #%d:%d: not copying the source, "
+               "encoder options were given for it\n", ost->file_index, ost->index);
+        return 0;
+    }
+
+    MATCH_PER_STREAM_OPT(copy_profiles, str, profiles, oc, st);
+    if (profiles) {
+        name = avcodec_profile_name(par->codec_id, par->profile);
+        if (!name || !av_match_name(name, profiles))
+            return 0;
+    }
+
+    MATCH_PER_STREAM_OPT(copy_max_levels, i, max_level, oc, st);
+    if (max_level > 0 && par->level > max_level)
+        return 0;
+
+    /* the container bitrate bounds a stream whose own is unknown */
+    MATCH_PER_STREAM_OPT(copy_max_bitrates, i64, max_bitrate, oc, st);
+    bitrate = par->bit_rate ? par->bit_rate : input_files[ist->file_index]->ctx->bit_rate;
+    if (max_bitrate > 0 && bitrate > max_bitrate)
+        return 0;
+
+    return 1;
+}
+
 static OutputStream *new_output_stream(OptionsContext *o, AVFormatContext *oc, enum AVMediaType type, int source_index){
     OutputStream *ost;
     AVStream *st = avformat_new_stream(oc, NULL);
@@ -2112,7 +2298,7 @@ static OutputStream *new_output_stream(OptionsContext *o, AVFormatContext *oc, e
         st->id = o->streamid_map[oc->nb_streams - 1];
 
     GROW_ARRAY(output_streams, nb_output_streams);
-    if (!(ost = av_mallocz(sizeof(*ost))))
+    if (!(ost = session_mallocz(sizeof(*ost))))
         exit_program(1);
     output_streams[nb_output_streams - 1] = ost;
 
@@ -2128,6 +2314,19 @@ static OutputStream *new_output_stream(OptionsContext *o, AVFormatContext *oc, e
         exit_program(1);
     }
 
+    MATCH_PER_STREAM_OPT(copy_if_compatible, i, ost->auto_copy, oc, st);
+    if (ost->auto_copy && ost->encoding_needed &&
+        source_matches_target(o, oc, ost, source_index)) {
+        av_log(NULL, AV_LOG_INFO, "Output stream #%d:%d: source is already %s within "
+               "the limits, copying it instead of encoding with %s\n",
+               ost->file_index, ost->index, avcodec_get_name(ost->enc->id), ost->enc->name);
+        ost->stream_copy     = 1;
+        ost->encoding_needed = 0;
+        ost->enc             = NULL;
+    } else {
+        ost->auto_copy = 0;
+    }
+
     ost->enc_ctx = avcodec_alloc_context3(ost->enc);
     if (!ost->enc_ctx) {
         av_log(NULL, AV_LOG_ERROR, "Error allocating the encoding context.\n");
@@ -2171,6 +2370,10 @@ static OutputStream *new_output_stream(OptionsContext *o, AVFormatContext *oc, e
                    preset, ost->file_index, ost->index);
             exit_program(1);
         }
+        /* other encoders' presets do not have an "ultrafast" */
+        if (preview_mode && type == AVMEDIA_TYPE_VIDEO &&
+            (!strcmp(ost->enc->name, "libx264") || !strcmp(ost->enc->name, "libx265")))
+            av_dict_set(&ost->encoder_opts, "preset", "ultrafast", AV_DICT_DONT_OVERWRITE);
     } else {
         ost->encoder_opts = filter_codec_opts(o->g->codec_opts, AV_CODEC_ID_NONE, oc, st, NULL);
     }
@@ -2211,6 +2414,8 @@ static OutputStream *new_output_stream(OptionsContext *o, AVFormatContext *oc, e
     MATCH_PER_STREAM_OPT(copy_prior_start, i, ost->copy_prior_start, oc ,st);
 
     MATCH_PER_STREAM_OPT(bitstream_filters, str, bsfs, oc, st);
+    if (!bsfs && ost->auto_copy)
+        bsfs = remux_annexb_bsf(input_streams[source_index]->st->codecpar, oc->oformat);
     while (bsfs && *bsfs) {
         const AVBitStreamFilter *filter;
         char *bsf, *bsf_options_str, *bsf_name;
@@ -2287,6 +2492,12 @@ static OutputStream *new_output_stream(OptionsContext *o, AVFormatContext *oc, e
         ost->enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 
     av_dict_copy(&ost->sws_dict, o->g->sws_dict, 0);
+    /* bicubic is the default from init_opts(), an explicit -sws_flags wins */
+    if (preview_mode) {
+        AVDictionaryEntry *e = av_dict_get(ost->sws_dict, "flags", NULL, 0);
+        if (!e || !strcmp(e->value, "bicubic"))
+            av_dict_set(&ost->sws_dict, "flags", "fast_bilinear", 0);
+    }
 
     av_dict_copy(&ost->swr_opts, o->g->swr_opts, 0);
     if (ost->enc && av_get_exact_bits_per_sample(ost->enc->id) == 24)
@@ -2748,6 +2959,7 @@ static int open_output_file(OptionsContext *o, const char *filename)
     AVDictionaryEntry *e = NULL;
     int format_flags = 0;
 
+    check_smart_cut_options(o, filename, 0);
 
     if (o->stop_time != INT64_MAX && o->recording_time != INT64_MAX) {
         o->stop_time = INT64_MAX;
@@ -2765,7 +2977,7 @@ static int open_output_file(OptionsContext *o, const char *filename)
     }
 
     GROW_ARRAY(output_files, nb_output_files);
-    of = av_mallocz(sizeof(*of));
+    of = session_mallocz(sizeof(*of));
     if (!of)
         exit_program(1);
     output_files[nb_output_files - 1] = of;
@@ -2775,6 +2987,7 @@ static int open_output_file(OptionsContext *o, const char *filename)
     of->start_time     = o->start_time;
     of->limit_filesize = o->limit_filesize;
     of->shortest       = o->shortest;
+    of->metadata_set   = o->nb_metadata || o->nb_metadata_map;
     av_dict_copy(&of->opts, o->g->format_opts, 0);
 
     if (!strcmp(filename, "-"))
@@ -3403,7 +3616,8 @@ static void uninit_options(OptionsContext *o)
     const OptionDef *po = options;
     int i;
 
-    /* all OPT_SPEC and OPT_STRING can be freed in generic way */
+    /* all OPT_SPEC and OPT_STRING can be freed in generic way; whatever
+     * came from the session arena is released with it */
     while (po->name) {
         void *dst = (uint8_t*)o + po->u.off;
 
@@ -3411,23 +3625,23 @@ static void uninit_options(OptionsContext *o)
             SpecifierOpt **so = dst;
             int i, *count = (int*)(so + 1);
             for (i = 0; i < *count; i++) {
-                av_freep(&(*so)[i].specifier);
+                session_freep(&(*so)[i].specifier);
                 if (po->flags & OPT_STRING)
-                    av_freep(&(*so)[i].u.str);
+                    session_freep(&(*so)[i].u.str);
             }
-            av_freep(so);
+            session_freep(so);
             *count = 0;
         } else if (po->flags & OPT_OFFSET && po->flags & OPT_STRING)
-            av_freep(dst);
+            session_freep(dst);
         po++;
     }
 
     for (i = 0; i < o->nb_stream_maps; i++)
         av_freep(&o->stream_maps[i].linklabel);
-    av_freep(&o->stream_maps);
-    av_freep(&o->audio_channel_maps);
-    av_freep(&o->streamid_map);
-    av_freep(&o->attachments);
+    session_freep(&o->stream_maps);
+    session_freep(&o->audio_channel_maps);
+    session_freep(&o->streamid_map);
+    session_freep(&o->attachments);
 }
 
 static int open_files(OptionGroupList *l, const char *inout,
@@ -0,0 +1,370 @@
+#include <string.h>
+
+#include <libavutil/avassert.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+#include <libavutil/mem.h>
+
+#include "ffmpeg_pkttrace.h"
+
+/*
+ * File layout, all integers little-endian:
+ *
+ *   "FFPKTRC" version(u8) nb_streams(u32)
+ *   per stream: time base, start time, duration, frame rates and the
+ *               AVCodecParameters fields below, then extradata
+ *   per packet: stream_index(u32) flags(u32) pts dts duration pos(i64)
+ *               size(u32) data nb_side_data(u32)
+ *               { type(u32) size(u32) data }...
+ *
+ * until the end of the file.
+ */
+
+#define PKTTRACE_MAGIC   "FFPKTRC"
+#define PKTTRACE_VERSION 1
+
+/* sanity limits for reading */
+#define PKTTRACE_MAX_STREAMS   1024
+#define PKTTRACE_MAX_SIDE_DATA 64
+
+#define PKTTRACE_PAR_INT_FIELDS(X) \
+    X(codec_type)                   \
+    X(codec_id)                     \
+    X(codec_tag)                    \
+    X(format)                       \
+    X(bits_per_coded_sample)        \
+    X(bits_per_raw_sample)          \
+    X(profile)                      \
+    X(level)                        \
+    X(width)                        \
+    X(height)                       \
+    X(sample_aspect_ratio.num)      \
+    X(sample_aspect_ratio.den)      \
+    X(field_order)                  \
+    X(color_range)                  \
+    X(color_primaries)              \
+    X(color_trc)                    \
+    X(color_space)                  \
+    X(chroma_location)              \
+    X(video_delay)                  \
+    X(channels)                     \
+    X(sample_rate)                  \
+    X(block_align)                  \
+    X(frame_size)                   \
+    X(initial_padding)              \
+    X(trailing_padding)             \
+    X(seek_preroll)
+
+struct PacketTraceWriter {
+    AVIOContext *pb;
+    int nb_streams;
+    uint64_t nb_packets;
+};
+
+typedef struct PacketTraceContext {
+    AVPacket *packets;
+    int nb_packets;
+    int packets_size;
+    int demux_pos;      ///< next packet for av_read_frame(), used while probing
+    int replay_pos;     ///< next packet for pkttrace_read()
+} PacketTraceContext;
+
+static void write_rational(AVIOContext *pb, AVRational q)
+{
+    avio_wl32(pb, q.num);
+    avio_wl32(pb, q.den);
+}
+
+static AVRational read_rational(AVIOContext *pb)
+{
+    AVRational q;
+    q.num = (int)avio_rl32(pb);
+    q.den = (int)avio_rl32(pb);
+    return q;
+}
+
+int pkttrace_writer_open(PacketTraceWriter **pw, const char *filename,
+                         const AVFormatContext *ic)
+{
+    PacketTraceWriter *w;
+    int i, ret;
+
+    if (!(w = av_mallocz(sizeof(*w))))
+        return AVERROR(ENOMEM);
+    if ((ret = avio_open(&w->pb, filename, AVIO_FLAG_WRITE)) < 0) {
+        av_free(w);
+        return ret;
+    }
+    w->nb_streams = ic->nb_streams;
+
+    avio_write(w->pb, (const unsigned char *)PKTTRACE_MAGIC, 7);
+    avio_w8(w->pb, PKTTRACE_VERSION);
+    avio_wl32(w->pb, ic->nb_streams);
+    for (i = 0; i < ic->nb_streams; i++) {
+        const AVStream *st = ic->streams[i];
+        const AVCodecParameters *par = st->codecpar;
+
+        write_rational(w->pb, st->time_base);
+        avio_wl64(w->pb, st->start_time);
+        avio_wl64(w->pb, st->duration);
+        write_rational(w->pb, st->avg_frame_rate);
+        write_rational(w->pb, st->r_frame_rate);
+
+#define WRITE_FIELD(f) avio_wl32(w->pb, par->f);
+        PKTTRACE_PAR_INT_FIELDS(WRITE_FIELD)
+#undef WRITE_FIELD
+        avio_wl64(w->pb, par->bit_rate);
+        avio_wl64(w->pb, par->channel_layout);
+        avio_wl32(w->pb, par->extradata_size);
+        avio_write(w->pb, par->extradata, par->extradata_size);
+    }
+
+    *pw = w;
+    return w->pb->error;
+}
+
+int pkttrace_writer_write(PacketTraceWriter *w, const AVPacket *pkt)
+{
+    AVIOContext *pb = w->pb;
+    int i;
+
+    if (pkt->stream_index >= w->nb_streams)
+        return 0;
+
+    avio_wl32(pb, pkt->stream_index);
+    avio_wl32(pb, pkt->flags);
+    avio_wl64(pb, pkt->pts);
+    avio_wl64(pb, pkt->dts);
+    avio_wl64(pb, pkt->duration);
+    avio_wl64(pb, pkt->pos);
+    avio_wl32(pb, pkt->size);
+    avio_write(pb, pkt->data, pkt->size);
+    avio_wl32(pb, pkt->side_data_elems);
+    for (i = 0; i < pkt->side_data_elems; i++) {
+        avio_wl32(pb, pkt->side_data[i].type);
+        avio_wl32(pb, pkt->side_data[i].size);
+        avio_write(pb, pkt->side_data[i].data, pkt->side_data[i].size);
+    }
+    w->nb_packets++;
+
+    return pb->error;
+}
+
+void pkttrace_writer_close(PacketTraceWriter **pw)
+{
+    PacketTraceWriter *w = *pw;
+
+    if (!w)
+        return;
+    av_log(NULL, AV_LOG_VERBOSE, "Recorded %"PRIu64" packets\n", w->nb_packets);
+    avio_closep(&w->pb);
+    av_freep(pw);
+}
+
+static int pkttrace_probe(AVProbeData *p)
+{
+    if (p->buf_size >= 8 && !memcmp(p->buf, PKTTRACE_MAGIC, 7) &&
+        p->buf[7] == PKTTRACE_VERSION)
+        return AVPROBE_SCORE_MAX;
+    return 0;
+}
+
+static int read_stream(AVFormatContext *s, AVIOContext *pb)
+{
+    AVCodecParameters *par;
+    AVStream *st;
+    int size;
+
+    if (!(st = avformat_new_stream(s, NULL)))
+        return AVERROR(ENOMEM);
+    par = st->codecpar;
+
+    st->time_base      = read_rational(pb);
+    st->start_time     = avio_rl64(pb);
+    st->duration       = avio_rl64(pb);
+    st->avg_frame_rate = read_rational(pb);
+    st->r_frame_rate   = read_rational(pb);
+    /* timestamps were already unwrapped by the recording demuxer */
+    st->pts_wrap_bits  = 64;
+    if (st->time_base.num <= 0 || st->time_base.den <= 0)
+        return AVERROR_INVALIDDATA;
+
+#define READ_FIELD(f) par->f = (int)avio_rl32(pb);
+    PKTTRACE_PAR_INT_FIELDS(READ_FIELD)
+#undef READ_FIELD
+    par->bit_rate       = avio_rl64(pb);
+    par->channel_layout = avio_rl64(pb);
+
+    size = avio_rl32(pb);
+    if (size < 0 || size > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE)
+        return AVERROR_INVALIDDATA;
+    if (size) {
+        if (!(par->extradata = av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE)))
+            return AVERROR(ENOMEM);
+        par->extradata_size = size;
+        if (avio_read(pb, par->extradata, size) != size)
+            return AVERROR_INVALIDDATA;
+    }
+    return 0;
+}
+
+static int read_packet_record(AVFormatContext *s, AVIOContext *pb, AVPacket *pkt)
+{
+    int i, ret, size, nb_side_data;
+
+    pkt->stream_index = avio_rl32(pb);
+    if (avio_feof(pb))
+        return AVERROR_EOF;
+    if ((unsigned)pkt->stream_index >= s->nb_streams)
+        return AVERROR_INVALIDDATA;
+    pkt->flags    = avio_rl32(pb);
+    pkt->pts      = avio_rl64(pb);
+    pkt->dts      = avio_rl64(pb);
+    pkt->duration = avio_rl64(pb);
+    pkt->pos      = avio_rl64(pb);
+
+    size = avio_rl32(pb);
+    if (size < 0 || (ret = av_new_packet(pkt, size)) < 0)
+        return size < 0 ? AVERROR_INVALIDDATA : ret;
+    if (avio_read(pb, pkt->data, size) != size)
+        return AVERROR_INVALIDDATA;
+
+    nb_side_data = avio_rl32(pb);
+    if (nb_side_data < 0 || nb_side_data > PKTTRACE_MAX_SIDE_DATA)
+        return AVERROR_INVALIDDATA;
+    for (i = 0; i < nb_side_data; i++) {
+        enum AVPacketSideDataType type = avio_rl32(pb);
+        uint8_t *data;
+
+        size = avio_rl32(pb);
+        if (size < 0 || !(data = av_packet_new_side_data(pkt, type, size)))
+            return size < 0 ? AVERROR_INVALIDDATA : AVERROR(ENOMEM);
+        if (avio_read(pb, data, size) != size)
+            return AVERROR_INVALIDDATA;
+    }
+    return 0;
+}
+
+static int pkttrace_read_close(AVFormatContext *s)
+{
+    PacketTraceContext *c = s->priv_data;
+    int i;
+
+    for (i = 0; i < c->nb_packets; i++)
+        av_packet_unref(&c->packets[i]);
+    av_freep(&c->packets);
+    c->nb_packets = c->packets_size = 0;
+    return 0;
+}
+
+/* the whole trace is loaded here, replay does no I/O */
+static int pkttrace_read_header(AVFormatContext *s)
+{
+    PacketTraceContext *c = s->priv_data;
+    AVIOContext *pb = s->pb;
+    uint8_t magic[8];
+    int i, ret, nb_streams;
+
+    if (avio_read(pb, magic, 8) != 8 || memcmp(magic, PKTTRACE_MAGIC, 7) ||
+        magic[7] != PKTTRACE_VERSION)
+        return AVERROR_INVALIDDATA;
+
+    nb_streams = avio_rl32(pb);
+    if (nb_streams <= 0 || nb_streams > PKTTRACE_MAX_STREAMS)
+        return AVERROR_INVALIDDATA;
+    for (i = 0; i < nb_streams; i++)
+        if ((ret = read_stream(s, pb)) < 0)
+            return ret;
+
+    for (;;) {
+        if (c->nb_packets == c->packets_size) {
+            int size = FFMAX(2 * c->packets_size, 1024);
+            if ((ret = av_reallocp_array(&c->packets, size, sizeof(*c->packets))) < 0)
+                goto fail;
+            c->packets_size = size;
+        }
+        av_init_packet(&c->packets[c->nb_packets]);
+        c->packets[c->nb_packets].data = NULL;
+        c->packets[c->nb_packets].size = 0;
+        ret = read_packet_record(s, pb, &c->packets[c->nb_packets]);
+        if (ret == AVERROR_EOF)
+            break;
+        if (ret < 0) {
+            av_packet_unref(&c->packets[c->nb_packets]);
+            goto fail;
+        }
+        c->nb_packets++;
+    }
+
+    av_log(s, AV_LOG_VERBOSE, "Loaded %d packets\n", c->nb_packets);
+    return 0;
+fail:
+    pkttrace_read_close(s);
+    return ret;
+}
+
+static int pkttrace_read_packet(AVFormatContext *s, AVPacket *pkt)
+{
+    PacketTraceContext *c = s->priv_data;
+
+    if (c->demux_pos >= c->nb_packets)
+        return AVERROR_EOF;
+    return av_packet_ref(pkt, &c->packets[c->demux_pos++]);
+}
+
+/* -stream_loop and -ss: restart from the last keyframe at or before ts */
+static int pkttrace_read_seek(AVFormatContext *s, int stream_index,
+                              int64_t ts, int flags)
+{
+    PacketTraceContext *c = s->priv_data;
+    int i, pos = 0;
+
+    for (i = 0; i < c->nb_packets; i++) {
+        const AVPacket *pkt = &c->packets[i];
+        int64_t pkt_ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+
+        if (pkt->stream_index != stream_index || !(pkt->flags & AV_PKT_FLAG_KEY))
+            continue;
+        if (pkt_ts != AV_NOPTS_VALUE && pkt_ts > ts)
+            break;
+        pos = i;
+    }
+    c->demux_pos = c->replay_pos = pos;
+    return 0;
+}
+
+static AVInputFormat pkttrace_demuxer = {
+    .name           = "pkttrace",
+    .long_name      = "recorded packet trace",
+    .extensions     = "pktr",
+    .priv_data_size = sizeof(PacketTraceContext),
+    .read_probe     = pkttrace_probe,
+    .read_header    = pkttrace_read_header,
+    .read_packet    = pkttrace_read_packet,
+    .read_close     = pkttrace_read_close,
+    .read_seek      = pkttrace_read_seek,
+};
+
+void pkttrace_register(void)
+{
+    static int registered;
+
+    if (!registered)
+        av_register_input_format(&pkttrace_demuxer);
+    registered = 1;
+}
+
+int pkttrace_is_replay(const AVFormatContext *s)
+{
+    return s->iformat == &pkttrace_demuxer;
+}
+
+int pkttrace_read(AVFormatContext *s, AVPacket *pkt)
+{
+    PacketTraceContext *c = s->priv_data;
+
+    av_assert0(pkttrace_is_replay(s));
+    if (c->replay_pos >= c->nb_packets)
+        return AVERROR_EOF;
+    return av_packet_ref(pkt, &c->packets[c->replay_pos++]);
+}
@@ -0,0 +1,51 @@
+#ifndef FFMPEG_PKTTRACE_H
+#define FFMPEG_PKTTRACE_H
+
+#include <libavformat/avformat.h>
+
+/*
+ * Packet traces hold the demuxed packets of one input, side data included,
+ * together with the stream parameters needed to set up decoders. They are
+ * written with -record_packets and read back by the "pkttrace" demuxer,
+ * which loads the whole trace into memory when the input is opened, so
+ * that replaying it measures decode, filter and encode without demuxer or
+ * I/O cost.
+ */
+
+typedef struct PacketTraceWriter PacketTraceWriter;
+
+/**
+ * Create a trace file and write the parameters of all streams of ic.
+ *
+ * @return 0 on success, a negative AVERROR otherwise
+ */
+int pkttrace_writer_open(PacketTraceWriter **pw, const char *filename,
+                         const AVFormatContext *ic);
+
+/**
+ * Append a packet as returned by the demuxer, before any timestamp
+ * adjustment. Packets of streams unknown at open time are skipped.
+ */
+int pkttrace_writer_write(PacketTraceWriter *w, const AVPacket *pkt);
+
+void pkttrace_writer_close(PacketTraceWriter **pw);
+
+/**
+ * Register the "pkttrace" demuxer. Safe to call more than once.
+ */
+void pkttrace_register(void);
+
+/**
+ * @return non-zero if s was opened by the "pkttrace" demuxer
+ */
+int pkttrace_is_replay(const AVFormatContext *s);
+
+/**
+ * Return a new reference to the next packet of a replayed trace, without
+ * going through av_read_frame().
+ *
+ * @return 0 on success, AVERROR_EOF at the end of the trace
+ */
+int pkttrace_read(AVFormatContext *s, AVPacket *pkt);
+
+#endif
@@ -0,0 +1,303 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include <libavutil/buffer.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/common.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
+
+#include "ffmpeg_pool.h"
+
+typedef struct FramePoolClass {
+    int size;
+    AVBufferPool *pool;
+} FramePoolClass;
+
+struct FramePool {
+    int flags;
+    pthread_mutex_t lock;       ///< only taken to add a size class
+    FramePoolClass classes[FRAME_POOL_MAX_CLASSES];
+    atomic_int nb_classes;      ///< classes[] entries below this are immutable
+
+    atomic_ullong requests;
+    atomic_ullong mallocs;
+    atomic_ullong steady_mallocs;
+    atomic_ullong bytes;
+    atomic_ullong fallbacks;
+    atomic_ullong huge_mappings;
+    atomic_ullong huge_bytes;
+    atomic_ullong hugetlb_mappings;
+    atomic_int    hugetlb_failed;   ///< stop trying MAP_HUGETLB after a failure
+};
+
+/* round up to 1/8 of the enclosing power of two, at most 12.5% slack */
+static int size_class(int size)
+{
+    int step = 1 << FFMAX(av_log2(size) - 3, 6);
+
+    if (size > INT_MAX - step)
+        return size;
+    return FFALIGN(size, step);
+}
+
+#ifdef __linux__
+/* the mapping length is the opaque, the pool may be gone by now */
+static void huge_free(void *opaque, uint8_t *data)
+{
+    munmap(data, (size_t)(uintptr_t)opaque);
+}
+
+static AVBufferRef *huge_alloc(FramePool *pool, int size)
+{
+    size_t len = FFALIGN((size_t)size, FRAME_POOL_HUGEPAGE_SIZE);
+    AVBufferRef *buf;
+    uint8_t *p = MAP_FAILED;
+    int hugetlb = 0;
+
+    if (!atomic_load(&pool->hugetlb_failed)) {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED)
+            atomic_store(&pool->hugetlb_failed, 1);
+        else
+            hugetlb = 1;
+    }
+    if (p == MAP_FAILED) {
+        /* over-map so the buffer starts on a huge page boundary, THP only
+         * backs aligned 2 MiB ranges */
+        size_t map_len = len + FRAME_POOL_HUGEPAGE_SIZE;
+        uint8_t *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        size_t head;
+
+        if (map == MAP_FAILED)
+            return NULL;
+        p    = (uint8_t *)FFALIGN((uintptr_t)map, FRAME_POOL_HUGEPAGE_SIZE);
+        head = p - map;
+        if (head)
+            munmap(map, head);
+        munmap(p + len, map_len - head - len);
+        madvise(p, len, MADV_HUGEPAGE);
+    }
+
+    buf = av_buffer_create(p, size, huge_free, (void *)(uintptr_t)len, 0);
+    if (!buf) {
+        munmap(p, len);
+        return NULL;
+    }
+    atomic_fetch_add(&pool->huge_mappings, 1);
+    atomic_fetch_add(&pool->huge_bytes, len);
+    if (hugetlb)
+        atomic_fetch_add(&pool->hugetlb_mappings, 1);
+    return buf;
+}
+#endif
+
+static AVBufferRef *pool_alloc(void *opaque, int size)
+{
+    FramePool *pool = opaque;
+
+    atomic_fetch_add(&pool->mallocs, 1);
+    atomic_fetch_add(&pool->bytes, size);
+    if (atomic_load(&pool->requests) > FRAME_POOL_WARMUP)
+        atomic_fetch_add(&pool->steady_mallocs, 1);
+#ifdef __linux__
+    if ((pool->flags & FRAME_POOL_FLAG_HUGEPAGES) && size >= FRAME_POOL_HUGEPAGE_MIN) {
+        AVBufferRef *buf = huge_alloc(pool, size);
+        if (buf)
+            return buf;
+    }
+#endif
+    return av_buffer_alloc(size);
+}
+
+static AVBufferPool *get_class(FramePool *pool, int size)
+{
+    AVBufferPool *p = NULL;
+    int i, n = atomic_load(&pool->nb_classes);
+
+    for (i = 0; i < n; i++)
+        if (pool->classes[i].size == size)
+            return pool->classes[i].pool;
+
+    pthread_mutex_lock(&pool->lock);
+    n = atomic_load(&pool->nb_classes);
+    for (i = 0; i < n; i++)
+        if (pool->classes[i].size == size)
+            p = pool->classes[i].pool;
+    if (!p && n < FRAME_POOL_MAX_CLASSES) {
+        p = av_buffer_pool_init2(size, pool, pool_alloc, NULL);
+        if (p) {
+            pool->classes[n].size = size;
+            pool->classes[n].pool = p;
+            atomic_store(&pool->nb_classes, n + 1);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return p;
+}
+
+static AVBufferRef *pool_get(FramePool *pool, int size)
+{
+    AVBufferPool *p;
+
+    atomic_fetch_add(&pool->requests, 1);
+    if (size <= 0 || !(p = get_class(pool, size_class(size)))) {
+        atomic_fetch_add(&pool->fallbacks, 1);
+        return av_buffer_alloc(FFMAX(size, 1));
+    }
+    return av_buffer_pool_get(p);
+}
+
+FramePool *frame_pool_alloc(int flags)
+{
+    FramePool *pool = av_mallocz(sizeof(*pool));
+
+    if (!pool)
+        return NULL;
+    pool->flags = flags;
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
+
+void frame_pool_free(FramePool **ppool)
+{
+    FramePool *pool = *ppool;
+    int i;
+
+    if (!pool)
+        return;
+    for (i = 0; i < atomic_load(&pool->nb_classes); i++)
+        av_buffer_pool_uninit(&pool->classes[i].pool);
+    pthread_mutex_destroy(&pool->lock);
+    av_freep(ppool);
+}
+
+/* w and h may be larger than the frame dimensions, e.g. padded for a decoder */
+static int alloc_video(FramePool *pool, AVFrame *frame, int w, int h,
+                       const int linesize_align[AV_NUM_DATA_POINTERS], int align)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    int linesize[4];
+    int i, ret;
+
+    if ((ret = av_image_fill_linesizes(linesize, frame->format, w)) < 0)
+        return ret;
+
+    for (i = 0; i < 4 && linesize[i]; i++) {
+        int plane_align = FFMAX(align, linesize_align ? linesize_align[i] : 0);
+        int plane_h     = h;
+
+        frame->linesize[i] = FFALIGN(linesize[i], plane_align);
+        if (i == 1 || i == 2)
+            plane_h = AV_CEIL_RSHIFT(h, desc->log2_chroma_h);
+
+        frame->buf[i] = pool_get(pool, frame->linesize[i] * plane_h + 16 + plane_align - 1);
+        if (!frame->buf[i])
+            goto fail;
+        frame->data[i] = frame->buf[i]->data;
+    }
+    frame->extended_data = frame->data;
+    return 0;
+fail:
+    av_frame_unref(frame);
+    return AVERROR(ENOMEM);
+}
+
+static int alloc_audio(FramePool *pool, AVFrame *frame, int channels, int align)
+{
+    int planar = av_sample_fmt_is_planar(frame->format);
+    int planes = planar ? channels : 1;
+    int i, ret;
+
+    ret = av_samples_get_buffer_size(&frame->linesize[0], channels, frame->nb_samples,
+                                     frame->format, align);
+    if (ret < 0)
+        return ret;
+
+    for (i = 0; i < planes; i++) {
+        frame->buf[i] = pool_get(pool, frame->linesize[0]);
+        if (!frame->buf[i]) {
+            av_frame_unref(frame);
+            return AVERROR(ENOMEM);
+        }
+        frame->data[i] = frame->buf[i]->data;
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+/* palettes, hardware frames and more planes than data[] holds keep using
+ * the libav* allocators */
+static int pool_can_alloc(const AVFrame *frame, int channels)
+{
+    if (frame->width > 0 && frame->height > 0) {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+        return desc && !(desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL |
+                                        AV_PIX_FMT_FLAG_HWACCEL));
+    }
+    if (frame->nb_samples > 0 && channels > 0)
+        return !av_sample_fmt_is_planar(frame->format) || channels <= AV_NUM_DATA_POINTERS;
+    return 0;
+}
+
+int frame_pool_get_buffer(FramePool *pool, AVFrame *frame, int align)
+{
+    int channels = frame->channels;
+
+    if (!channels && frame->channel_layout) {
+        channels = av_get_channel_layout_nb_channels(frame->channel_layout);
+        av_frame_set_channels(frame, channels);
+    }
+    if (!pool_can_alloc(frame, channels) || frame->format < 0) {
+        atomic_fetch_add(&pool->fallbacks, 1);
+        return av_frame_get_buffer(frame, align);
+    }
+
+    if (align <= 0)
+        align = 32;
+    if (frame->width > 0 && frame->height > 0)
+        return alloc_video(pool, frame, FFALIGN(frame->width, align),
+                           FFALIGN(frame->height, 32), NULL, align);
+    return alloc_audio(pool, frame, channels, align);
+}
+
+int frame_pool_get_buffer2(FramePool *pool, AVCodecContext *s, AVFrame *frame, int flags)
+{
+    if (!(s->codec->capabilities & AV_CODEC_CAP_DR1) ||
+        !pool_can_alloc(frame, s->channels)) {
+        atomic_fetch_add(&pool->fallbacks, 1);
+        return avcodec_default_get_buffer2(s, frame, flags);
+    }
+
+    if (s->codec_type == AVMEDIA_TYPE_VIDEO) {
+        int linesize_align[AV_NUM_DATA_POINTERS];
+        int w = frame->width, h = frame->height;
+
+        avcodec_align_dimensions2(s, &w, &h, linesize_align);
+        return alloc_video(pool, frame, w, h, linesize_align, 32);
+    }
+    return alloc_audio(pool, frame, s->channels, 0);
+}
+
+void frame_pool_get_stats(const FramePool *pool, FramePoolStats *stats)
+{
+    FramePool *p = (FramePool *)pool;
+
+    stats->requests       = atomic_load(&p->requests);
+    stats->mallocs        = atomic_load(&p->mallocs);
+    stats->steady_mallocs = atomic_load(&p->steady_mallocs);
+    stats->bytes          = atomic_load(&p->bytes);
+    stats->fallbacks      = atomic_load(&p->fallbacks);
+    stats->huge_mappings  = atomic_load(&p->huge_mappings);
+    stats->huge_bytes     = atomic_load(&p->huge_bytes);
+    stats->hugetlb_mappings = atomic_load(&p->hugetlb_mappings);
+    stats->faults_saved   = stats->huge_bytes / 4096 - stats->huge_bytes / FRAME_POOL_HUGEPAGE_SIZE;
+    stats->nb_classes     = atomic_load(&p->nb_classes);
+}
@@ -0,0 +1,76 @@
+#ifndef FFMPEG_POOL_H
+#define FFMPEG_POOL_H
+
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+
+/*
+ * Frame buffer pool shared by all decoders and frame producers of one
+ * session. Planes are rounded up to size classes (1/8 of a power of two)
+ * and served from one AVBufferPool per class, so buffers are recycled
+ * across streams and across decoder reinits instead of being reallocated.
+ */
+
+#define FRAME_POOL_MAX_CLASSES 64
+
+/* requests served before mallocs stop counting as warm-up */
+#define FRAME_POOL_WARMUP 256
+
+/**
+ * Back buffers of at least FRAME_POOL_HUGEPAGE_MIN bytes with huge pages:
+ * a MAP_HUGETLB mapping when the system has reserved huge pages, else an
+ * anonymous mapping with madvise(MADV_HUGEPAGE) for transparent huge pages.
+ */
+#define FRAME_POOL_FLAG_HUGEPAGES 1
+
+#define FRAME_POOL_HUGEPAGE_SIZE (2 << 20)
+#define FRAME_POOL_HUGEPAGE_MIN  (1 << 20)
+
+typedef struct FramePoolStats {
+    uint64_t requests;          ///< buffers handed out
+    uint64_t mallocs;           ///< buffers actually allocated
+    uint64_t steady_mallocs;    ///< mallocs after the first FRAME_POOL_WARMUP requests
+    uint64_t bytes;             ///< total size of allocated buffers
+    uint64_t fallbacks;         ///< requests that bypassed the pool
+    uint64_t huge_mappings;     ///< buffers mapped with MAP_HUGETLB or MADV_HUGEPAGE
+    uint64_t huge_bytes;
+    uint64_t hugetlb_mappings;  ///< of which explicit MAP_HUGETLB
+    /**
+     * Page faults avoided by huge-page buffers, estimated as one fault per
+     * huge page instead of one per 4 KiB page. Transparent huge pages are
+     * best effort, so compare against measured minor faults.
+     */
+    uint64_t faults_saved;
+    int nb_classes;
+} FramePoolStats;
+
+typedef struct FramePool FramePool;
+
+/**
+ * @param flags a combination of FRAME_POOL_FLAG_*
+ */
+FramePool *frame_pool_alloc(int flags);
+
+/**
+ * Free the pool. Buffers still referenced stay valid and are released
+ * when their last reference goes away.
+ */
+void frame_pool_free(FramePool **pool);
+
+/**
+ * Drop-in replacement for av_frame_get_buffer(): allocate the planes of a
+ * frame whose format, width/height or nb_samples/channel_layout are set.
+ */
+int frame_pool_get_buffer(FramePool *pool, AVFrame *frame, int align);
+
+/**
+ * get_buffer2() implementation for decoders with AV_CODEC_CAP_DR1,
+ * falling back to avcodec_default_get_buffer2() for anything else.
+ */
+int frame_pool_get_buffer2(FramePool *pool, AVCodecContext *s, AVFrame *frame, int flags);
+
+void frame_pool_get_stats(const FramePool *pool, FramePoolStats *stats);
+
+#endif
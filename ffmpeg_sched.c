@@ -0,0 +1,105 @@
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+#include "ffmpeg_sched.h"
+
+static int less(const SchedHeap *h, int a, int b)
+{
+    return h->key[a] < h->key[b] || (h->key[a] == h->key[b] && a < b);
+}
+
+static void place(SchedHeap *h, int i, int idx)
+{
+    h->heap[i] = idx;
+    h->pos[idx] = i;
+}
+
+static void sift_up(SchedHeap *h, int i)
+{
+    int idx = h->heap[i];
+
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!less(h, idx, h->heap[parent]))
+            break;
+        place(h, i, h->heap[parent]);
+        i = parent;
+    }
+    place(h, i, idx);
+}
+
+static void sift_down(SchedHeap *h, int i)
+{
+    int idx = h->heap[i];
+
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= h->size)
+            break;
+        if (child + 1 < h->size && less(h, h->heap[child + 1], h->heap[child]))
+            child++;
+        if (!less(h, h->heap[child], idx))
+            break;
+        place(h, i, h->heap[child]);
+        i = child;
+    }
+    place(h, i, idx);
+}
+
+int sched_heap_init(SchedHeap *h, int n)
+{
+    int i;
+
+    h->heap = av_malloc_array(n, sizeof(*h->heap));
+    h->pos  = av_malloc_array(n, sizeof(*h->pos));
+    h->key  = av_malloc_array(n, sizeof(*h->key));
+    h->size = 0;
+    h->nb_entries = n;
+    if (n && (!h->heap || !h->pos || !h->key)) {
+        sched_heap_free(h);
+        return AVERROR(ENOMEM);
+    }
+    for (i = 0; i < n; i++)
+        h->pos[i] = -1;
+    return 0;
+}
+
+void sched_heap_free(SchedHeap *h)
+{
+    av_freep(&h->heap);
+    av_freep(&h->pos);
+    av_freep(&h->key);
+    h->size = h->nb_entries = 0;
+}
+
+void sched_heap_update(SchedHeap *h, int idx, int64_t key)
+{
+    int i = h->pos[idx];
+
+    if (i < 0) {
+        h->key[idx] = key;
+        place(h, h->size++, idx);
+        sift_up(h, h->size - 1);
+        return;
+    }
+    if (key == h->key[idx])
+        return;
+    h->key[idx] = key;
+    sift_up(h, i);
+    sift_down(h, h->pos[idx]);
+}
+
+void sched_heap_remove(SchedHeap *h, int idx)
+{
+    int i = h->pos[idx];
+
+    if (i < 0)
+        return;
+    h->pos[idx] = -1;
+    if (i == --h->size)
+        return;
+    idx = h->heap[h->size];
+    place(h, i, idx);
+    sift_up(h, i);
+    sift_down(h, h->pos[idx]);
+}
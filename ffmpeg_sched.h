@@ -0,0 +1,45 @@
+#ifndef FFMPEG_SCHED_H
+#define FFMPEG_SCHED_H
+
+#include <stdint.h>
+
+/*
+ * Indexed binary min-heap of output streams keyed by their muxed dts, so
+ * picking the stream that is furthest behind costs O(1) and moving one
+ * stream forward after a write costs O(log n) instead of scanning every
+ * output stream per packet. Entries are identified by a dense index in
+ * [0, n) and ordered by (key, index), which keeps the lowest-index
+ * tie-break of the linear scan it replaces.
+ */
+
+typedef struct SchedHeap {
+    int *heap;          ///< entry indices in heap order
+    int *pos;           ///< heap position of each entry, -1 when absent
+    int64_t *key;
+    int size;
+    int nb_entries;     ///< capacity, entries are 0..nb_entries-1
+} SchedHeap;
+
+/**
+ * Allocate an empty heap for entries 0..n-1.
+ *
+ * @return 0 on success, a negative AVERROR code on failure
+ */
+int sched_heap_init(SchedHeap *h, int n);
+void sched_heap_free(SchedHeap *h);
+
+/**
+ * Insert idx with the given key, or move it if it is already present.
+ */
+void sched_heap_update(SchedHeap *h, int idx, int64_t key);
+void sched_heap_remove(SchedHeap *h, int idx);
+
+/**
+ * @return the entry with the smallest key, -1 if the heap is empty
+ */
+static inline int sched_heap_top(const SchedHeap *h)
+{
+    return h->size ? h->heap[0] : -1;
+}
+
+#endif
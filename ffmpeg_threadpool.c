@@ -0,0 +1,257 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+#include <libavutil/mem.h>
+
+#include "ffmpeg_threadpool.h"
+
+typedef struct PoolBatch {
+    ThreadPoolSession *session;
+    ThreadPoolFunc *func;
+    void *opaque;
+    int *ret;
+    int nb_jobs;
+    atomic_int next_job;        ///< next job to claim, may run past nb_jobs
+    /* under the pool lock */
+    int done;
+    int users;                  ///< workers that may still touch the batch
+    struct PoolBatch *next;
+} PoolBatch;
+
+struct ThreadPoolSession {
+    PoolBatch *head;            ///< batches that may have unclaimed jobs
+    struct ThreadPoolSession *next;
+    ThreadPoolStats stats;
+};
+
+typedef struct ThreadPool {
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;   ///< a batch was queued
+    pthread_cond_t done_cond;   ///< a batch may be complete
+    int nb_threads;
+    int nb_sessions;
+    ThreadPoolSession *sessions;
+    ThreadPoolSession *last;    ///< session served last, for round-robin
+} ThreadPool;
+
+static ThreadPool pool = {
+    .lock      = PTHREAD_MUTEX_INITIALIZER,
+    .work_cond = PTHREAD_COND_INITIALIZER,
+    .done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int run_jobs(PoolBatch *b)
+{
+    int jobnr, n = 0;
+
+    while ((jobnr = atomic_fetch_add(&b->next_job, 1)) < b->nb_jobs) {
+        int ret = b->func(b->opaque, jobnr, b->nb_jobs);
+        if (b->ret)
+            b->ret[jobnr] = ret;
+        n++;
+    }
+    return n;
+}
+
+static void unlink_batch(PoolBatch *b)
+{
+    PoolBatch **p;
+
+    for (p = &b->session->head; *p; p = &(*p)->next)
+        if (*p == b) {
+            *p = b->next;
+            return;
+        }
+}
+
+/* next session after the one served last that still has jobs to claim */
+static PoolBatch *pick_batch(void)
+{
+    ThreadPoolSession *s = pool.last && pool.last->next ? pool.last->next : pool.sessions;
+    int i;
+
+    for (i = 0; i < pool.nb_sessions; i++) {
+        while (s->head && atomic_load(&s->head->next_job) >= s->head->nb_jobs)
+            s->head = s->head->next;
+        if (s->head) {
+            pool.last = s;
+            return s->head;
+        }
+        s = s->next ? s->next : pool.sessions;
+    }
+    return NULL;
+}
+
+static void *worker(av_unused void *arg)
+{
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        PoolBatch *b = pick_batch();
+        int n;
+
+        if (!b) {
+            pthread_cond_wait(&pool.work_cond, &pool.lock);
+            continue;
+        }
+        b->users++;
+        pthread_mutex_unlock(&pool.lock);
+
+        n = run_jobs(b);
+
+        pthread_mutex_lock(&pool.lock);
+        b->users--;
+        b->done += n;
+        b->session->stats.offloaded += n;
+        if (b->done == b->nb_jobs && !b->users)
+            pthread_cond_broadcast(&pool.done_cond);
+    }
+    return NULL;
+}
+
+int thread_pool_init(int nb_threads)
+{
+    int i, ret = 0;
+
+    if (nb_threads < 0)
+        nb_threads = av_cpu_count();
+
+    pthread_mutex_lock(&pool.lock);
+    if (pool.nb_threads)
+        goto end;
+    /* the submitting thread is the last one */
+    for (i = 0; i < nb_threads - 1; i++) {
+        pthread_t thread;
+
+        if ((ret = pthread_create(&thread, NULL, worker, NULL))) {
+            ret = AVERROR(ret);
+            break;
+        }
+        pthread_detach(thread);
+    }
+    pool.nb_threads = i + 1;
+end:
+    pthread_mutex_unlock(&pool.lock);
+    return ret;
+}
+
+int thread_pool_nb_threads(void)
+{
+    int n;
+
+    pthread_mutex_lock(&pool.lock);
+    n = pool.nb_threads;
+    pthread_mutex_unlock(&pool.lock);
+    return n;
+}
+
+ThreadPoolSession *thread_pool_session_alloc(void)
+{
+    ThreadPoolSession *s;
+
+    if (!thread_pool_nb_threads() || !(s = av_mallocz(sizeof(*s))))
+        return NULL;
+
+    pthread_mutex_lock(&pool.lock);
+    s->next = pool.sessions;
+    pool.sessions = s;
+    pool.nb_sessions++;
+    pthread_mutex_unlock(&pool.lock);
+    return s;
+}
+
+void thread_pool_session_free(ThreadPoolSession **psession)
+{
+    ThreadPoolSession *s = *psession, **p;
+
+    if (!s)
+        return;
+
+    pthread_mutex_lock(&pool.lock);
+    for (p = &pool.sessions; *p; p = &(*p)->next)
+        if (*p == s) {
+            *p = s->next;
+            break;
+        }
+    if (pool.last == s)
+        pool.last = NULL;
+    pool.nb_sessions--;
+    pthread_mutex_unlock(&pool.lock);
+    av_freep(psession);
+}
+
+int thread_pool_execute(ThreadPoolSession *s, ThreadPoolFunc *func,
+                        void *opaque, int *ret, int nb_jobs)
+{
+    PoolBatch b = { .session = s, .func = func, .opaque = opaque,
+                    .ret = ret, .nb_jobs = nb_jobs };
+    PoolBatch **tail;
+    int n, serial;
+
+    atomic_init(&b.next_job, 0);
+
+    /* sessions may submit from several threads, e.g. -filter_complex_parallel */
+    pthread_mutex_lock(&pool.lock);
+    serial = nb_jobs <= 1 || pool.nb_threads <= 1;
+    if (!serial) {
+        for (tail = &s->head; *tail; tail = &(*tail)->next)
+            ;
+        *tail = &b;
+        if (nb_jobs > 2)
+            pthread_cond_broadcast(&pool.work_cond);
+        else
+            pthread_cond_signal(&pool.work_cond);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    n = run_jobs(&b);
+
+    pthread_mutex_lock(&pool.lock);
+    b.done += n;
+    if (!serial) {
+        while (b.done < b.nb_jobs || b.users)
+            pthread_cond_wait(&pool.done_cond, &pool.lock);
+        unlink_batch(&b);
+    }
+    s->stats.batches++;
+    s->stats.jobs += nb_jobs;
+    pthread_mutex_unlock(&pool.lock);
+    return 0;
+}
+
+typedef struct FilterJob {
+    AVFilterContext *ctx;
+    avfilter_action_func *func;
+    void *arg;
+} FilterJob;
+
+static int run_filter_job(void *opaque, int jobnr, int nb_jobs)
+{
+    FilterJob *job = opaque;
+    return job->func(job->ctx, job->arg, jobnr, nb_jobs);
+}
+
+int thread_pool_filter_execute(AVFilterContext *ctx, avfilter_action_func *func,
+                               void *arg, int *ret, int nb_jobs)
+{
+    FilterJob job = { ctx, func, arg };
+    return thread_pool_execute(ctx->graph->opaque, run_filter_job, &job, ret, nb_jobs);
+}
+
+int thread_pool_codec_threads(int nb_codecs)
+{
+    int n;
+
+    pthread_mutex_lock(&pool.lock);
+    n = pool.nb_threads / (FFMAX(pool.nb_sessions, 1) * FFMAX(nb_codecs, 1));
+    pthread_mutex_unlock(&pool.lock);
+    return FFMAX(n, 1);
+}
+
+void thread_pool_session_get_stats(const ThreadPoolSession *s, ThreadPoolStats *stats)
+{
+    pthread_mutex_lock(&pool.lock);
+    *stats = s->stats;
+    pthread_mutex_unlock(&pool.lock);
+}
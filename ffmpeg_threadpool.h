@@ -0,0 +1,73 @@
+#ifndef FFMPEG_THREADPOOL_H
+#define FFMPEG_THREADPOOL_H
+
+#include <stdint.h>
+
+#include <libavfilter/avfilter.h>
+
+/*
+ * One pool of worker threads for the whole process, shared by every
+ * session instead of each filtergraph starting its own slice threads.
+ * Work is submitted in batches of independent jobs. Idle workers take
+ * batches from the sessions in turn and claim single jobs from them, while
+ * the submitting thread works through the same batch, so a session always
+ * makes progress even when all workers are busy elsewhere.
+ */
+
+typedef struct ThreadPoolSession ThreadPoolSession;
+
+typedef int (ThreadPoolFunc)(void *opaque, int jobnr, int nb_jobs);
+
+typedef struct ThreadPoolStats {
+    uint64_t batches;
+    uint64_t jobs;
+    uint64_t offloaded;     ///< jobs run by pool workers, not the submitter
+} ThreadPoolStats;
+
+/**
+ * Start the process-wide pool. Only the first call has an effect.
+ *
+ * @param nb_threads threads working on batches including the submitting
+ *                   one, negative for one per core
+ */
+int thread_pool_init(int nb_threads);
+
+/**
+ * @return number of threads of the pool, 0 if it was not started
+ */
+int thread_pool_nb_threads(void);
+
+/**
+ * Register a unit of fairness, e.g. a transcode session. Batches are
+ * taken round-robin from the sessions with pending work.
+ *
+ * @return NULL if the pool was not started or on allocation failure
+ */
+ThreadPoolSession *thread_pool_session_alloc(void);
+void thread_pool_session_free(ThreadPoolSession **session);
+
+/**
+ * Run func for jobs 0..nb_jobs-1 and wait until all are done.
+ *
+ * @param ret if not NULL, receives the return value of every job
+ */
+int thread_pool_execute(ThreadPoolSession *session, ThreadPoolFunc *func,
+                        void *opaque, int *ret, int nb_jobs);
+
+/**
+ * AVFilterGraph.execute callback, the graph opaque must be the session.
+ */
+int thread_pool_filter_execute(AVFilterContext *ctx, avfilter_action_func *func,
+                               void *arg, int *ret, int nb_jobs);
+
+/**
+ * Threads a codec of the session should use so that all sessions together
+ * stay close to the pool size.
+ *
+ * @param nb_codecs threaded codecs the session runs at the same time
+ */
+int thread_pool_codec_threads(int nb_codecs);
+
+void thread_pool_session_get_stats(const ThreadPoolSession *session, ThreadPoolStats *stats);
+
+#endif
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+
+#include "ffmpeg_threadtune.h"
+
+/* pixels per thread at which a codec still has enough work per frame */
+#define ENC_PIXELS_PER_THREAD 160000
+#define DEC_PIXELS_PER_THREAD 400000
+/* filters need a few lines per slice to beat the job overhead */
+#define FILTER_LINES_PER_THREAD 270
+
+static double machine_load(void)
+{
+    double load = 0;
+    int running = 0;
+    FILE *f;
+
+    if (getloadavg(&load, 1) < 1)
+        load = 0;
+    /* the load average lags, the running count also sees jobs started
+     * in the same second; both include this process */
+    if ((f = fopen("/proc/loadavg", "r"))) {
+        if (fscanf(f, "%*f %*f %*f %d", &running) != 1)
+            running = 0;
+        fclose(f);
+    }
+    return FFMAX(load, running) - 1;
+}
+
+int thread_tune_cores(int nb_jobs)
+{
+    int cores = av_cpu_count();
+    int avail = cores - (int)(machine_load() + 0.5);
+
+    if (nb_jobs > 1)
+        avail = FFMIN(avail, cores / nb_jobs);
+    return av_clip(avail, 1, cores);
+}
+
+static int threads_for(int width, int height, int pixels_per_thread)
+{
+    int64_t pixels = (int64_t)width * height;
+    return av_clip((pixels + pixels_per_thread - 1) / pixels_per_thread, 1, 16);
+}
+
+void thread_tune_codec(AVCodecContext *avctx, const AVCodec *codec, int nb_jobs)
+{
+    int cores, threads;
+
+    if (avctx->codec_type != AVMEDIA_TYPE_VIDEO || avctx->width <= 0 || avctx->height <= 0)
+        return;
+
+    cores = thread_tune_cores(nb_jobs);
+    if (av_codec_is_encoder(codec)) {
+        /* the encoder is the expensive half of a transcode */
+        threads = FFMIN(threads_for(avctx->width, avctx->height, ENC_PIXELS_PER_THREAD),
+                        FFMAX(cores * 2 / 3, 1));
+    } else {
+        threads = FFMIN(threads_for(avctx->width, avctx->height, DEC_PIXELS_PER_THREAD),
+                        FFMAX(cores / 3, 1));
+        /* frame threads scale with any stream, slices only with sliced ones */
+        if (codec->capabilities & AV_CODEC_CAP_FRAME_THREADS)
+            avctx->thread_type = FF_THREAD_FRAME;
+        else if (codec->capabilities & AV_CODEC_CAP_SLICE_THREADS)
+            avctx->thread_type = FF_THREAD_SLICE;
+        else
+            threads = 1;
+    }
+    avctx->thread_count = threads;
+}
+
+int thread_tune_filter(int height, int nb_jobs)
+{
+    int cores = thread_tune_cores(nb_jobs);
+
+    if (height <= 0)
+        return 1;
+    return av_clip(height / FILTER_LINES_PER_THREAD, 1, FFMAX(cores / 4, 1));
+}
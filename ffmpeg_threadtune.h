@@ -0,0 +1,33 @@
+#ifndef FFMPEG_THREADTUNE_H
+#define FFMPEG_THREADTUNE_H
+
+#include <libavcodec/avcodec.h>
+
+/*
+ * Thread counts per job from the frame size, the codec's threading
+ * capabilities and the cores left over by the rest of the machine. One job
+ * alone gets enough threads to keep its codecs busy, jobs running side by
+ * side shrink towards one thread each, which is where throughput peaks
+ * once the cores are all taken.
+ */
+
+/**
+ * Cores this job can expect to have: the core count minus the current
+ * load, divided among nb_jobs when the caller knows how many jobs share
+ * the machine (0 if it does not).
+ */
+int thread_tune_cores(int nb_jobs);
+
+/**
+ * Set thread_count and thread_type of a video codec context whose
+ * dimensions are known, before avcodec_open2(). Other media types are left
+ * alone.
+ */
+void thread_tune_codec(AVCodecContext *avctx, const AVCodec *codec, int nb_jobs);
+
+/**
+ * @return slice threads for a filtergraph working on frames of this height
+ */
+int thread_tune_filter(int height, int nb_jobs);
+
+#endif
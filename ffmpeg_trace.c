@@ -0,0 +1,179 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include "ffmpeg_trace.h"
+
+/* per thread cap, one span is 40 bytes */
+#define TRACE_MAX_EVENTS (1 << 20)
+
+typedef struct TraceEvent {
+    const char *name;
+    int64_t ts;
+    int64_t dur;
+    int64_t frame;
+    int file_index;
+    int stream_index;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+    struct TraceBuffer *next;
+    int tid;
+    TraceEvent *events;
+    int nb_events;
+    int nb_allocated;
+    uint64_t dropped;
+    unsigned packets;
+    int sampled;
+} TraceBuffer;
+
+char *trace_filename;
+int trace_sample_interval = 1;
+int trace_enabled;
+
+static TraceBuffer *trace_buffers;
+static int trace_nb_threads;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread TraceBuffer *trace_local;
+
+void trace_init(void)
+{
+    trace_enabled = !!trace_filename;
+    if (trace_sample_interval < 1)
+        trace_sample_interval = 1;
+}
+
+static TraceBuffer *get_trace_buffer(void)
+{
+    TraceBuffer *tb = trace_local;
+
+    if (tb)
+        return tb;
+
+    tb = av_mallocz(sizeof(*tb));
+    if (!tb)
+        return NULL;
+
+    /* only taken once per thread */
+    pthread_mutex_lock(&trace_lock);
+    tb->tid = ++trace_nb_threads;
+    tb->next = trace_buffers;
+    trace_buffers = tb;
+    pthread_mutex_unlock(&trace_lock);
+
+    trace_local = tb;
+    return tb;
+}
+
+void trace_sample_packet(void)
+{
+    TraceBuffer *tb;
+
+    if (!trace_enabled || !(tb = get_trace_buffer()))
+        return;
+    tb->sampled = !(tb->packets++ % trace_sample_interval);
+}
+
+int64_t trace_begin_sampled(void)
+{
+    TraceBuffer *tb = trace_local;
+
+    /* threads that never sampled a packet record everything they do */
+    if (!tb) {
+        if (!(tb = get_trace_buffer()))
+            return 0;
+        tb->sampled = 1;
+    }
+    if (!tb->sampled)
+        return 0;
+    return av_gettime_relative();
+}
+
+void trace_end_sampled(const char *name, int64_t begin, int file_index,
+                       int stream_index, int64_t frame)
+{
+    TraceBuffer *tb = trace_local;
+    TraceEvent *ev;
+
+    if (!tb)
+        return;
+
+    if (tb->nb_events >= tb->nb_allocated) {
+        int new_size = FFMAX(1024, 2 * tb->nb_allocated);
+        TraceEvent *events;
+
+        if (new_size > TRACE_MAX_EVENTS ||
+            !(events = av_realloc_array(tb->events, new_size, sizeof(*events)))) {
+            tb->dropped++;
+            return;
+        }
+        tb->events       = events;
+        tb->nb_allocated = new_size;
+    }
+
+    ev = &tb->events[tb->nb_events++];
+    ev->name         = name;
+    ev->ts           = begin;
+    ev->dur          = av_gettime_relative() - begin;
+    ev->frame        = frame;
+    ev->file_index   = file_index;
+    ev->stream_index = stream_index;
+}
+
+void trace_write(void)
+{
+    TraceBuffer *tb, *next;
+    FILE *f;
+    int pid = getpid();
+    int first = 1;
+    int i;
+
+    if (!trace_enabled)
+        return;
+    trace_enabled = 0;
+
+    f = fopen(trace_filename, "w");
+    if (!f)
+        av_log(NULL, AV_LOG_ERROR, "Cannot open trace file %s: %s\n",
+               trace_filename, av_err2str(AVERROR(errno)));
+
+    pthread_mutex_lock(&trace_lock);
+    if (f)
+        fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (tb = trace_buffers; tb; tb = next) {
+        next = tb->next;
+        if (f) {
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s %d\"}}",
+                    first ? "" : ",\n", pid, tb->tid,
+                    tb->tid == 1 ? "main" : "worker", tb->tid);
+            first = 0;
+            for (i = 0; i < tb->nb_events; i++) {
+                const TraceEvent *ev = &tb->events[i];
+                fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"transcode\",\"ph\":\"X\","
+                        "\"ts\":%"PRId64",\"dur\":%"PRId64",\"pid\":%d,\"tid\":%d,"
+                        "\"args\":{\"stream\":\"%d:%d\",\"frame\":%"PRId64"}}",
+                        ev->name, ev->ts, ev->dur, pid, tb->tid,
+                        ev->file_index, ev->stream_index, ev->frame);
+            }
+        }
+        if (tb->dropped)
+            av_log(NULL, AV_LOG_WARNING, "trace: thread %d dropped %"PRIu64" spans\n",
+                   tb->tid, tb->dropped);
+        av_freep(&tb->events);
+        av_free(tb);
+    }
+    trace_buffers = NULL;
+    pthread_mutex_unlock(&trace_lock);
+
+    if (f) {
+        fprintf(f, "\n]}\n");
+        fclose(f);
+    }
+}
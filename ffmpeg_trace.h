@@ -0,0 +1,55 @@
+#ifndef FFMPEG_TRACE_H
+#define FFMPEG_TRACE_H
+
+#include <stdint.h>
+
+/**
+ * Chrome trace-event recorder for the per-frame pipeline spans.
+ *
+ * Spans are appended to a buffer owned by the calling thread, so recording
+ * takes no lock. Only one packet out of every trace_sample_interval is
+ * traced; the spans of everything done on behalf of that packet (decode,
+ * filtering, encode, mux) are kept, the others cost a single branch.
+ */
+
+extern char *trace_filename;
+extern int trace_sample_interval;
+extern int trace_enabled;
+
+/**
+ * Enable tracing if -trace was given. Must be called before any span is
+ * recorded.
+ */
+void trace_init(void);
+
+/**
+ * Decide whether the work triggered by the next input packet on this
+ * thread is recorded.
+ */
+void trace_sample_packet(void);
+
+int64_t trace_begin_sampled(void);
+void trace_end_sampled(const char *name, int64_t begin, int file_index,
+                       int stream_index, int64_t frame);
+
+/**
+ * @return a span start timestamp, or 0 if the current packet is not traced
+ */
+static inline int64_t trace_begin(void)
+{
+    return trace_enabled ? trace_begin_sampled() : 0;
+}
+
+static inline void trace_end(const char *name, int64_t begin, int file_index,
+                             int stream_index, int64_t frame)
+{
+    if (begin)
+        trace_end_sampled(name, begin, file_index, stream_index, frame);
+}
+
+/**
+ * Write all recorded spans to trace_filename and free the buffers.
+ */
+void trace_write(void);
+
+#endif
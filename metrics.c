@@ -0,0 +1,261 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <libavutil/bprint.h>
+#include <libavutil/time.h>
+
+#include "metrics.h"
+
+static const int ttfb_bounds[METRICS_TTFB_BUCKETS] = {
+    5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000
+};
+
+static struct {
+    atomic_llong  connections_queued;
+    atomic_llong  workers_running;
+    atomic_llong  sessions_active;
+    atomic_ullong sessions_total;
+    atomic_ullong forks_total;
+    atomic_ullong fork_failures_total;
+    atomic_llong  children_running;
+    atomic_ullong bytes_sent_total;
+    atomic_ullong cpu_user_usec_total;
+    atomic_ullong cpu_system_usec_total;
+    atomic_ullong ttfb_buckets[METRICS_TTFB_BUCKETS + 1];
+    atomic_ullong ttfb_sum_usec;
+    atomic_ullong ttfb_count;
+    atomic_llong  next_id;
+} metrics;
+
+static MetricsSession sessions[METRICS_MAX_SESSIONS];
+
+void metrics_init(void)
+{
+    memset(&metrics, 0, sizeof(metrics));
+    memset(sessions, 0, sizeof(sessions));
+}
+
+void metrics_connection_queued(void)
+{
+    atomic_fetch_add(&metrics.connections_queued, 1);
+}
+
+void metrics_connection_dequeued(void)
+{
+    atomic_fetch_sub(&metrics.connections_queued, 1);
+}
+
+void metrics_worker_start(void)
+{
+    atomic_fetch_add(&metrics.workers_running, 1);
+}
+
+void metrics_worker_stop(void)
+{
+    atomic_fetch_sub(&metrics.workers_running, 1);
+}
+
+MetricsSession *metrics_session_begin(int64_t start_time)
+{
+    int i;
+
+    atomic_fetch_add(&metrics.sessions_active, 1);
+    atomic_fetch_add(&metrics.sessions_total, 1);
+
+    for (i = 0; i < METRICS_MAX_SESSIONS; i++) {
+        MetricsSession *s = &sessions[i];
+        int expected = 0;
+
+        if (!atomic_compare_exchange_strong(&s->in_use, &expected, 1))
+            continue;
+
+        atomic_store(&s->start_time, start_time);
+        atomic_store(&s->first_byte, 0);
+        atomic_store(&s->bytes_sent, 0);
+        atomic_store(&s->speed, 0);
+        atomic_store(&s->queued_bytes, 0);
+        atomic_store(&s->pid, 0);
+        atomic_store(&s->id, atomic_fetch_add(&metrics.next_id, 1));
+        return s;
+    }
+
+    /* more sessions than slots: still counted globally, just not per session */
+    return NULL;
+}
+
+void metrics_session_end(MetricsSession *s)
+{
+    atomic_fetch_sub(&metrics.sessions_active, 1);
+    if (s)
+        atomic_store(&s->in_use, 0);
+}
+
+void metrics_session_fork(MetricsSession *s, int pid)
+{
+    if (pid < 0) {
+        atomic_fetch_add(&metrics.fork_failures_total, 1);
+        return;
+    }
+    atomic_fetch_add(&metrics.forks_total, 1);
+    atomic_fetch_add(&metrics.children_running, 1);
+    if (s)
+        atomic_store(&s->pid, pid);
+}
+
+void metrics_session_exit(MetricsSession *s, const struct rusage *ru)
+{
+    atomic_fetch_sub(&metrics.children_running, 1);
+    if (ru) {
+        atomic_fetch_add(&metrics.cpu_user_usec_total,
+                         ru->ru_utime.tv_sec * 1000000ULL + ru->ru_utime.tv_usec);
+        atomic_fetch_add(&metrics.cpu_system_usec_total,
+                         ru->ru_stime.tv_sec * 1000000ULL + ru->ru_stime.tv_usec);
+    }
+    if (s)
+        atomic_store(&s->pid, 0);
+}
+
+void metrics_session_sent(MetricsSession *s, size_t bytes)
+{
+    atomic_fetch_add(&metrics.bytes_sent_total, bytes);
+    if (!s)
+        return;
+
+    if (!atomic_load(&s->first_byte)) {
+        int64_t now  = av_gettime_relative();
+        int64_t ttfb = now - atomic_load(&s->start_time);
+        int i;
+
+        atomic_store(&s->first_byte, now);
+        for (i = 0; i < METRICS_TTFB_BUCKETS; i++)
+            if (ttfb <= ttfb_bounds[i] * 1000LL)
+                break;
+        atomic_fetch_add(&metrics.ttfb_buckets[i], 1);
+        atomic_fetch_add(&metrics.ttfb_sum_usec, ttfb);
+        atomic_fetch_add(&metrics.ttfb_count, 1);
+    }
+    atomic_fetch_add(&s->bytes_sent, bytes);
+}
+
+void metrics_session_speed(MetricsSession *s, double speed)
+{
+    if (s)
+        atomic_store(&s->speed, (int)(speed * 1000));
+}
+
+void metrics_session_progress(MetricsSession *s, const char *line)
+{
+    if (!strncmp(line, "speed=", 6) && strcmp(line + 6, "N/A"))
+        metrics_session_speed(s, strtod(line + 6, NULL));
+    else if (!strncmp(line, "mem_bytes=", 10) && s)
+        atomic_store(&s->queued_bytes, strtoll(line + 10, NULL, 10));
+}
+
+static void print_metric(AVBPrint *bp, const char *name, const char *type,
+                         const char *help, double value)
+{
+    av_bprintf(bp, "# HELP %s %s\n# TYPE %s %s\n%s %.15g\n",
+               name, help, name, type, name, value);
+}
+
+void metrics_serve(int client)
+{
+    static const char header[] =
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "\r\n";
+    uint64_t cumulative = 0;
+    int64_t now = av_gettime_relative();
+    AVBPrint bp;
+    int i;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+
+    print_metric(&bp, "cffmpeg_connections_queued", "gauge",
+                 "Accepted connections whose request is not parsed yet",
+                 atomic_load(&metrics.connections_queued));
+    print_metric(&bp, "cffmpeg_sessions_active", "gauge",
+                 "Transcoding sessions currently streaming",
+                 atomic_load(&metrics.sessions_active));
+    print_metric(&bp, "cffmpeg_sessions_total", "counter",
+                 "Transcoding sessions started",
+                 atomic_load(&metrics.sessions_total));
+    print_metric(&bp, "cffmpeg_workers", "gauge",
+                 "Client threads currently running",
+                 atomic_load(&metrics.workers_running));
+    print_metric(&bp, "cffmpeg_forks_total", "counter",
+                 "Transcoding processes forked",
+                 atomic_load(&metrics.forks_total));
+    print_metric(&bp, "cffmpeg_fork_failures_total", "counter",
+                 "Failed fork() calls",
+                 atomic_load(&metrics.fork_failures_total));
+    print_metric(&bp, "cffmpeg_children", "gauge",
+                 "Transcoding processes currently running",
+                 atomic_load(&metrics.children_running));
+    print_metric(&bp, "cffmpeg_bytes_sent_total", "counter",
+                 "Bytes of transcoded output sent to clients",
+                 atomic_load(&metrics.bytes_sent_total));
+    print_metric(&bp, "cffmpeg_transcode_cpu_user_seconds_total", "counter",
+                 "User CPU time of finished transcoding processes",
+                 atomic_load(&metrics.cpu_user_usec_total) / 1000000.0);
+    print_metric(&bp, "cffmpeg_transcode_cpu_system_seconds_total", "counter",
+                 "System CPU time of finished transcoding processes",
+                 atomic_load(&metrics.cpu_system_usec_total) / 1000000.0);
+
+    av_bprintf(&bp, "# HELP cffmpeg_ttfb_seconds Time from accept to the first byte sent\n"
+                    "# TYPE cffmpeg_ttfb_seconds histogram\n");
+    for (i = 0; i <= METRICS_TTFB_BUCKETS; i++) {
+        cumulative += atomic_load(&metrics.ttfb_buckets[i]);
+        if (i < METRICS_TTFB_BUCKETS)
+            av_bprintf(&bp, "cffmpeg_ttfb_seconds_bucket{le=\"%g\"} %"PRIu64"\n",
+                       ttfb_bounds[i] / 1000.0, cumulative);
+        else
+            av_bprintf(&bp, "cffmpeg_ttfb_seconds_bucket{le=\"+Inf\"} %"PRIu64"\n",
+                       cumulative);
+    }
+    av_bprintf(&bp, "cffmpeg_ttfb_seconds_sum %.6f\n",
+               atomic_load(&metrics.ttfb_sum_usec) / 1000000.0);
+    av_bprintf(&bp, "cffmpeg_ttfb_seconds_count %"PRIu64"\n",
+               (uint64_t)atomic_load(&metrics.ttfb_count));
+
+    av_bprintf(&bp, "# HELP cffmpeg_session_speed Encode speed of a running session (realtime = 1)\n"
+                    "# TYPE cffmpeg_session_speed gauge\n");
+    for (i = 0; i < METRICS_MAX_SESSIONS; i++) {
+        MetricsSession *s = &sessions[i];
+        if (atomic_load(&s->in_use))
+            av_bprintf(&bp, "cffmpeg_session_speed{session=\"%lld\"} %.3f\n",
+                       (long long)atomic_load(&s->id), atomic_load(&s->speed) / 1000.0);
+    }
+    av_bprintf(&bp, "# HELP cffmpeg_session_queued_bytes Bytes of packets and frames queued by a running session\n"
+                    "# TYPE cffmpeg_session_queued_bytes gauge\n");
+    for (i = 0; i < METRICS_MAX_SESSIONS; i++) {
+        MetricsSession *s = &sessions[i];
+        if (atomic_load(&s->in_use))
+            av_bprintf(&bp, "cffmpeg_session_queued_bytes{session=\"%lld\"} %lld\n",
+                       (long long)atomic_load(&s->id), (long long)atomic_load(&s->queued_bytes));
+    }
+    av_bprintf(&bp, "# HELP cffmpeg_session_bytes_sent Bytes sent by a running session\n"
+                    "# TYPE cffmpeg_session_bytes_sent gauge\n");
+    for (i = 0; i < METRICS_MAX_SESSIONS; i++) {
+        MetricsSession *s = &sessions[i];
+        if (atomic_load(&s->in_use))
+            av_bprintf(&bp, "cffmpeg_session_bytes_sent{session=\"%lld\"} %"PRIu64"\n",
+                       (long long)atomic_load(&s->id), (uint64_t)atomic_load(&s->bytes_sent));
+    }
+    av_bprintf(&bp, "# HELP cffmpeg_session_age_seconds Time since a running session was accepted\n"
+                    "# TYPE cffmpeg_session_age_seconds gauge\n");
+    for (i = 0; i < METRICS_MAX_SESSIONS; i++) {
+        MetricsSession *s = &sessions[i];
+        if (atomic_load(&s->in_use))
+            av_bprintf(&bp, "cffmpeg_session_age_seconds{session=\"%lld\"} %.3f\n",
+                       (long long)atomic_load(&s->id),
+                       (now - atomic_load(&s->start_time)) / 1000000.0);
+    }
+
+    send(client, header, strlen(header), 0);
+    if (av_bprint_is_complete(&bp))
+        send(client, bp.str, bp.len, 0);
+    av_bprint_finalize(&bp, NULL);
+}
@@ -0,0 +1,59 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+#include "stdatomic.h"
+
+#define METRICS_MAX_SESSIONS 256
+
+/* upper bounds of the time-to-first-byte histogram buckets, in milliseconds */
+#define METRICS_TTFB_BUCKETS 12
+
+/**
+ * Per-session counters. A slot is claimed by the thread serving the client
+ * and only read by the /metrics handler, so all updates are plain atomic
+ * stores/adds and scraping never blocks the data path.
+ */
+typedef struct MetricsSession {
+    atomic_int   in_use;
+    atomic_llong id;
+    atomic_llong start_time;    ///< av_gettime_relative() at accept
+    atomic_llong first_byte;    ///< time of the first byte sent, 0 before
+    atomic_ullong bytes_sent;
+    atomic_int   speed;         ///< last encode speed reported by -progress, x1000
+    atomic_llong queued_bytes;  ///< packets and frames queued, from -progress mem_bytes
+    atomic_int   pid;           ///< transcoding child, 0 before fork
+} MetricsSession;
+
+void metrics_init(void);
+
+/* connection accepted, request not parsed yet */
+void metrics_connection_queued(void);
+void metrics_connection_dequeued(void);
+
+/* client thread started/finished */
+void metrics_worker_start(void);
+void metrics_worker_stop(void);
+
+MetricsSession *metrics_session_begin(int64_t start_time);
+void metrics_session_end(MetricsSession *s);
+
+void metrics_session_fork(MetricsSession *s, int pid);
+void metrics_session_exit(MetricsSession *s, const struct rusage *ru);
+void metrics_session_sent(MetricsSession *s, size_t bytes);
+void metrics_session_speed(MetricsSession *s, double speed);
+
+/**
+ * Parse one line of the -progress key=value stream of a session.
+ */
+void metrics_session_progress(MetricsSession *s, const char *line);
+
+/**
+ * Write the HTTP response for a /metrics scrape to the client socket.
+ */
+void metrics_serve(int client);
+
+#endif
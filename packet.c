@@ -4,6 +4,8 @@ int PacketListInit(PacketList* pl){
 	pl->header=NULL;
 	pl->tail = NULL;
 	pl->length=0;
+	pl->bytes=0;
+	pl->budget=NULL;
 	pthread_mutex_init(&(pl->packetLocker),NULL);
 	return 0;
 };
@@ -16,6 +18,7 @@ int PacketListPushBack(PacketList* pl,AVPacket* packet){
 	pthread_mutex_lock(&pl->packetLocker);
 	PacketNode* pn = (PacketNode*)malloc(sizeof(PacketNode));
 	pn->packet = packet;
+	pn->size = mem_packet_size(packet);
 	pn->next = NULL;
 	if(pl->length==0){
 		pl->header = pn;
@@ -26,6 +29,10 @@ int PacketListPushBack(PacketList* pl,AVPacket* packet){
 		pl->tail->next = NULL;
 	}
 	pl->length++;
+	pl->bytes += pn->size;
+	if(pl->budget!=NULL){
+		mem_budget_charge(pl->budget,pn->size);
+	}
 	pthread_mutex_unlock(&pl->packetLocker);
 	return 0;
 }
@@ -37,14 +44,21 @@ AVPacket* PacketListGetFront(PacketList* pl){
 	}
 	pthread_mutex_lock(&pl->packetLocker);
 	if(pl->length==0||pl->header==NULL){
+		pthread_mutex_unlock(&pl->packetLocker);
 		return NULL;
 	}
 	PacketNode* pn = pl->header;
+	AVPacket* packet = pn->packet;
 	//av_log(NULL,AV_LOG_INFO,"can get packet,packet address is %x,length is %d,%d\n",pl->header->packet,pl->length,pthread_self());
 	pl->header = pl->header->next;
 	pl->length--;
+	pl->bytes -= pn->size;
+	if(pl->budget!=NULL){
+		mem_budget_release(pl->budget,pn->size);
+	}
 	pthread_mutex_unlock(&pl->packetLocker);
-	return pn->packet;
+	free(pn);
+	return packet;
 }
 
 int ReleasePacketList(PacketList* pl){
@@ -52,8 +66,16 @@ int ReleasePacketList(PacketList* pl){
 		return 0;
 	}
 	while(pl->header!=NULL){
-		av_packet_unref(pl->header->packet);
-		pl->header = pl->header->next;
+		PacketNode* pn = pl->header;
+		av_packet_unref(pn->packet);
+		if(pl->budget!=NULL){
+			mem_budget_release(pl->budget,pn->size);
+		}
+		pl->header = pn->next;
+		free(pn);
 	}
+	pl->tail = NULL;
+	pl->length = 0;
+	pl->bytes = 0;
 	return 0;
 }
\ No newline at end of file
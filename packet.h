@@ -1,8 +1,10 @@
 #include "libavcodec/avcodec.h"
 #include <pthread.h>
+#include "ffmpeg_mem.h"
 
 typedef struct PacketNode{
 	AVPacket* packet;
+	int64_t size;
 	struct PacketNode* next;
 }PacketNode;
 
@@ -10,6 +12,8 @@ typedef struct PacketList{
 	PacketNode* header;
 	PacketNode* tail;
 	int length;
+	int64_t bytes;
+	MemBudget* budget;	//charged for every queued packet, may be NULL
 	pthread_mutex_t packetLocker;
 }PacketList;
 
@@ -0,0 +1,316 @@
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/mem.h>
+
+#include "remux.h"
+
+/* read when the header did not describe every stream */
+#define REMUX_PROBESIZE     (1 << 20)
+#define REMUX_ANALYZE_USEC  (1 * AV_TIME_BASE)
+
+typedef struct RemuxStream {
+    int out_index;          ///< -1 if not copied
+    int started;            ///< a keyframe was seen
+    AVBSFContext *bsf;
+} RemuxStream;
+
+/* the parameters a muxer needs, what find_stream_info would fill in */
+static int stream_info_complete(const AVStream *st)
+{
+    const AVCodecParameters *par = st->codecpar;
+
+    if (par->codec_id == AV_CODEC_ID_NONE)
+        return 0;
+    switch (par->codec_type) {
+    case AVMEDIA_TYPE_VIDEO:
+        return par->width > 0 && par->height > 0;
+    case AVMEDIA_TYPE_AUDIO:
+        return par->sample_rate > 0 && par->channels > 0;
+    default:
+        return 1;
+    }
+}
+
+int remux_open_input(const char *filename, AVFormatContext **pic, int *probed)
+{
+    AVFormatContext *ic = NULL;
+    AVDictionary *opts = NULL;
+    int i, ret;
+
+    /* the header of most containers is enough, do not read ahead */
+    av_dict_set_int(&opts, "probesize", REMUX_PROBESIZE, 0);
+    av_dict_set_int(&opts, "analyzeduration", REMUX_ANALYZE_USEC, 0);
+    ret = avformat_open_input(&ic, filename, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open input file %s: %s\n",
+               filename, av_err2str(ret));
+        return ret;
+    }
+
+    for (i = 0; i < ic->nb_streams; i++)
+        if (!stream_info_complete(ic->streams[i]))
+            break;
+    if (i < ic->nb_streams || !ic->nb_streams) {
+        if (probed)
+            *probed = 1;
+        ic->fps_probe_size = 0;
+        if ((ret = avformat_find_stream_info(ic, NULL)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "%s: could not find codec parameters: %s\n",
+                   filename, av_err2str(ret));
+            avformat_close_input(&ic);
+            return ret;
+        }
+    }
+    *pic = ic;
+    return 0;
+}
+
+const char *remux_annexb_bsf(const AVCodecParameters *par, const AVOutputFormat *ofmt)
+{
+    if (strcmp(ofmt->name, "mpegts") || par->extradata_size < 7 || par->extradata[0] != 1)
+        return NULL;
+    if (par->codec_id == AV_CODEC_ID_H264)
+        return "h264_mp4toannexb";
+    if (par->codec_id == AV_CODEC_ID_HEVC)
+        return "hevc_mp4toannexb";
+    return NULL;
+}
+
+static int add_stream(AVFormatContext *oc, AVStream *ist, RemuxStream *rs)
+{
+    const char *bsf_name = remux_annexb_bsf(ist->codecpar, oc->oformat);
+    AVStream *ost;
+    int ret;
+
+    if (!(ost = avformat_new_stream(oc, NULL)))
+        return AVERROR(ENOMEM);
+    rs->out_index = ost->index;
+
+    if (bsf_name) {
+        const AVBitStreamFilter *filter = av_bsf_get_by_name(bsf_name);
+
+        if (!filter)
+            return AVERROR_BSF_NOT_FOUND;
+        if ((ret = av_bsf_alloc(filter, &rs->bsf)) < 0 ||
+            (ret = avcodec_parameters_copy(rs->bsf->par_in, ist->codecpar)) < 0)
+            return ret;
+        rs->bsf->time_base_in = ist->time_base;
+        if ((ret = av_bsf_init(rs->bsf)) < 0 ||
+            (ret = avcodec_parameters_copy(ost->codecpar, rs->bsf->par_out)) < 0)
+            return ret;
+    } else if ((ret = avcodec_parameters_copy(ost->codecpar, ist->codecpar)) < 0) {
+        return ret;
+    }
+
+    /* the input's tag may mean something else in the output container */
+    ost->codecpar->codec_tag = 0;
+    ost->time_base = ist->time_base;
+    ost->disposition = ist->disposition;
+    av_dict_copy(&ost->metadata, ist->metadata, 0);
+    return 0;
+}
+
+static int write_packet(AVFormatContext *oc, AVStream *ist, RemuxStream *rs,
+                        AVPacket *pkt, RemuxJob *job)
+{
+    AVStream *ost = oc->streams[rs->out_index];
+    int64_t out_time;
+    int ret;
+
+    if (job->ts_offset) {
+        int64_t offset = av_rescale_q(job->ts_offset, AV_TIME_BASE_Q, ist->time_base);
+
+        if (pkt->pts != AV_NOPTS_VALUE)
+            pkt->pts += offset;
+        if (pkt->dts != AV_NOPTS_VALUE)
+            pkt->dts += offset;
+    }
+
+    out_time = pkt->dts != AV_NOPTS_VALUE ?
+               av_rescale_q(pkt->dts, ist->time_base, AV_TIME_BASE_Q) : AV_NOPTS_VALUE;
+    pkt->stream_index = rs->out_index;
+    pkt->pos = -1;
+    av_packet_rescale_ts(pkt, ist->time_base, ost->time_base);
+    job->packets++;
+    job->bytes += pkt->size;
+    /* the packet keeps its demuxer buffer, the muxer takes the reference */
+    if ((ret = av_interleaved_write_frame(oc, pkt)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Error muxing a packet to %s: %s\n",
+               job->output, av_err2str(ret));
+        return ret;
+    }
+    if (job->progress && out_time != AV_NOPTS_VALUE)
+        ret = job->progress(job->opaque, job, out_time);
+    return ret;
+}
+
+static int remux_streams(AVFormatContext *ic, RemuxJob *job)
+{
+    AVFormatContext *oc = NULL;
+    RemuxStream *streams = NULL;
+    AVPacket pkt;
+    int i, ret, nb_streams = 0;
+
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+
+    ret = avformat_alloc_output_context2(&oc, NULL, job->format, job->output);
+    if (ret < 0 || !oc) {
+        av_log(NULL, AV_LOG_ERROR, "Could not create output context for %s\n", job->output);
+        ret = ret < 0 ? ret : AVERROR_UNKNOWN;
+        goto end;
+    }
+
+    nb_streams = ic->nb_streams;
+    if (!(streams = av_mallocz_array(nb_streams, sizeof(*streams)))) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    for (i = 0; i < nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+        enum AVMediaType type = st->codecpar->codec_type;
+
+        streams[i].out_index = -1;
+        if (job->streams || (type != AVMEDIA_TYPE_VIDEO && type != AVMEDIA_TYPE_AUDIO &&
+                             type != AVMEDIA_TYPE_SUBTITLE)) {
+            st->discard = AVDISCARD_ALL;
+            continue;
+        }
+        if ((ret = add_stream(oc, st, &streams[i])) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Could not set up output stream for input stream #%d: %s\n",
+                   i, av_err2str(ret));
+            goto end;
+        }
+    }
+    for (i = 0; job->streams && i < job->nb_streams; i++) {
+        int idx = job->streams[i];
+
+        if (idx < 0 || idx >= nb_streams || streams[idx].out_index >= 0) {
+            ret = AVERROR(EINVAL);
+            goto end;
+        }
+        ic->streams[idx]->discard = AVDISCARD_DEFAULT;
+        if ((ret = add_stream(oc, ic->streams[idx], &streams[idx])) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Could not set up output stream for input stream #%d: %s\n",
+                   idx, av_err2str(ret));
+            goto end;
+        }
+    }
+    av_dict_copy(&oc->metadata, ic->metadata, 0);
+
+    if (!(oc->oformat->flags & AVFMT_NOFILE) &&
+        (ret = avio_open(&oc->pb, job->output, AVIO_FLAG_WRITE)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open output file %s: %s\n",
+               job->output, av_err2str(ret));
+        goto end;
+    }
+    if ((ret = avformat_write_header(oc, NULL)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not write header for %s: %s\n",
+               job->output, av_err2str(ret));
+        goto end;
+    }
+
+    while ((ret = av_read_frame(ic, &pkt)) >= 0) {
+        AVStream *st;
+        RemuxStream *rs;
+
+        /* streams appearing after the header are not copied */
+        if (pkt.stream_index >= nb_streams || streams[pkt.stream_index].out_index < 0) {
+            av_packet_unref(&pkt);
+            continue;
+        }
+        st = ic->streams[pkt.stream_index];
+        rs = &streams[pkt.stream_index];
+        /* what precedes the first keyframe can not be decoded */
+        if (!rs->started && !(pkt.flags & AV_PKT_FLAG_KEY) && !job->copy_initial_nonkeyframes) {
+            av_packet_unref(&pkt);
+            continue;
+        }
+        rs->started = 1;
+        if (!rs->bsf) {
+            ret = write_packet(oc, st, rs, &pkt, job);
+        } else if ((ret = av_bsf_send_packet(rs->bsf, &pkt)) >= 0) {
+            while ((ret = av_bsf_receive_packet(rs->bsf, &pkt)) >= 0)
+                if ((ret = write_packet(oc, st, rs, &pkt, job)) < 0)
+                    break;
+            if (ret == AVERROR(EAGAIN))
+                ret = 0;
+        }
+        av_packet_unref(&pkt);
+        if (ret < 0)
+            goto end;
+    }
+    if (ret != AVERROR_EOF) {
+        av_log(NULL, AV_LOG_ERROR, "Error reading %s: %s\n", job->input, av_err2str(ret));
+        goto end;
+    }
+
+    for (i = 0; i < nb_streams; i++) {
+        if (!streams[i].bsf)
+            continue;
+        av_bsf_send_packet(streams[i].bsf, NULL);
+        while (av_bsf_receive_packet(streams[i].bsf, &pkt) >= 0)
+            if ((ret = write_packet(oc, ic->streams[i], &streams[i], &pkt, job)) < 0)
+                goto end;
+    }
+
+    ret = av_write_trailer(oc);
+
+end:
+    av_packet_unref(&pkt);
+    for (i = 0; streams && i < nb_streams; i++)
+        av_bsf_free(&streams[i].bsf);
+    av_freep(&streams);
+    if (oc && !(oc->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&oc->pb);
+    avformat_free_context(oc);
+    return ret;
+}
+
+static int remux_job(RemuxJob *job)
+{
+    AVFormatContext *ic = NULL;
+    int ret;
+
+    if ((ret = remux_open_input(job->input, &ic, &job->probed)) < 0)
+        return ret;
+    ret = remux_streams(ic, job);
+    avformat_close_input(&ic);
+    return ret;
+}
+
+int remux_context(AVFormatContext *ic, RemuxJob *job)
+{
+    job->packets = job->bytes = 0;
+    return remux_streams(ic, job);
+}
+
+int remux_file(const char *input, const char *output, const char *format)
+{
+    RemuxJob job = { input, output, format };
+
+    return remux_job(&job);
+}
+
+int remux_batch(RemuxJob *jobs, int nb_jobs)
+{
+    int i, failed = 0;
+
+    for (i = 0; i < nb_jobs; i++) {
+        RemuxJob *job = &jobs[i];
+
+        job->probed  = 0;
+        job->packets = job->bytes = 0;
+        job->ret = remux_job(job);
+        if (job->ret < 0)
+            failed++;
+        av_log(NULL, AV_LOG_VERBOSE, "Remuxed %s to %s: %"PRId64" packets, %"PRId64" bytes%s\n",
+               job->input, job->output, job->packets, job->bytes,
+               job->probed ? ", stream info probed" : "");
+    }
+    return failed;
+}
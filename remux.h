@@ -0,0 +1,73 @@
+#ifndef REMUX_H
+#define REMUX_H
+
+#include <stdint.h>
+
+#include <libavformat/avformat.h>
+
+/*
+ * Remux-only pipeline for jobs where every stream is copied: no decoders,
+ * no filtergraphs, stream info probing only when the container header
+ * leaves parameters open, and demuxed packets handed to the muxer by
+ * reference. Several jobs can run in one process one after another.
+ */
+
+typedef struct RemuxJob RemuxJob;
+
+struct RemuxJob {
+    const char *input;
+    const char *output;
+    const char *format;     ///< output format, NULL to guess from the name
+    /* input stream indices to copy, in output order; NULL copies every
+     * video, audio and subtitle stream */
+    const int *streams;
+    int nb_streams;
+    int64_t ts_offset;      ///< added to all timestamps, in AV_TIME_BASE units
+    /* keep the packets before a stream's first keyframe, like -copyinkf */
+    int copy_initial_nonkeyframes;
+    /* if set, called after every written packet with the output time so far
+     * in AV_TIME_BASE units; a negative return stops the job with that code */
+    int (*progress)(void *opaque, RemuxJob *job, int64_t out_time);
+    void *opaque;
+
+    /* filled in by remux_batch() */
+    int ret;
+    int probed;             ///< avformat_find_stream_info() had to run
+    int64_t packets;
+    int64_t bytes;
+};
+
+/**
+ * @return 0 on success, a negative AVERROR code on failure
+ */
+int remux_file(const char *input, const char *output, const char *format);
+
+/**
+ * Run the jobs in order. A failed job does not stop the others.
+ *
+ * @return number of failed jobs
+ */
+int remux_batch(RemuxJob *jobs, int nb_jobs);
+
+/**
+ * Run one job on an input opened by the caller, which keeps ownership.
+ * Packets buffered by avformat_find_stream_info() are not lost, so this
+ * also works for inputs that cannot be reopened. job->input is only used
+ * in messages.
+ */
+int remux_context(AVFormatContext *ic, RemuxJob *job);
+
+/**
+ * Open an input, running avformat_find_stream_info() only when the header
+ * does not describe every stream.
+ *
+ * @param probed if not NULL, set to 1 when stream info had to be probed
+ */
+int remux_open_input(const char *filename, AVFormatContext **ic, int *probed);
+
+/**
+ * @return the bitstream filter MP4-style H.264/HEVC needs for ofmt, or NULL
+ */
+const char *remux_annexb_bsf(const AVCodecParameters *par, const AVOutputFormat *ofmt);
+
+#endif
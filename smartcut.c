@@ -0,0 +1,565 @@
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/mem.h>
+#include <libavutil/timestamp.h>
+
+#include "remux.h"
+#include "smartcut.h"
+
+typedef struct SmartCutKey {
+    int64_t pts, dts;
+    int open;               ///< followed in decode order by pictures shown before it
+} SmartCutKey;
+
+enum SmartCutPhase {
+    PHASE_ENCODE,       ///< decoding, re-encoding frames of [seg_start, seg_end)
+    PHASE_COPY,         ///< copying complete GOPs
+    PHASE_DONE,
+};
+
+typedef struct SmartCut {
+    const char *input;
+    const char *output;
+    AVFormatContext *ic, *oc;
+    int video;                  ///< input index of the cut video stream
+    int nb_streams;
+    int *out_index;             ///< per input stream, -1 if not written
+    int *stream_done;           ///< non-video stream went past the end
+    int nb_active;              ///< non-video streams still inside the range
+    AVBSFContext *bsf;          ///< for the copied video packets
+    AVCodecContext *dec, *enc;
+    AVFrame *frame;
+
+    int64_t start_us, end_us;   ///< absolute input timestamps, AV_TIME_BASE
+    int64_t start, end;         ///< same, video stream time base
+
+    /* keyframes from the one before start to the first one past the end,
+     * or past the first closed one after start when cutting to the end */
+    SmartCutKey *keys;
+    int nb_keys;
+    const SmartCutKey *copy_from;   ///< first copied keyframe, NULL if nothing is copied
+    const SmartCutKey *copy_to;     ///< first keyframe not copied, NULL to copy to the end
+
+    int phase;
+    int copy_started;
+    int64_t seg_start, seg_end;
+    int64_t seg_delay;          ///< pts - dts of the source keyframe the segment adjoins
+    SmartCutStats stats;
+} SmartCut;
+
+static int scan_keyframes(SmartCut *s, int64_t target)
+{
+    AVStream *vst = s->ic->streams[s->video];
+    AVPacket pkt;
+    int i, ret;
+
+    s->nb_keys = 0;
+    if ((ret = av_seek_frame(s->ic, s->video, target, AVSEEK_FLAG_BACKWARD)) < 0)
+        return ret;
+
+    /* only the video packets' flags and timestamps are needed */
+    for (i = 0; i < s->ic->nb_streams; i++)
+        if (i != s->video)
+            s->ic->streams[i]->discard = AVDISCARD_ALL;
+
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+    while ((ret = av_read_frame(s->ic, &pkt)) >= 0) {
+        int video = pkt.stream_index == s->video;
+        int key = video && (pkt.flags & AV_PKT_FLAG_KEY) && pkt.pts != AV_NOPTS_VALUE;
+        int64_t pts = pkt.pts;
+        int64_t dts = pkt.dts != AV_NOPTS_VALUE ? pkt.dts : pkt.pts;
+        SmartCutKey *last = s->nb_keys ? &s->keys[s->nb_keys - 1] : NULL;
+
+        av_packet_unref(&pkt);
+        if (video && !key && last && pts != AV_NOPTS_VALUE && pts < last->pts)
+            last->open = 1;
+        if (!key)
+            continue;
+        /* whether the previous keyframe is open is only known now */
+        if (last && (last->pts > s->end ||
+                     (s->end == INT64_MAX && last->pts >= s->start && !last->open)))
+            break;
+        if ((ret = av_reallocp_array(&s->keys, s->nb_keys + 1, sizeof(*s->keys))) < 0) {
+            s->nb_keys = 0;
+            break;
+        }
+        s->keys[s->nb_keys].pts  = pts;
+        s->keys[s->nb_keys].dts  = dts;
+        s->keys[s->nb_keys].open = 0;
+        s->nb_keys++;
+    }
+
+    for (i = 0; i < s->ic->nb_streams; i++)
+        s->ic->streams[i]->discard = AVDISCARD_DEFAULT;
+    if (ret == AVERROR_EOF)
+        ret = 0;
+    if (ret >= 0 && !s->nb_keys) {
+        av_log(NULL, AV_LOG_ERROR, "%s: no video keyframe found at %s\n",
+               s->input, av_ts2timestr(target, &vst->time_base));
+        ret = AVERROR_INVALIDDATA;
+    }
+    return ret;
+}
+
+static int find_keyframes(SmartCut *s)
+{
+    int ret;
+
+    if ((ret = scan_keyframes(s, s->start)) < 0)
+        return ret;
+    /* seek indexes may be in dts, which lands on a keyframe shown after start */
+    if (s->keys[0].pts > s->start && s->keys[0].dts > s->ic->streams[s->video]->start_time)
+        ret = scan_keyframes(s, s->keys[0].dts - 1);
+    return ret;
+}
+
+/* re-encode [start, copy_from) and [copy_to, end), copy the GOPs in between.
+ * Both splices are at closed GOPs: the leading pictures of an open one would
+ * be dropped at copy_from, as they reference the re-encoded GOP before it, and
+ * at copy_to they belong to the copied range but come after the keyframe. */
+static void plan_segments(SmartCut *s)
+{
+    const SmartCutKey *k1 = NULL, *k2 = NULL;
+    int i;
+
+    for (i = 0; i < s->nb_keys; i++) {
+        if (s->keys[i].open)
+            continue;
+        if (!k1 && s->keys[i].pts >= s->start)
+            k1 = &s->keys[i];
+        if (s->keys[i].pts <= s->end)
+            k2 = &s->keys[i];
+    }
+    if (k1 && s->end == INT64_MAX) {
+        s->copy_from = k1;
+    } else if (k1 && k2 && k2 >= k1) {
+        s->copy_from = k1;
+        s->copy_to   = k2;
+    }
+}
+
+static int add_stream(SmartCut *s, AVStream *ist)
+{
+    AVStream *ost;
+    int ret;
+
+    if (!(ost = avformat_new_stream(s->oc, NULL)))
+        return AVERROR(ENOMEM);
+    s->out_index[ist->index] = ost->index;
+
+    if (ist->index == s->video) {
+        const char *bsf_name = remux_annexb_bsf(ist->codecpar, s->oc->oformat);
+
+        if (bsf_name) {
+            const AVBitStreamFilter *filter = av_bsf_get_by_name(bsf_name);
+
+            if (!filter)
+                return AVERROR_BSF_NOT_FOUND;
+            if ((ret = av_bsf_alloc(filter, &s->bsf)) < 0 ||
+                (ret = avcodec_parameters_copy(s->bsf->par_in, ist->codecpar)) < 0)
+                return ret;
+            s->bsf->time_base_in = ist->time_base;
+            if ((ret = av_bsf_init(s->bsf)) < 0)
+                return ret;
+        }
+    } else {
+        s->nb_active++;
+    }
+    if ((ret = avcodec_parameters_copy(ost->codecpar, ist->codecpar)) < 0)
+        return ret;
+
+    ost->codecpar->codec_tag = 0;
+    ost->time_base = ist->time_base;
+    ost->disposition = ist->disposition;
+    av_dict_copy(&ost->metadata, ist->metadata, 0);
+    return 0;
+}
+
+static int open_output(SmartCut *s)
+{
+    int i, ret;
+
+    /* the spliced segments carry their own SPS/PPS, which needs an in-band container */
+    ret = avformat_alloc_output_context2(&s->oc, NULL, "mpegts", s->output);
+    if (ret < 0 || !s->oc) {
+        av_log(NULL, AV_LOG_ERROR, "Could not create output context for %s\n", s->output);
+        return ret < 0 ? ret : AVERROR_UNKNOWN;
+    }
+
+    s->nb_streams  = s->ic->nb_streams;
+    s->out_index   = av_malloc_array(s->nb_streams, sizeof(*s->out_index));
+    s->stream_done = av_mallocz_array(s->nb_streams, sizeof(*s->stream_done));
+    if (!s->out_index || !s->stream_done)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->ic->streams[i];
+        enum AVMediaType type = st->codecpar->codec_type;
+
+        s->out_index[i] = -1;
+        if (i != s->video && type != AVMEDIA_TYPE_AUDIO && type != AVMEDIA_TYPE_SUBTITLE) {
+            st->discard = AVDISCARD_ALL;
+            continue;
+        }
+        if ((ret = add_stream(s, st)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Could not set up output stream for input stream #%d: %s\n",
+                   i, av_err2str(ret));
+            return ret;
+        }
+    }
+    av_dict_copy(&s->oc->metadata, s->ic->metadata, 0);
+
+    if ((ret = avio_open(&s->oc->pb, s->output, AVIO_FLAG_WRITE)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open output file %s: %s\n",
+               s->output, av_err2str(ret));
+        return ret;
+    }
+    if ((ret = avformat_write_header(s->oc, NULL)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not write header for %s: %s\n",
+               s->output, av_err2str(ret));
+        return ret;
+    }
+    return 0;
+}
+
+static int open_decoder(SmartCut *s)
+{
+    AVStream *vst = s->ic->streams[s->video];
+    AVCodec *codec = avcodec_find_decoder(vst->codecpar->codec_id);
+    AVDictionary *opts = NULL;
+    int ret;
+
+    if (!codec) {
+        av_log(NULL, AV_LOG_ERROR, "No decoder for %s\n",
+               avcodec_get_name(vst->codecpar->codec_id));
+        return AVERROR_DECODER_NOT_FOUND;
+    }
+    if (!(s->dec = avcodec_alloc_context3(codec)))
+        return AVERROR(ENOMEM);
+    if ((ret = avcodec_parameters_to_context(s->dec, vst->codecpar)) < 0)
+        return ret;
+    av_codec_set_pkt_timebase(s->dec, vst->time_base);
+
+    av_dict_set(&opts, "threads", "auto", 0);
+    ret = avcodec_open2(s->dec, codec, &opts);
+    av_dict_free(&opts);
+    return ret;
+}
+
+/* same codec, geometry, profile and level as the copied GOPs */
+static int open_encoder(SmartCut *s, const AVFrame *frame)
+{
+    AVStream *vst = s->ic->streams[s->video];
+    const AVCodecParameters *par = vst->codecpar;
+    AVCodec *codec = avcodec_find_encoder(par->codec_id);
+    AVCodecContext *enc;
+    AVDictionary *opts = NULL;
+    int ret;
+
+    if (!codec) {
+        av_log(NULL, AV_LOG_ERROR, "No %s encoder to re-encode the cut points\n",
+               avcodec_get_name(par->codec_id));
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+    if (!(s->enc = enc = avcodec_alloc_context3(codec)))
+        return AVERROR(ENOMEM);
+
+    enc->width   = frame->width;
+    enc->height  = frame->height;
+    enc->pix_fmt = frame->format;
+    enc->sample_aspect_ratio = frame->sample_aspect_ratio.num ?
+                               frame->sample_aspect_ratio : par->sample_aspect_ratio;
+    enc->color_range     = frame->color_range;
+    enc->colorspace      = frame->colorspace;
+    enc->color_primaries = frame->color_primaries;
+    enc->color_trc       = frame->color_trc;
+    enc->time_base = vst->time_base;
+    enc->framerate = av_guess_frame_rate(s->ic, vst, NULL);
+    enc->profile   = par->profile;
+    enc->level     = par->level;
+    if (par->bit_rate > 0)
+        enc->bit_rate = par->bit_rate;
+    /* dts is derived from pts at the splice, see encode_frame() */
+    enc->max_b_frames = 0;
+
+    av_dict_set(&opts, "threads", "auto", 0);
+    ret = avcodec_open2(enc, codec, &opts);
+    av_dict_free(&opts);
+    if (ret < 0)
+        av_log(NULL, AV_LOG_ERROR, "Could not open %s encoder: %s\n",
+               codec->name, av_err2str(ret));
+    return ret;
+}
+
+/* tb is the time base of the packet's timestamps */
+static int write_packet(SmartCut *s, AVPacket *pkt, int index, AVRational tb)
+{
+    AVStream *ost = s->oc->streams[s->out_index[index]];
+    int64_t offset = av_rescale_q(s->start_us, AV_TIME_BASE_Q, tb);
+    int ret;
+
+    if (pkt->pts != AV_NOPTS_VALUE)
+        pkt->pts -= offset;
+    if (pkt->dts != AV_NOPTS_VALUE)
+        pkt->dts -= offset;
+    pkt->stream_index = ost->index;
+    pkt->pos = -1;
+    av_packet_rescale_ts(pkt, tb, ost->time_base);
+    if ((ret = av_interleaved_write_frame(s->oc, pkt)) < 0)
+        av_log(NULL, AV_LOG_ERROR, "Error muxing a packet to %s: %s\n",
+               s->output, av_err2str(ret));
+    return ret;
+}
+
+static int encode_frame(SmartCut *s, AVFrame *frame)
+{
+    AVPacket pkt;
+    int ret;
+
+    if (!s->enc) {
+        if (!frame)
+            return 0;
+        if ((ret = open_encoder(s, frame)) < 0)
+            return ret;
+    }
+    if (frame)
+        s->stats.frames_encoded++;
+    if ((ret = avcodec_send_frame(s->enc, frame)) < 0)
+        return ret;
+
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+    while ((ret = avcodec_receive_packet(s->enc, &pkt)) >= 0) {
+        /* without reordering any dts <= pts works: keep the source's offset
+         * so the segment's dts stay below those of the GOP it adjoins */
+        pkt.dts = pkt.pts - s->seg_delay;
+        if ((ret = write_packet(s, &pkt, s->video, s->enc->time_base)) < 0)
+            return ret;
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+/* NULL pkt drains the decoder */
+static int decode_packet(SmartCut *s, AVPacket *pkt)
+{
+    int ret = avcodec_send_packet(s->dec, pkt);
+
+    if (ret < 0 && ret != AVERROR_EOF) {
+        av_log(NULL, AV_LOG_WARNING, "%s: error decoding a packet: %s\n",
+               s->input, av_err2str(ret));
+        if (ret != AVERROR_INVALIDDATA)
+            return ret;
+    }
+    while ((ret = avcodec_receive_frame(s->dec, s->frame)) >= 0) {
+        int64_t pts = av_frame_get_best_effort_timestamp(s->frame);
+
+        ret = 0;
+        if (pts != AV_NOPTS_VALUE && pts >= s->seg_start && pts < s->seg_end) {
+            s->frame->pts = pts;
+            s->frame->pict_type = AV_PICTURE_TYPE_NONE;
+            ret = encode_frame(s, s->frame);
+        }
+        av_frame_unref(s->frame);
+        if (ret < 0)
+            return ret;
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+static void begin_segment(SmartCut *s, int64_t start, int64_t end, int64_t delay)
+{
+    s->phase     = PHASE_ENCODE;
+    s->seg_start = start;
+    s->seg_end   = end;
+    s->seg_delay = delay;
+}
+
+static int finish_segment(SmartCut *s)
+{
+    int ret = decode_packet(s, NULL);
+
+    avcodec_flush_buffers(s->dec);
+    if (ret >= 0)
+        ret = encode_frame(s, NULL);
+    avcodec_free_context(&s->enc);
+    return ret;
+}
+
+static int copy_video(SmartCut *s, AVPacket *pkt)
+{
+    AVRational tb = s->ic->streams[s->video]->time_base;
+    int ret;
+
+    s->stats.packets_copied++;
+    if (!s->bsf)
+        return write_packet(s, pkt, s->video, tb);
+    if ((ret = av_bsf_send_packet(s->bsf, pkt)) < 0)
+        return ret;
+    while ((ret = av_bsf_receive_packet(s->bsf, pkt)) >= 0)
+        if ((ret = write_packet(s, pkt, s->video, tb)) < 0)
+            return ret;
+    return ret == AVERROR(EAGAIN) ? 0 : ret;
+}
+
+static int video_packet(SmartCut *s, AVPacket *pkt)
+{
+    int key = (pkt->flags & AV_PKT_FLAG_KEY) && pkt->pts != AV_NOPTS_VALUE;
+    int ret;
+
+    if (s->phase == PHASE_ENCODE) {
+        if (key && s->copy_from && pkt->pts == s->copy_from->pts) {
+            if ((ret = finish_segment(s)) < 0)
+                return ret;
+            s->phase = PHASE_COPY;
+        } else if (pkt->dts != AV_NOPTS_VALUE && pkt->dts >= s->seg_end) {
+            /* every later packet is shown at or after its dts */
+            s->phase = PHASE_DONE;
+            return finish_segment(s);
+        } else {
+            return decode_packet(s, pkt);
+        }
+    }
+    if (s->phase != PHASE_COPY)
+        return 0;
+
+    if (key && pkt->pts == s->copy_from->pts)
+        s->copy_started = 1;
+    if (!s->copy_started)
+        return 0;
+    if (key && s->copy_to && pkt->pts == s->copy_to->pts) {
+        if (s->copy_to->pts >= s->end) {
+            s->phase = PHASE_DONE;
+            return 0;
+        }
+        begin_segment(s, s->copy_to->pts, s->end, s->copy_to->pts - s->copy_to->dts);
+        return decode_packet(s, pkt);
+    }
+    return copy_video(s, pkt);
+}
+
+static int other_packet(SmartCut *s, AVPacket *pkt)
+{
+    AVStream *st = s->ic->streams[pkt->stream_index];
+    int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+
+    if (ts == AV_NOPTS_VALUE || s->stream_done[st->index] ||
+        av_compare_ts(ts, st->time_base, s->start_us, AV_TIME_BASE_Q) < 0)
+        return 0;
+    if (s->end_us != INT64_MAX &&
+        av_compare_ts(ts, st->time_base, s->end_us, AV_TIME_BASE_Q) >= 0) {
+        s->stream_done[st->index] = 1;
+        s->nb_active--;
+        return 0;
+    }
+    return write_packet(s, pkt, st->index, st->time_base);
+}
+
+int smartcut_file(const char *input, const char *output, int64_t start,
+                  int64_t duration, SmartCutStats *stats)
+{
+    SmartCut s = { 0 };
+    const SmartCutKey *from;
+    AVStream *vst;
+    AVPacket pkt;
+    int ret;
+
+    s.input  = input;
+    s.output = output;
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+
+    if ((ret = remux_open_input(input, &s.ic, NULL)) < 0)
+        return ret;
+    if ((ret = av_find_best_stream(s.ic, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "%s: no video stream to cut\n", input);
+        goto end;
+    }
+    s.video = ret;
+    vst = s.ic->streams[s.video];
+
+    s.start_us = start;
+    if (s.ic->start_time != AV_NOPTS_VALUE)
+        s.start_us += s.ic->start_time;
+    s.end_us = duration == INT64_MAX || duration > INT64_MAX - s.start_us ?
+               INT64_MAX : s.start_us + duration;
+    s.start = av_rescale_q(s.start_us, AV_TIME_BASE_Q, vst->time_base);
+    s.end   = s.end_us == INT64_MAX ? INT64_MAX :
+              av_rescale_q(s.end_us, AV_TIME_BASE_Q, vst->time_base);
+
+    if ((ret = find_keyframes(&s)) < 0)
+        goto end;
+    plan_segments(&s);
+    av_log(NULL, AV_LOG_VERBOSE, "Smart cut of %s: copying %s to %s, re-encoding the rest\n",
+           input,
+           s.copy_from ? av_ts2timestr(s.copy_from->pts, &vst->time_base) : "nothing",
+           s.copy_to ? av_ts2timestr(s.copy_to->pts, &vst->time_base) : "the end");
+
+    if ((ret = open_output(&s)) < 0 || (ret = open_decoder(&s)) < 0)
+        goto end;
+    if (!(s.frame = av_frame_alloc())) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    if (!s.copy_from || s.copy_from->pts > s.start) {
+        from = &s.keys[0];
+        begin_segment(&s, s.start, s.copy_from ? s.copy_from->pts : s.end,
+                      s.copy_from ? s.copy_from->pts - s.copy_from->dts : 0);
+    } else {
+        from = s.copy_from;
+        s.phase = PHASE_COPY;
+    }
+    if ((ret = av_seek_frame(s.ic, s.video, from->dts, AVSEEK_FLAG_BACKWARD)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "%s: could not seek: %s\n", input, av_err2str(ret));
+        goto end;
+    }
+
+    while (s.phase != PHASE_DONE || s.nb_active > 0) {
+        if ((ret = av_read_frame(s.ic, &pkt)) < 0)
+            break;
+        if (pkt.stream_index >= s.nb_streams || s.out_index[pkt.stream_index] < 0)
+            ret = 0;
+        else if (pkt.stream_index == s.video)
+            ret = video_packet(&s, &pkt);
+        else
+            ret = other_packet(&s, &pkt);
+        av_packet_unref(&pkt);
+        if (ret < 0)
+            goto end;
+    }
+    if (ret < 0 && ret != AVERROR_EOF) {
+        av_log(NULL, AV_LOG_ERROR, "Error reading %s: %s\n", input, av_err2str(ret));
+        goto end;
+    }
+    if (s.phase == PHASE_ENCODE && (ret = finish_segment(&s)) < 0)
+        goto end;
+    if ((ret = av_write_trailer(s.oc)) < 0)
+        goto end;
+
+    av_log(NULL, AV_LOG_VERBOSE, "Smart cut %s to %s: %"PRId64" frames re-encoded, "
+           "%"PRId64" packets copied\n",
+           input, output, s.stats.frames_encoded, s.stats.packets_copied);
+    if (stats)
+        *stats = s.stats;
+
+end:
+    av_packet_unref(&pkt);
+    av_frame_free(&s.frame);
+    avcodec_free_context(&s.enc);
+    avcodec_free_context(&s.dec);
+    av_bsf_free(&s.bsf);
+    av_freep(&s.keys);
+    av_freep(&s.out_index);
+    av_freep(&s.stream_done);
+    if (s.oc)
+        avio_closep(&s.oc->pb);
+    avformat_free_context(s.oc);
+    avformat_close_input(&s.ic);
+    return ret;
+}
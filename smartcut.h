@@ -0,0 +1,34 @@
+#ifndef SMARTCUT_H
+#define SMARTCUT_H
+
+#include <stdint.h>
+
+/*
+ * Trimming without re-encoding the whole range: only the partial GOPs at
+ * the cut points are decoded and re-encoded, every complete GOP in between
+ * is stream copied. Splices are only made at closed-GOP keyframes, so no
+ * leading pictures are lost on either side. The output is MPEG-TS, where
+ * each spliced segment carries its own parameter sets in band, so the
+ * re-encoded boundaries and the copied interior do not need identical
+ * extradata.
+ */
+
+typedef struct SmartCutStats {
+    int64_t frames_encoded;     ///< boundary frames decoded and re-encoded
+    int64_t packets_copied;     ///< video packets copied from the interior GOPs
+} SmartCutStats;
+
+/**
+ * Cut [start, start + duration) of the first video stream of input, like
+ * -ss start -t duration as output options. Audio and subtitle packets are
+ * copied when they start inside the range.
+ *
+ * @param start    relative to the start of the input, in AV_TIME_BASE units
+ * @param duration in AV_TIME_BASE units, INT64_MAX to cut until the end
+ * @param stats    if not NULL, filled in on success
+ * @return 0 on success, a negative AVERROR code on failure
+ */
+int smartcut_file(const char *input, const char *output, int64_t start,
+                  int64_t duration, SmartCutStats *stats);
+
+#endif
@@ -0,0 +1,706 @@
+/*
+ * Transcoding benchmark harness.
+ *
+ * Generates synthetic inputs with lavfi, runs every pipeline of the tree on
+ * them under a matrix of configurations and reports fps, realtime speed,
+ * CPU seconds per output minute and peak RSS as JSON. Every run happens in
+ * a forked child, both because run_transcoding() exits the process and so
+ * that getrusage() of the child measures that run alone.
+ *
+ * With -j n every run is started n times at once, as a loaded server would,
+ * and fps/speed become the aggregate throughput of all copies. Compare
+ * x264_veryfast with x264_auto_threads at -j 1 and -j 16 to check the
+ * thread tuner against the codec defaults.
+ *
+ * Configs with psnr set also score their output against the input, so
+ * speed/quality trade-offs such as -preview show both sides.
+ *
+ * tbench [-d seconds] [-r rate] [-j jobs] [-w workdir] [-o results.json]
+ *        [-b baseline.json] [-t threshold%] [-f filter] [-v]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <libavdevice/avdevice.h>
+#include <libavutil/avstring.h>
+#include <libavutil/log.h>
+#include <libavutil/time.h>
+
+#include "transcoding.h"
+#include "remux.h"
+#include "smartcut.h"
+#include "trans.h"
+#if CONFIG_TRANS2
+#include "trans2.h"
+#endif
+
+#define BENCH_MAX_MAPS 64
+
+typedef struct BenchInput {
+    const char *name;
+    int width, height;
+    const char *encoder;
+    const char *ext;
+} BenchInput;
+
+typedef struct BenchConfig {
+    const char *name;
+    const char *runner;
+    /* extra output options for run_transcoding(), NULL terminated */
+    const char *args[16];
+    /* extra input options, NULL terminated */
+    const char *in_args[4];
+    /* map the input audio this many times, to scale the output stream count */
+    int nb_audio_maps;
+    /* measure the PSNR of the output video against the input */
+    int psnr;
+    /* fail the run unless the frame pool stops allocating after warm-up */
+    int steady_pool;
+    /* fail the run unless its video matches the output of this config,
+     * for options that must only change the speed */
+    const char *same_output;
+} BenchConfig;
+
+typedef struct BenchResult {
+    char name[128];
+    double wall;
+    double cpu;
+    double fps;
+    double speed;
+    double cpu_per_min;
+    int64_t max_rss_kb;
+    int64_t minor_faults;
+    double psnr;        ///< mean over all frames, 0 if not measured
+    int64_t frames;     ///< video frames in the outputs of all copies
+    int status;
+} BenchResult;
+
+static const BenchInput bench_inputs[] = {
+    { "360p_h264",  640,  360,  "libx264", "mp4" },
+    { "720p_h264",  1280, 720,  "libx264", "mp4" },
+    { "1080p_h264", 1920, 1080, "libx264", "mp4" },
+    { "2160p_h264", 3840, 2160, "libx264", "mp4" },
+    { "720p_mpeg4", 1280, 720,  "mpeg4",   "avi" },
+};
+
+static const BenchConfig bench_configs[] = {
+    { "x264_veryfast",  "ffmpeg", { "-c:v", "libx264", "-preset", "veryfast", "-c:a", "aac", NULL } },
+    { "x264_medium",    "ffmpeg", { "-c:v", "libx264", "-preset", "medium",   "-c:a", "aac", NULL } },
+    { "x264_pool",      "ffmpeg", { "-frame_pool", "-c:v", "libx264", "-preset", "veryfast", "-c:a", "aac", NULL },
+                                    { NULL }, 0, 0, 1 },
+    { "x264_hugepages", "ffmpeg", { "-frame_pool_hugepages", "-c:v", "libx264", "-preset", "veryfast", "-c:a", "aac", NULL } },
+    { "x264_auto_threads", "ffmpeg", { "-auto_threads", "-c:v", "libx264", "-preset", "veryfast", "-c:a", "aac", NULL } },
+    { "x264_scale",     "ffmpeg", { "-c:v", "libx264", "-preset", "veryfast", "-s", "640x360", NULL } },
+    /* 25 to 12 fps, with and without skipping the frames the conversion drops */
+    { "x264_fps12",     "ffmpeg", { "-c:v", "libx264", "-preset", "veryfast", "-r", "12", NULL } },
+    { "x264_fps12_predict", "ffmpeg", { "-drop_predict", "-c:v", "libx264", "-preset", "veryfast",
+                                        "-r", "12", NULL }, { NULL }, 0, 0, 0, "x264_fps12" },
+    /* proxy rendition: default decoding and scaling against -preview */
+    { "x264_proxy",     "ffmpeg", { "-s", "640x360", "-c:v", "libx264", "-preset", "ultrafast",
+                                    NULL }, { NULL }, 0, 1 },
+    { "x264_proxy_preview", "ffmpeg", { "-preview", "-s", "640x360", "-c:v", "libx264", NULL },
+                                    { NULL }, 0, 1 },
+    /* yadif is slice threaded, so its slices run on lavfi's threads or on the pool */
+    { "x264_yadif",     "ffmpeg", { "-vf", "yadif", "-c:v", "libx264", "-preset", "veryfast", NULL } },
+    { "x264_yadif_tp",  "ffmpeg", { "-thread_pool", "-1", "-vf", "yadif", "-c:v", "libx264", "-preset", "veryfast", NULL } },
+    /* two independent complex graphs, on the main thread or one thread each */
+    { "complex2",       "ffmpeg", { "-filter_complex", "[0:v]scale=640:360[v]",
+                                    "-filter_complex", "[0:a]volume=0.5[a]", "-map", "[v]", "-map", "[a]",
+                                    "-c:v", "libx264", "-preset", "veryfast", "-c:a", "aac", NULL } },
+    { "complex2_parallel", "ffmpeg", { "-filter_complex_parallel",
+                                    "-filter_complex", "[0:v]scale=640:360[v]",
+                                    "-filter_complex", "[0:a]volume=0.5[a]", "-map", "[v]", "-map", "[a]",
+                                    "-c:v", "libx264", "-preset", "veryfast", "-c:a", "aac", NULL } },
+    { "copy",           "ffmpeg", { "-c", "copy", NULL } },
+    /* realtime paced: wall time is fixed, cpu_s shows the loop's idle cost */
+    { "copy_paced",     "ffmpeg", { "-c", "copy", NULL }, { "-re", NULL } },
+    /* stream selection cost: 1, 10 and 50 copied output streams */
+    { "copy_streams1",  "ffmpeg", { "-c", "copy", NULL }, { NULL },  1 },
+    { "copy_streams10", "ffmpeg", { "-c", "copy", NULL }, { NULL }, 10 },
+    { "copy_streams50", "ffmpeg", { "-c", "copy", NULL }, { NULL }, 50 },
+    /* remux.c: no decoders, header-only probing; copy_batch4 remuxes the input
+     * 4 times in one process, fps and speed count a single copy */
+    { "copy",           "remux",  { NULL } },
+    { "copy_batch4",    "remux",  { NULL } },
+    /* 4 s out of the middle: re-encoding the whole range against smartcut.c,
+     * which only re-encodes the partial GOPs at both cut points */
+    { "trim",           "ffmpeg", { "-ss", "3", "-t", "4", "-c:v", "libx264", "-preset", "veryfast",
+                                    "-c:a", "copy", NULL } },
+    { "trim",           "smartcut", { NULL } },
+    { "default",        "trans",  { NULL } },
+#if CONFIG_TRANS2
+    { "default",        "trans2", { NULL } },
+#endif
+};
+
+static int bench_duration = 10;
+static int bench_rate     = 25;
+static int bench_jobs     = 1;
+static int bench_job;           ///< index of this copy in a child
+static const char *bench_workdir = "./bench";
+static const char *bench_output;
+static const char *bench_baseline;
+static const char *bench_filter;
+static double bench_threshold = 5.0;
+static int bench_verbose;
+
+static void bench_child_init(void)
+{
+    if (!bench_verbose) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0) {
+            dup2(fd, 1);
+            dup2(fd, 2);
+            close(fd);
+        }
+    }
+    av_log_set_level(bench_verbose ? AV_LOG_INFO : AV_LOG_ERROR);
+}
+
+/**
+ * Run fn(arg) in nb_jobs concurrent child processes and collect the wall
+ * time until the last one finished and their combined rusage, with the
+ * largest RSS of any of them.
+ *
+ * @return the first non-zero child exit status, <0 if a child could not
+ *         be started
+ */
+static int run_children(int (*fn)(void *), void *arg, int nb_jobs,
+                        double *wall, struct rusage *ru)
+{
+    int64_t start = av_gettime_relative();
+    int i, started = 0, ret = 0;
+
+    memset(ru, 0, sizeof(*ru));
+    for (i = 0; i < nb_jobs; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            ret = -1;
+            break;
+        }
+        if (!pid) {
+            bench_job = i;
+            bench_child_init();
+            exit(fn(arg) < 0);
+        }
+        started++;
+    }
+    while (started--) {
+        struct rusage r;
+        int status;
+
+        if (wait4(-1, &status, 0, &r) < 0)
+            return -1;
+        ru->ru_utime.tv_sec  += r.ru_utime.tv_sec;
+        ru->ru_utime.tv_usec += r.ru_utime.tv_usec;
+        ru->ru_stime.tv_sec  += r.ru_stime.tv_sec;
+        ru->ru_stime.tv_usec += r.ru_stime.tv_usec;
+        ru->ru_maxrss = FFMAX(ru->ru_maxrss, r.ru_maxrss);
+        ru->ru_minflt += r.ru_minflt;
+        if (!ret)
+            ret = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+    *wall = (av_gettime_relative() - start) / 1000000.0;
+    return ret;
+}
+
+static int run_child(int (*fn)(void *), void *arg, double *wall, struct rusage *ru)
+{
+    return run_children(fn, arg, 1, wall, ru);
+}
+
+typedef struct GenerateArgs {
+    const BenchInput *in;
+    const char *path;
+} GenerateArgs;
+
+static int generate_input(void *opaque)
+{
+    GenerateArgs *g = opaque;
+    char video[256], audio[128];
+    char *argv[] = {
+        "ffmpeg", "-y",
+        "-f", "lavfi", "-i", video,
+        "-f", "lavfi", "-i", audio,
+        "-c:v", (char *)g->in->encoder, "-pix_fmt", "yuv420p",
+        "-g", "50",
+        "-c:a", "aac",
+        "-shortest",
+        (char *)g->path,
+    };
+
+    snprintf(video, sizeof(video), "testsrc=size=%dx%d:rate=%d:duration=%d",
+             g->in->width, g->in->height, bench_rate, bench_duration);
+    snprintf(audio, sizeof(audio), "sine=frequency=1000:sample_rate=48000:duration=%d",
+             bench_duration);
+
+    avdevice_register_all();
+    return run_transcoding(FF_ARRAY_ELEMS(argv), argv, NULL, NULL);
+}
+
+typedef struct RunArgs {
+    const BenchConfig *cfg;
+    const char *in;
+    const char *out;
+    char job_out[600];      ///< per-job output name with -jobs, out points here
+} RunArgs;
+
+typedef struct PsnrArgs {
+    const char *in;
+    const char *out;
+    const char *stats;
+} PsnrArgs;
+
+/* the input is scaled to the output size, as the rendition is watched */
+static int measure_psnr(void *opaque)
+{
+    PsnrArgs *p = opaque;
+    char graph[700];
+    char *argv[] = {
+        "ffmpeg", "-y", "-nostdin",
+        "-i", (char *)p->out,
+        "-i", (char *)p->in,
+        "-lavfi", graph,
+        "-f", "null", "-",
+    };
+
+    snprintf(graph, sizeof(graph), "[1:v][0:v]scale2ref[ref][out];[out][ref]psnr=stats_file=%s",
+             p->stats);
+    return run_transcoding(FF_ARRAY_ELEMS(argv), argv, NULL, NULL);
+}
+
+static double read_psnr(const char *path)
+{
+    char line[512];
+    double sum = 0;
+    int n = 0;
+    FILE *f;
+
+    if (!(f = fopen(path, "r")))
+        return 0;
+    while (fgets(line, sizeof(line), f)) {
+        const char *p = strstr(line, "psnr_avg:");
+
+        /* identical frames are "inf" */
+        if (p) {
+            sum += FFMIN(strtod(p + 9, NULL), 100.0);
+            n++;
+        }
+    }
+    fclose(f);
+    return n ? sum / n : 0;
+}
+
+static int run_pipeline(void *opaque)
+{
+    RunArgs *r = opaque;
+
+    if (bench_jobs > 1) {
+        snprintf(r->job_out, sizeof(r->job_out), "%s.%d.ts", r->out, bench_job);
+        r->out = r->job_out;
+    }
+
+    if (!strcmp(r->cfg->runner, "ffmpeg")) {
+        char *argv[32 + 2 * BENCH_MAX_MAPS];
+        char stats[620];
+        int argc = 0, i;
+
+        argv[argc++] = "ffmpeg";
+        argv[argc++] = "-y";
+        argv[argc++] = "-nostdin";
+        if (r->cfg->steady_pool) {
+            snprintf(stats, sizeof(stats), "%s.bench.json", r->out);
+            argv[argc++] = "-benchmark_all";
+            argv[argc++] = "-benchmark_file";
+            argv[argc++] = stats;
+        }
+        for (i = 0; r->cfg->in_args[i]; i++)
+            argv[argc++] = (char *)r->cfg->in_args[i];
+        argv[argc++] = "-i";
+        argv[argc++] = (char *)r->in;
+        for (i = 0; i < FFMIN(r->cfg->nb_audio_maps, BENCH_MAX_MAPS); i++) {
+            argv[argc++] = "-map";
+            argv[argc++] = "0:a";
+        }
+        for (i = 0; r->cfg->args[i]; i++)
+            argv[argc++] = (char *)r->cfg->args[i];
+        argv[argc++] = (char *)r->out;
+        return run_transcoding(argc, argv, NULL, NULL);
+    }
+    if (!strcmp(r->cfg->runner, "remux") && !strcmp(r->cfg->name, "copy_batch4")) {
+        char outs[4][620];
+        RemuxJob jobs[4] = { { 0 } };
+        int i;
+
+        for (i = 0; i < 4; i++) {
+            snprintf(outs[i], sizeof(outs[i]), "%s.b%d.ts", r->out, i);
+            jobs[i].input  = r->in;
+            jobs[i].output = outs[i];
+        }
+        return remux_batch(jobs, 4) ? -1 : 0;
+    }
+    if (!strcmp(r->cfg->runner, "remux"))
+        return remux_file(r->in, r->out, NULL);
+    if (!strcmp(r->cfg->runner, "smartcut"))
+        return smartcut_file(r->in, r->out, 3 * AV_TIME_BASE, 4 * AV_TIME_BASE, NULL);
+    if (!strcmp(r->cfg->runner, "trans"))
+        return create_trans_task((char *)r->in, (char *)r->out);
+#if CONFIG_TRANS2
+    if (!strcmp(r->cfg->runner, "trans2"))
+        return CreateTransTask((char *)r->in, (char *)r->out);
+#endif
+    return -1;
+}
+
+static double rusage_cpu(const struct rusage *ru)
+{
+    return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1000000.0 +
+           ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1000000.0;
+}
+
+static void print_result(FILE *f, const BenchResult *r, int last)
+{
+    fprintf(f, "{\"name\":\"%s\",\"status\":%d,\"wall_s\":%.3f,\"cpu_s\":%.3f,"
+            "\"fps\":%.2f,\"speed\":%.3f,\"cpu_s_per_output_min\":%.3f,"
+            "\"max_rss_kb\":%"PRId64",\"minor_faults\":%"PRId64",\"frames\":%"PRId64,
+            r->name, r->status, r->wall, r->cpu, r->fps, r->speed,
+            r->cpu_per_min, r->max_rss_kb, r->minor_faults, r->frames);
+    if (r->psnr > 0)
+        fprintf(f, ",\"psnr\":%.2f", r->psnr);
+    fprintf(f, "}%s\n", last ? "" : ",");
+}
+
+/* the output file of copy k of a run, as run_pipeline() names it */
+static void job_output(char *buf, int size, const char *out, int k)
+{
+    if (bench_jobs > 1)
+        snprintf(buf, size, "%s.%d.ts", out, k);
+    else
+        av_strlcpy(buf, out, size);
+}
+
+/* video packets in path, the frames the run actually produced */
+static int64_t count_frames(const char *path)
+{
+    AVFormatContext *ic = NULL;
+    AVPacket pkt;
+    int64_t n = 0;
+    int video;
+
+    if (avformat_open_input(&ic, path, NULL, NULL) < 0)
+        return 0;
+    if (avformat_find_stream_info(ic, NULL) >= 0 &&
+        (video = av_find_best_stream(ic, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) >= 0) {
+        av_init_packet(&pkt);
+        pkt.data = NULL;
+        pkt.size = 0;
+        while (av_read_frame(ic, &pkt) >= 0) {
+            n += pkt.stream_index == video;
+            av_packet_unref(&pkt);
+        }
+    }
+    avformat_close_input(&ic);
+    return n;
+}
+
+/* the video packets of both files, timestamps and data, are the same */
+static int same_video(const char *a, const char *b)
+{
+    AVFormatContext *ic[2] = { NULL };
+    const char *path[2] = { a, b };
+    AVPacket pkt[2];
+    int video[2], ret[2], i, same = 0;
+
+    for (i = 0; i < 2; i++) {
+        av_init_packet(&pkt[i]);
+        pkt[i].data = NULL;
+        pkt[i].size = 0;
+        if (avformat_open_input(&ic[i], path[i], NULL, NULL) < 0 ||
+            avformat_find_stream_info(ic[i], NULL) < 0 ||
+            (video[i] = av_find_best_stream(ic[i], AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0)
+            goto end;
+    }
+    for (;;) {
+        for (i = 0; i < 2; i++) {
+            while ((ret[i] = av_read_frame(ic[i], &pkt[i])) >= 0 &&
+                   pkt[i].stream_index != video[i])
+                av_packet_unref(&pkt[i]);
+        }
+        if (ret[0] < 0 || ret[1] < 0) {
+            same = ret[0] < 0 && ret[1] < 0;
+            break;
+        }
+        if (pkt[0].pts != pkt[1].pts || pkt[0].dts != pkt[1].dts ||
+            pkt[0].size != pkt[1].size || memcmp(pkt[0].data, pkt[1].data, pkt[0].size))
+            break;
+        for (i = 0; i < 2; i++)
+            av_packet_unref(&pkt[i]);
+    }
+end:
+    for (i = 0; i < 2; i++) {
+        av_packet_unref(&pkt[i]);
+        avformat_close_input(&ic[i]);
+    }
+    return same;
+}
+
+static int json_number(const char *line, const char *key, double *v)
+{
+    char pattern[64];
+    const char *p;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    if (!(p = strstr(line, pattern)))
+        return 0;
+    *v = strtod(p + strlen(pattern), NULL);
+    return 1;
+}
+
+/* steady state means every frame buffer after warm-up is a recycled one */
+static int check_steady_pool(const char *out)
+{
+    char path[620];
+    char *buf = NULL;
+    double mallocs;
+    long size;
+    int ret = 1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s.bench.json", out);
+    if (!(f = fopen(path, "r"))) {
+        fprintf(stderr, "%s: no benchmark stats\n", path);
+        return 1;
+    }
+    if (!fseek(f, 0, SEEK_END) && (size = ftell(f)) > 0 &&
+        !fseek(f, 0, SEEK_SET) && (buf = malloc(size + 1)) &&
+        fread(buf, 1, size, f) == (size_t)size) {
+        buf[size] = 0;
+        if (!json_number(buf, "steady_mallocs", &mallocs))
+            fprintf(stderr, "%s: no frame pool stats\n", path);
+        else if (mallocs)
+            fprintf(stderr, "%s: frame pool allocated %.0f buffers after warm-up\n", out, mallocs);
+        else
+            ret = 0;
+    }
+    free(buf);
+    fclose(f);
+    return ret;
+}
+
+/* the results file has one run per line, which keeps this parser trivial */
+static int find_baseline(const char *name, BenchResult *b)
+{
+    char line[1024], pattern[160];
+    double v;
+    FILE *f;
+    int found = 0;
+
+    if (!(f = fopen(bench_baseline, "r")))
+        return 0;
+    snprintf(pattern, sizeof(pattern), "\"name\":\"%s\"", name);
+    while (fgets(line, sizeof(line), f)) {
+        if (!strstr(line, pattern))
+            continue;
+        json_number(line, "fps", &b->fps);
+        json_number(line, "cpu_s_per_output_min", &b->cpu_per_min);
+        if (json_number(line, "max_rss_kb", &v))
+            b->max_rss_kb = v;
+        json_number(line, "psnr", &b->psnr);
+        found = 1;
+        break;
+    }
+    fclose(f);
+    return found;
+}
+
+static int compare_baseline(const BenchResult *r)
+{
+    BenchResult b = { { 0 } };
+    int regressed = 0;
+
+    /* a failed run's numbers say nothing about the pipeline's speed */
+    if (r->status) {
+        printf("  %-40s failed, not compared\n", r->name);
+        return 0;
+    }
+    if (!find_baseline(r->name, &b)) {
+        printf("  %-40s no baseline\n", r->name);
+        return 0;
+    }
+
+#define CHECK(field, worse, fmt)                                             \
+    do {                                                                     \
+        double delta = b.field ? 100.0 * (r->field - b.field) / b.field : 0; \
+        int bad = (worse) * delta > bench_threshold;                         \
+        printf("  %-40s %-20s " fmt " -> " fmt " (%+.1f%%)%s\n", r->name,     \
+               #field, b.field, r->field, delta, bad ? " REGRESSION" : "");   \
+        regressed |= bad;                                                    \
+    } while (0)
+
+    CHECK(fps,         -1, "%.2f");
+    CHECK(cpu_per_min,  1, "%.3f");
+    CHECK(max_rss_kb,   1, "%"PRId64);
+    if (r->psnr > 0)
+        CHECK(psnr,    -1, "%.2f");
+#undef CHECK
+
+    return regressed;
+}
+
+int main(int argc, char **argv)
+{
+    BenchResult *results;
+    int nb_results = 0, regressions = 0;
+    int i, j, k, opt;
+    FILE *out = stdout;
+
+    while ((opt = getopt(argc, argv, "d:r:j:w:o:b:t:f:v")) != -1) {
+        switch (opt) {
+        case 'd': bench_duration  = atoi(optarg); break;
+        case 'r': bench_rate      = atoi(optarg); break;
+        case 'j': bench_jobs      = FFMAX(atoi(optarg), 1); break;
+        case 'w': bench_workdir   = optarg;       break;
+        case 'o': bench_output    = optarg;       break;
+        case 'b': bench_baseline  = optarg;       break;
+        case 't': bench_threshold = atof(optarg); break;
+        case 'f': bench_filter    = optarg;       break;
+        case 'v': bench_verbose   = 1;            break;
+        default:
+            fprintf(stderr, "usage: %s [-d seconds] [-r rate] [-j jobs] [-w workdir] [-o results.json] "
+                    "[-b baseline.json] [-t threshold%%] [-f filter] [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    mkdir(bench_workdir, 0755);
+    /* the runs are children, but the parent reads their outputs back */
+    av_register_all();
+    results = calloc(FF_ARRAY_ELEMS(bench_inputs) * FF_ARRAY_ELEMS(bench_configs),
+                     sizeof(*results));
+    if (!results)
+        return 1;
+
+    for (i = 0; i < FF_ARRAY_ELEMS(bench_inputs); i++) {
+        const BenchInput *in = &bench_inputs[i];
+        char in_path[512];
+        struct stat st;
+
+        snprintf(in_path, sizeof(in_path), "%s/%s_%ds.%s",
+                 bench_workdir, in->name, bench_duration, in->ext);
+        if (stat(in_path, &st) < 0) {
+            GenerateArgs g = { in, in_path };
+            struct rusage ru;
+            double wall;
+
+            fprintf(stderr, "generating %s\n", in_path);
+            if (run_child(generate_input, &g, &wall, &ru) != 0) {
+                fprintf(stderr, "failed to generate %s\n", in_path);
+                unlink(in_path);
+                continue;
+            }
+        }
+
+        for (j = 0; j < FF_ARRAY_ELEMS(bench_configs); j++) {
+            const BenchConfig *cfg = &bench_configs[j];
+            BenchResult *r = &results[nb_results];
+            char out_path[512];
+            RunArgs args = { cfg, in_path, out_path };
+            struct rusage ru;
+
+            snprintf(r->name, sizeof(r->name), "%s/%s/%s", cfg->runner, cfg->name, in->name);
+            /* keep single-job names stable for existing baselines */
+            if (bench_jobs > 1)
+                av_strlcatf(r->name, sizeof(r->name), "/j%d", bench_jobs);
+            if (bench_filter && !strstr(r->name, bench_filter))
+                continue;
+            snprintf(out_path, sizeof(out_path), "%s/out_%s_%s_%s.ts",
+                     bench_workdir, cfg->runner, cfg->name, in->name);
+
+            fprintf(stderr, "running %s\n", r->name);
+            memset(&ru, 0, sizeof(ru));
+            r->status      = run_children(run_pipeline, &args, bench_jobs, &r->wall, &ru);
+            r->cpu         = rusage_cpu(&ru);
+            r->max_rss_kb  = ru.ru_maxrss;
+            r->minor_faults = ru.ru_minflt;
+            for (k = 0; !r->status && k < bench_jobs; k++) {
+                char job_out[600], counted[620];
+
+                job_output(job_out, sizeof(job_out), out_path, k);
+                /* copy_batch4 counts a single copy, see bench_configs */
+                if (!strcmp(cfg->runner, "remux") && !strcmp(cfg->name, "copy_batch4"))
+                    snprintf(counted, sizeof(counted), "%s.b0.ts", job_out);
+                else
+                    av_strlcpy(counted, job_out, sizeof(counted));
+                r->frames += count_frames(counted);
+            }
+            r->fps         = r->wall > 0 ? r->frames / r->wall : 0;
+            r->speed       = r->wall > 0 ? bench_duration * bench_jobs / r->wall : 0;
+            r->cpu_per_min = r->cpu / (bench_duration * bench_jobs / 60.0);
+            if (cfg->same_output && !r->status) {
+                char ref_path[512], ref_out[600], job_out[600];
+
+                snprintf(ref_path, sizeof(ref_path), "%s/out_%s_%s_%s.ts",
+                         bench_workdir, cfg->runner, cfg->same_output, in->name);
+                job_output(ref_out, sizeof(ref_out), ref_path, 0);
+                job_output(job_out, sizeof(job_out), out_path, 0);
+                if (!same_video(ref_out, job_out)) {
+                    fprintf(stderr, "%s: video differs from %s\n", job_out, ref_out);
+                    r->status = 1;
+                }
+            }
+            for (k = 0; cfg->steady_pool && !r->status && k < bench_jobs; k++) {
+                char job_out[600];
+
+                job_output(job_out, sizeof(job_out), out_path, k);
+                r->status = check_steady_pool(job_out);
+            }
+            if (cfg->psnr && !r->status) {
+                char scored[600], stats[620];
+                PsnrArgs p = { in_path, scored, stats };
+                double wall;
+
+                /* with -j the copies are identical, score the first one */
+                job_output(scored, sizeof(scored), out_path, 0);
+                snprintf(stats, sizeof(stats), "%s.psnr", scored);
+                if (run_child(measure_psnr, &p, &wall, &ru) == 0)
+                    r->psnr = read_psnr(stats);
+            }
+            nb_results++;
+        }
+    }
+
+    if (bench_output && !(out = fopen(bench_output, "w"))) {
+        perror(bench_output);
+        out = stdout;
+    }
+    fprintf(out, "{\"duration\":%d,\"rate\":%d,\"jobs\":%d,\"results\":[\n",
+            bench_duration, bench_rate, bench_jobs);
+    for (i = 0; i < nb_results; i++)
+        print_result(out, &results[i], i == nb_results - 1);
+    fprintf(out, "]}\n");
+    if (out != stdout)
+        fclose(out);
+
+    if (bench_baseline) {
+        printf("comparison against %s (threshold %.1f%%):\n", bench_baseline, bench_threshold);
+        for (i = 0; i < nb_results; i++)
+            regressions += compare_baseline(&results[i]);
+    }
+
+    for (i = 0; i < nb_results; i++)
+        if (results[i].status)
+            fprintf(stderr, "%s failed with status %d\n", results[i].name, results[i].status);
+
+    free(results);
+    return regressions ? 1 : 0;
+}
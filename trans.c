@@ -67,6 +67,7 @@ int open_input_file(const char *filename, AVFormatContext **ifmt_ctx, StreamCont
 			if (codec_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
 				codec_ctx->framerate = av_guess_frame_rate(ifmt_ctx, stream, NULL);
 			/* Open decoder */
+			thread_tune_codec(codec_ctx, dec, 0);
 			ret = avcodec_open2(codec_ctx, dec, NULL);
 			if (ret < 0) {
 				ERROR_LOG("Failed to open decoder for stream #%u: %s!\n", i, av_err2str(ret));
@@ -159,6 +160,7 @@ int open_output_file(const char *filename, const AVFormatContext *ifmt_ctx, AVFo
 				enc_ctx->time_base = (AVRational) { 1, enc_ctx->sample_rate };
 			}
 
+			thread_tune_codec(enc_ctx, encoder, 0);
 			ret = avcodec_open2(enc_ctx, encoder, NULL);
 			if (ret < 0) {
 				ERROR_LOG("Cannot open video encoder for stream #%u: %s!\n", i,av_err2str(ret));
@@ -222,6 +224,7 @@ int init_filter(FilteringContext *fctx, AVCodecContext *dec_ctx, AVCodecContext
 		ret = AVERROR(ENOMEM);
 		goto end;
 	}
+	filter_graph->nb_threads = thread_tune_filter(dec_ctx->height, 0);
 
 	if (dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO) {
 		buffersrc = avfilter_get_by_name("buffer");
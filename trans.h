@@ -18,6 +18,8 @@
 #include <libavutil/pixdesc.h>
 #include <libavutil/audio_fifo.h>
 
+#include "ffmpeg_threadtune.h"
+
 
 
 enum log_level_enum
@@ -55,17 +55,43 @@ int getEffectiveUID(const char* filepath){
 	}
 }
 
+void free_transfer_task(Transfer_Thread_Task* task,int size){
+	int i;
+	for(i=0;i<size;i++){
+		if(task[i].frame_pool){
+			FramePoolStats stats;
+			frame_pool_get_stats(task[i].frame_pool,&stats);
+			av_log(NULL,AV_LOG_INFO,"frame pool: %"PRIu64" buffers served, %"PRIu64" allocated\n",stats.requests,stats.mallocs);
+			frame_pool_free(&task[i].frame_pool);
+		}
+		thread_pool_session_free(&task[i].pool_session);
+		av_freep(&task[i].outputfilename);
+	}
+}
+
 int init_transfer_task(Transfer_Thread_Task* task,int size){
 	int i=0;	
+	int ret;
+	//all segment threads share one pool instead of a set of slice threads per graph
+	if((ret=thread_pool_init(-1))<0){
+		return ret;
+	}
 	for(i=0;i<size;i++){
 		PacketListInit(&task[i].pl);
+		task[i].pl.budget = &mem_budget_process;
 		task[i].output_format_context = NULL;
 		pthread_mutex_init(&(task[i].mutex),NULL);
 		pthread_cond_init(&(task[i].cond),NULL);
 		task[i].pushover = 0;
-		task[i].outputfilename = (char*)av_malloc(255);
-		memset(task[i].outputfilename,0,255);
 		task[i].avaf = NULL;
+		task[i].outputfilename = (char*)av_mallocz(255);
+		//the pool outlives the segments, free_transfer_task() releases it
+		task[i].frame_pool = frame_pool_alloc(0);
+		task[i].pool_session = thread_pool_session_alloc();
+		if(!task[i].outputfilename||!task[i].frame_pool||!task[i].pool_session){
+			free_transfer_task(task,i+1);
+			return AVERROR(ENOMEM);
+		}
 		task[i].pts=0;
 		task[i].dts=0;
 		task[i].frame_index=0;
@@ -73,6 +99,29 @@ int init_transfer_task(Transfer_Thread_Task* task,int size){
 	return 0;
 }
 
+//a segment is only consumed once it is complete, so the reader can not be
+//held back by its own task, only by earlier segments still being drained
+void wait_for_mem_budget(Transfer_Thread_Task* task,int size,int current){
+	static int warned=0;
+	while(mem_budget_exceeded(&mem_budget_process)!=NULL){
+		int i,draining=0;
+		for(i=0;i<size;i++){
+			if(i!=current&&task[i].pushover&&task[i].pl.length>0){
+				draining=1;
+			}
+		}
+		if(!draining){
+			if(!warned){
+				av_log(NULL,AV_LOG_WARNING,"memory budget exceeded, %lld bytes queued\n",
+						(long long)atomic_load(&mem_budget_process.used));
+				warned=1;
+			}
+			break;
+		}
+		av_usleep(1000);
+	}
+}
+
 int open_input_file(const char* inputfilename,AVFormatContext** input_avformat_context,Transfer_Thread_Task* task,int size){
 	int ret;
 	int i;
@@ -267,7 +316,7 @@ int open_output_file(const AVFormatContext* avfc_input,const char* filename,Tran
 		av_log(NULL, AV_LOG_ERROR, "Error occurred when opening output file\n");
 		return ret;
 	}
-	if((ret = init_filters(&(task->filter_context),input_format_context,task->output_format_context))<0){
+	if((ret = init_filters(&(task->filter_context),input_format_context,task->output_format_context,task->pool_session))<0){
 			av_log(NULL,AV_LOG_ERROR,"init filters error!\n");
 		}
 	
@@ -275,7 +324,7 @@ int open_output_file(const AVFormatContext* avfc_input,const char* filename,Tran
 }
 
 int init_filter(FilteringContext* fctx, AVCodecContext *dec_ctx,
-        AVCodecContext *enc_ctx, const char *filter_spec)
+        AVCodecContext *enc_ctx, const char *filter_spec, ThreadPoolSession* session)
 {
     char args[512];
     int ret = 0;
@@ -292,6 +341,12 @@ int init_filter(FilteringContext* fctx, AVCodecContext *dec_ctx,
         goto end;
     }
 
+    if (session) {
+        filter_graph->opaque = session;
+        filter_graph->execute = thread_pool_filter_execute;
+        filter_graph->nb_threads = thread_pool_nb_threads();
+    }
+
     if (dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO) {
         buffersrc = avfilter_get_by_name("buffer");
         buffersink = avfilter_get_by_name("buffersink");
@@ -423,7 +478,7 @@ end:
     return ret;
 }
 
-int init_filters(FilteringContext** fc,const AVFormatContext* avfc_input,const AVFormatContext* avfc_output){
+int init_filters(FilteringContext** fc,const AVFormatContext* avfc_input,const AVFormatContext* avfc_output,ThreadPoolSession* session){
 	int i;
 	int ret;
 	const char* filter_spec;
@@ -446,7 +501,7 @@ int init_filters(FilteringContext** fc,const AVFormatContext* avfc_input,const A
 		else{
 			filter_spec = "anull";
 		}
-		ret = init_filter(&(*fc)[i],avfc_input->streams[i]->codec,avfc_output->streams[i]->codec,filter_spec);
+		ret = init_filter(&(*fc)[i],avfc_input->streams[i]->codec,avfc_output->streams[i]->codec,filter_spec,session);
 		if(ret<0){
 			return ret;
 		}
@@ -634,7 +689,11 @@ FLUSH:
 			newframe->pkt_pts = task->frame_index*encoder_frame_size+task->pts;
 			newframe->pts = task->frame_index*encoder_frame_size+task->pts;
 			newframe->pkt_dts = task->frame_index*encoder_frame_size+task->dts;
-			av_frame_get_buffer(newframe,0);
+			ret = frame_pool_get_buffer(task->frame_pool,newframe,0);
+			if(ret<0){
+				av_log(NULL,AV_LOG_ERROR,"alloc audio frame buffer error,%s\n",av_err2str(ret));
+				break;
+			}
 			//filt_frame->nb_samples = encoder_frame_size;
 			ret=av_audio_fifo_read(task->avaf,(void**)newframe->data,encoder_frame_size);
 			if(ret<0){
@@ -926,7 +985,9 @@ int CreateTransTask(char* inputfilename, char* outputpath){
 		return -1;
 	}
 	
-	init_transfer_task(task,thread_count);
+	if((ret=init_transfer_task(task,thread_count))<0){
+		return ret;
+	}
 	
 	if ((ret=open_input_file(inputfilename,&input_format_context,task,thread_count))<0){
 		goto end;
@@ -991,6 +1052,7 @@ loop:
 				}
 			}
 		}
+		wait_for_mem_budget(task,thread_count,index%thread_count);
 		PacketListPushBack(&task[index%thread_count].pl,packet);
 	}
 	//av_log(NULL,AV_LOG_INFO,"current index is %d\n",fileindex);
@@ -1012,5 +1074,6 @@ loop:
 end:
 	av_log(NULL,AV_LOG_INFO,"goto end\n");
 	avformat_close_input(&input_format_context);
+	free_transfer_task(task,thread_count);
 	return ret;
 }
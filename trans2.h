@@ -12,7 +12,10 @@
 #include "libavutil/mathematics.h"
 #include "libavfilter/avfilter.h"
 #include "libavutil/audio_fifo.h"
+#include "libavutil/time.h"
 #include "packet.h"
+#include "ffmpeg_pool.h"
+#include "ffmpeg_threadpool.h"
 
 typedef struct FilteringContext{
 	AVFilterContext* buffersrc_ctx;
@@ -42,6 +45,8 @@ typedef struct Transfer_Thread_Task{
 	AVBitStreamFilterContext* extrabsfc;
 	AVBitStreamFilterContext* h264_mp4toannexbbsfc;
 	AVAudioFifo* avaf;
+	FramePool* frame_pool;
+	ThreadPoolSession* pool_session;
 	PacketList pl;
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
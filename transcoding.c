@@ -2,12 +2,16 @@
 #include <libavutil/pixdesc.h>
 #include <libavutil/hwcontext.h>
 #include <libavutil/intreadwrite.h>
+#include <libavutil/time.h>
 #include <libavutil/timestamp.h>
 #include <libavutil/avassert.h>
 #include <libavfilter/buffersrc.h>
 #include <libavfilter/buffersink.h>
 
 #include "ffmpeg_opt.h"
+#include "ffmpeg_trace.h"
+#include "remux.h"
+#include "smartcut.h"
 #include "transcoding.h"
 #include "mathops.h"
 
@@ -33,10 +37,33 @@ static int run_as_daemon  = 0;
 static int nb_frames_dup = 0;
 static unsigned dup_warning = 1000;
 static int nb_frames_drop = 0;
+static int nb_frames_budget_drop = 0;
+/* filtergraph reconfigurations after the first one, and the time they took */
+static int nb_filter_reinits = 0;
+static int64_t filter_reinit_time = 0;
+static int64_t filter_reinit_max = 0;
+static int nb_frames_prescaled = 0;
 static int64_t decode_error_stat[2];
 
 static int want_sdp = 1;
-static int current_time;
+static int64_t current_time;
+static uint64_t current_perf[BENCH_PERF_NB];
+static int bench_perf_enabled = 0;
+static FramePool *frame_pool;
+ThreadPoolSession *thread_pool_session;
+static volatile int received_bench_dump = 0;
+/* earliest time a -re input has its next packet due, INT64_MAX if unknown */
+static int64_t input_deadline = INT64_MAX;
+/* an input returned EAGAIN without a known deadline, and how long to wait */
+static int eagain_unknown;
+static int64_t eagain_backoff;
+/* output streams ordered by muxed dts, built by the first choose_output() */
+static SchedHeap output_heap;
+/* streams below these indices are initialized (or out of input) / finished */
+static int first_pending_init;
+static int first_unfinished;
+/* output streams flagged unavailable since the last reset_eagain() */
+static int nb_unavailable;
 
 static uint8_t *subtitle_out;
 static int64_t decode_error_stat[2];
@@ -64,6 +91,57 @@ static int decode_interrupt_cb(void *ctx)
 const AVIOInterruptCB int_cb = { decode_interrupt_cb, NULL };
 
 static void ffmpeg_cleanup(int ret){
+    int i;
+
+    /* joins frame threads, whose get_buffer2() callbacks use the
+     * InputStream living in the session arena */
+    for (i = 0; i < nb_input_streams; i++)
+        avcodec_free_context(&input_streams[i]->dec_ctx);
+    frame_pool_free(&frame_pool);
+    /* filtergraphs run their slices on it until freed */
+    for (i = 0; i < nb_filtergraphs; i++) {
+        FilterGraph *fg = filtergraphs[i];
+        int j;
+
+        fg_thread_free(fg);
+        avfilter_graph_free(&fg->graph);
+        for (j = 0; j < fg->nb_inputs; j++) {
+            sws_freeContext(fg->inputs[j]->prescale);
+            fg->inputs[j]->prescale = NULL;
+        }
+    }
+    thread_pool_session_free(&thread_pool_session);
+    sched_heap_free(&output_heap);
+
+    av_log(NULL, AV_LOG_VERBOSE, "Queued memory: peak %lld bytes in session, %lld in process\n",
+           (long long)atomic_load(&mem_budget_session.peak),
+           (long long)atomic_load(&mem_budget_process.peak));
+    /* packets and frames still queued are not freed one by one */
+    mem_budget_release(&mem_budget_session, atomic_load(&mem_budget_session.used));
+
+    for (i = 0; i < nb_input_files; i++)
+        pkttrace_writer_close(&input_files[i]->pkttrace);
+    trace_write();
+    bench_perf_uninit();
+    loop_event_uninit();
+
+    if (session_arena) {
+        ArenaStats s;
+
+        arena_get_stats(session_arena, &s);
+        av_log(NULL, AV_LOG_VERBOSE, "Session arena: %zu allocations, %zu of %zu bytes "
+               "in %d blocks\n", s.allocs, s.used, s.reserved, s.nb_blocks);
+        /* the stream, file and filtergraph arrays live in the arena */
+        nb_input_streams = nb_output_streams = 0;
+        nb_input_files   = nb_output_files   = 0;
+        nb_filtergraphs  = 0;
+        input_streams  = NULL;
+        output_streams = NULL;
+        input_files    = NULL;
+        output_files   = NULL;
+        filtergraphs   = NULL;
+        arena_free(&session_arena);
+    }
     //printf("exit transcoding , result value=%d\n", ret);
     av_log(NULL, AV_LOG_INFO, "exit transcoding , result value=%d\n", ret);
 }
@@ -122,6 +200,127 @@ static int64_t getmaxrss(void)
 #endif
 }
 
+/**
+ * Charge the wall time elapsed since the previous call to the given stage
+ * of stats. A NULL stats only restarts the clock.
+ */
+static void update_benchmark(BenchStats *stats, enum BenchStage stage)
+{
+    if (do_benchmark_all) {
+        int64_t t = av_gettime_relative();
+
+        if (stats)
+            bench_record(stats, stage, t - current_time);
+        current_time = t;
+
+        if (bench_perf_enabled) {
+            uint64_t v[BENCH_PERF_NB], delta[BENCH_PERF_NB];
+            int i;
+
+            if (bench_perf_read(v) < 0)
+                return;
+            if (stats) {
+                for (i = 0; i < BENCH_PERF_NB; i++)
+                    delta[i] = v[i] - current_perf[i];
+                bench_record_perf(stats, stage, delta);
+            }
+            memcpy(current_perf, v, sizeof(v));
+        }
+    }
+}
+
+/* -drop_predict: decode time the frames never decoded would have taken, and
+ * filter time all the predicted frames would have taken, both at the
+ * average of the frames that were */
+static void drop_predict_saved(const InputStream *ist, int64_t *decode_us, int64_t *filter_us)
+{
+    *decode_us = ist->frames_decoded ?
+                 ist->drop_decode_us * ist->drop_predict_skipped / ist->frames_decoded : 0;
+    *filter_us = ist->drop_filter_frames ?
+                 ist->drop_filter_us * (ist->drop_predict_skipped + ist->drop_predict_frames) /
+                 ist->drop_filter_frames : 0;
+}
+
+static void dump_benchmark_stats(void)
+{
+    AVBPrint bp;
+    int i;
+
+    if (!do_benchmark_all)
+        return;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&bp, "{\"input_streams\":[");
+    for (i = 0; i < nb_input_streams; i++) {
+        InputStream *ist = input_streams[i];
+
+        av_bprintf(&bp, "%s{\"file\":%d,\"stream\":%d,\"type\":\"%s\",\"stages\":",
+                   i ? "," : "", ist->file_index, ist->st->index,
+                   av_get_media_type_string(ist->st->codecpar->codec_type));
+        bench_print_json(&bp, &ist->bench);
+        if (ist->drop_ost) {
+            int64_t decode_us, filter_us;
+
+            drop_predict_saved(ist, &decode_us, &filter_us);
+            av_bprintf(&bp, ",\"drop_predict\":{\"packets\":%"PRIu64",\"decoded\":%"PRIu64","
+                       "\"skipped\":%"PRIu64",\"decode_saved_us\":%"PRId64",\"filter_saved_us\":%"PRId64"}",
+                       ist->drop_predict_packets, ist->drop_predict_frames,
+                       ist->drop_predict_skipped, decode_us, filter_us);
+        }
+        av_bprintf(&bp, "}");
+    }
+    av_bprintf(&bp, "],\"output_streams\":[");
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+
+        av_bprintf(&bp, "%s{\"file\":%d,\"stream\":%d,\"type\":\"%s\",\"stages\":",
+                   i ? "," : "", ost->file_index, ost->index,
+                   av_get_media_type_string(ost->st->codecpar->codec_type));
+        bench_print_json(&bp, &ost->bench);
+        av_bprintf(&bp, "}");
+    }
+    av_bprintf(&bp, "]");
+    if (frame_pool) {
+        FramePoolStats s;
+
+        frame_pool_get_stats(frame_pool, &s);
+        av_bprintf(&bp, ",\"frame_pool\":{\"requests\":%"PRIu64",\"mallocs\":%"PRIu64","
+                   "\"steady_mallocs\":%"PRIu64",\"bytes\":%"PRIu64",\"fallbacks\":%"PRIu64","
+                   "\"classes\":%d,\"huge_mappings\":%"PRIu64",\"hugetlb_mappings\":%"PRIu64","
+                   "\"huge_bytes\":%"PRIu64",\"faults_saved\":%"PRIu64"}",
+                   s.requests, s.mallocs, s.steady_mallocs, s.bytes, s.fallbacks, s.nb_classes,
+                   s.huge_mappings, s.hugetlb_mappings, s.huge_bytes, s.faults_saved);
+    }
+    av_bprintf(&bp, ",\"main_loop\":");
+    loop_print_json(&bp);
+    av_bprintf(&bp, ",\"queued_memory\":{\"bytes\":%lld,\"peak\":%lld,\"limit\":%"PRId64","
+               "\"frames_dropped\":%d}",
+               (long long)atomic_load(&mem_budget_session.used),
+               (long long)atomic_load(&mem_budget_session.peak),
+               mem_budget_session.limit, nb_frames_budget_drop);
+    av_bprintf(&bp, ",\"filter_reinit\":{\"count\":%d,\"time_us\":%"PRId64","
+               "\"max_us\":%"PRId64",\"prescaled_frames\":%d}",
+               nb_filter_reinits, filter_reinit_time, filter_reinit_max, nb_frames_prescaled);
+    av_bprintf(&bp, "}\n");
+
+    if (!av_bprint_is_complete(&bp)) {
+        av_log(NULL, AV_LOG_ERROR, "Out of memory while dumping benchmark stats\n");
+    } else if (benchmark_filename) {
+        /* rewrite the whole file so every dump is a complete snapshot */
+        FILE *f = fopen(benchmark_filename, "w");
+        if (!f) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot open benchmark file %s: %s\n",
+                   benchmark_filename, av_err2str(AVERROR(errno)));
+        } else {
+            fputs(bp.str, f);
+            fclose(f);
+        }
+    } else {
+        av_log(NULL, AV_LOG_INFO, "bench: %s", bp.str);
+    }
+    av_bprint_finalize(&bp, NULL);
+}
+
 /* end of sub2video hack */
 
 static void term_exit_sigsafe(void)
@@ -143,6 +342,13 @@ static void sigterm_handler(int sig)
 
         exit(123);
     }
+    loop_event_signal();
+}
+
+static void bench_dump_handler(int sig)
+{
+    received_bench_dump = 1;
+    loop_event_signal();
 }
 
 void term_init(void)
@@ -174,6 +380,9 @@ void term_init(void)
 #ifdef SIGXCPU
     signal(SIGXCPU, sigterm_handler);
 #endif
+#ifdef SIGUSR1
+    signal(SIGUSR1, bench_dump_handler); /* dump -benchmark_all stats */
+#endif
 #if HAVE_SETCONSOLECTRLHANDLER
     SetConsoleCtrlHandler((PHANDLER_ROUTINE) CtrlHandler, TRUE);
 #endif
@@ -188,6 +397,7 @@ void term_exit(void)
 void register_ffmpeg(){
     avfilter_register_all();
     av_register_all();
+    pkttrace_register();
     avformat_network_init();
 }
 
@@ -277,6 +487,8 @@ static int get_buffer(AVCodecContext *s, AVFrame *frame, int flags)
     if (ist->hwaccel_get_buffer && frame->format == ist->hwaccel_pix_fmt)
         return ist->hwaccel_get_buffer(s, frame, flags);
 
+    if (frame_pool)
+        return frame_pool_get_buffer2(frame_pool, s, frame, flags);
     return avcodec_default_get_buffer2(s, frame, flags);
 }
 
@@ -449,6 +661,283 @@ static int init_output_stream_encode(OutputStream *ost)
     return 0;
 }
 
+static int nb_threaded_codecs(void)
+{
+    int i, n = 0;
+
+    for (i = 0; i < nb_input_streams; i++)
+        n += input_streams[i]->decoding_needed &&
+             input_streams[i]->st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+    for (i = 0; i < nb_output_streams; i++)
+        n += output_streams[i]->encoding_needed && output_streams[i]->enc &&
+             output_streams[i]->enc->type == AVMEDIA_TYPE_VIDEO;
+    return n;
+}
+
+/* with the shared pool the codecs split it instead of each taking all cores */
+static void set_default_threads(AVCodecContext *avctx, const AVCodec *codec, AVDictionary **opts)
+{
+    if (av_dict_get(*opts, "threads", NULL, 0))
+        return;
+    if (auto_threads && avctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+        thread_tune_codec(avctx, codec, auto_threads_jobs);
+        av_log(NULL, AV_LOG_VERBOSE, "Using %d %s threads for %s %dx%d\n",
+               avctx->thread_count, avctx->thread_type == FF_THREAD_FRAME ? "frame" :
+               avctx->thread_type == FF_THREAD_SLICE ? "slice" : "codec",
+               codec->name, avctx->width, avctx->height);
+    } else if (thread_pool_session)
+        av_dict_set_int(opts, "threads", thread_pool_codec_threads(nb_threaded_codecs()), 0);
+    else
+        av_dict_set(opts, "threads", "auto", 0);
+}
+
+static int resolve_video_sync(OutputFile *of, InputStream *ist)
+{
+    int format_video_sync = video_sync_method;
+
+    if (format_video_sync == VSYNC_AUTO) {
+        if(!strcmp(of->ctx->oformat->name, "avi")) {
+            format_video_sync = VSYNC_VFR;
+        } else
+            format_video_sync = (of->ctx->oformat->flags & AVFMT_VARIABLE_FPS) ? ((of->ctx->oformat->flags & AVFMT_NOTIMESTAMPS) ? VSYNC_PASSTHROUGH : VSYNC_VFR) : VSYNC_CFR;
+        if (   ist
+            && format_video_sync == VSYNC_CFR
+            && input_files[ist->file_index]->ctx->nb_streams == 1
+            && input_files[ist->file_index]->input_ts_offset == 0) {
+            format_video_sync = VSYNC_VSCFR;
+        }
+        if (format_video_sync == VSYNC_CFR && copy_ts) {
+            format_video_sync = VSYNC_VSCFR;
+        }
+    }
+    return format_video_sync;
+}
+
+/* -drop_predict: replay do_video_out() for the only output fed by ist, on
+ * the frame grid of a constant rate input. Only when nothing between the
+ * decoder and do_video_out() adds, drops or retimes frames: no filters, no
+ * trim for -ss, and neither -frame_drop_threshold nor -frames, which do
+ * not depend on the timestamps alone. */
+static void init_drop_prediction(InputStream *ist)
+{
+    InputFile *f = input_files[ist->file_index];
+    AVRational in_rate;
+    FilterGraph *fg;
+    OutputStream *ost;
+    OutputFile *of;
+    int vsync;
+
+    if (!drop_predict || ist->dec_ctx->codec_type != AVMEDIA_TYPE_VIDEO ||
+        ist->framerate.num || ist->nb_filters != 1 || frame_drop_threshold ||
+        (f->start_time != AV_NOPTS_VALUE && f->accurate_seek))
+        return;
+    fg  = ist->filters[0]->graph;
+    ost = fg->outputs[0]->ost;
+    if (!filtergraph_is_simple(fg) || !ost || !ost->frame_rate.num ||
+        !ost->avfilter || strcmp(ost->avfilter, "null") ||
+        ost->max_frames != INT64_MAX)
+        return;
+    of = output_files[ost->file_index];
+    vsync = resolve_video_sync(of, ist);
+    if (of->start_time != AV_NOPTS_VALUE ||
+        vsync == VSYNC_PASSTHROUGH || vsync == VSYNC_DROP)
+        return;
+
+    /* constant rate: the demuxer saw no other rate, and the frame duration
+     * is a whole number of time base units */
+    in_rate = ist->st->r_frame_rate;
+    if (!in_rate.num || !in_rate.den ||
+        av_cmp_q(in_rate, ist->st->avg_frame_rate) ||
+        av_cmp_q(ost->frame_rate, in_rate) >= 0)
+        return;
+    ist->drop_step = av_rescale_q(1, av_inv_q(in_rate), ist->st->time_base);
+    if (ist->drop_step <= 0 ||
+        av_cmp_q(av_mul_q((AVRational){ ist->drop_step, 1 }, ist->st->time_base),
+                 av_inv_q(in_rate)))
+        return;
+
+    ist->drop_ost    = ost;
+    ist->drop_vsync  = vsync;
+    ist->drop_origin = AV_NOPTS_VALUE;
+    ist->skip_frame  = ist->dec_ctx->skip_frame;
+    av_log(NULL, AV_LOG_VERBOSE, "Input stream #%d:%d: predicting the frames dropped "
+           "by the %d/%d to %d/%d fps conversion\n", ist->file_index, ist->st->index,
+           in_rate.num, in_rate.den, ost->frame_rate.num, ost->frame_rate.den);
+}
+
+static void drop_prediction_stop(InputStream *ist, const char *reason)
+{
+    av_log(NULL, AV_LOG_VERBOSE, "Input stream #%d:%d: no longer predicting "
+           "dropped frames, %s\n", ist->file_index, ist->st->index, reason);
+    ist->drop_off = 1;
+    ist->dec_ctx->skip_frame = ist->skip_frame;
+}
+
+/* do_video_out() on grid frame k: how often it outputs the frame, moving
+ * sync_opts and frame_number on as it does. reap_filters() computes the
+ * same sync_ipts, and the rate conversion below is the one do_video_out()
+ * does on it with the options init_drop_prediction() allows. Frames it
+ * drops leave both untouched, so skipping them upstream changes nothing.
+ * A constant input slower than the output never needs the previous frame
+ * duplicated, which do_video_out() would take from a skipped frame. */
+static int drop_replay(InputStream *ist, int64_t k, int64_t *sync_opts,
+                       int64_t *frame_number)
+{
+    AVRational tb = ist->drop_enc_tb;
+    int extra_bits = av_clip(29 - av_log2(tb.den), 0, 16);
+    double sync_ipts, delta0, delta, duration = ist->drop_duration;
+    int nb_frames = 1;
+
+    tb.den <<= extra_bits;
+    sync_ipts = av_rescale_q(ist->drop_origin + k * ist->drop_step, ist->drop_filter_tb, tb);
+    sync_ipts /= 1 << extra_bits;
+    sync_ipts += FFSIGN(sync_ipts) * 1.0 / (1<<17);
+
+    delta0 = sync_ipts - *sync_opts;
+    delta  = delta0 + duration;
+    if (delta0 < 0 && delta > 0) {
+        sync_ipts = *sync_opts;
+        duration += delta0;
+        delta0 = 0;
+    }
+    switch (ist->drop_vsync) {
+    case VSYNC_VSCFR:
+        if (*frame_number == 0 && delta0 >= 0.5) {
+            delta = duration;
+            *sync_opts = lrint(sync_ipts);
+        }
+    case VSYNC_CFR:
+        if (delta < -1.1)
+            nb_frames = 0;
+        else if (delta > 1.1)
+            nb_frames = lrintf(delta);
+        break;
+    case VSYNC_VFR:
+        if (delta <= -0.6)
+            nb_frames = 0;
+        else if (delta > 0.6)
+            *sync_opts = lrint(sync_ipts);
+        break;
+    }
+    *sync_opts    += nb_frames;
+    *frame_number += nb_frames;
+    return nb_frames;
+}
+
+/* The encoder time base and the buffersink parameters do_video_out() works
+ * with are known once reap_filters() opened the encoder. */
+static int drop_prediction_ready(InputStream *ist)
+{
+    OutputStream *ost = ist->drop_ost;
+    AVFilterContext *sink = ost->filter->filter;
+    AVRational frame_rate;
+    double duration = 0;
+    int64_t sync_opts = 0, frame_number = 0, k;
+
+    if (ist->drop_ready)
+        return 1;
+    if (!ost->initialized || !sink)
+        return 0;
+
+    ist->drop_enc_tb    = ost->enc_ctx->time_base;
+    ist->drop_filter_tb = av_buffersink_get_time_base(sink);
+    frame_rate = av_buffersink_get_frame_rate(sink);
+    if (frame_rate.num > 0 && frame_rate.den > 0)
+        duration = 1/(av_q2d(frame_rate) * av_q2d(ist->drop_enc_tb));
+    if (ist->st->start_time != AV_NOPTS_VALUE && ist->st->first_dts != AV_NOPTS_VALUE)
+        duration = FFMIN(duration, 1/(av_q2d(ost->frame_rate) * av_q2d(ist->drop_enc_tb)));
+    if (!ost->filters_script && !ost->filters &&
+        lrintf(ist->drop_pkt_duration * av_q2d(ist->st->time_base) / av_q2d(ist->drop_enc_tb)) > 0)
+        duration = lrintf(ist->drop_pkt_duration * av_q2d(ist->st->time_base) / av_q2d(ist->drop_enc_tb));
+    ist->drop_duration = duration;
+    ist->drop_ready    = 1;
+
+    /* every frame so far went through do_video_out() */
+    for (k = 0; k < ist->drop_next; k++)
+        drop_replay(ist, k, &sync_opts, &frame_number);
+    ist->drop_sync_opts    = sync_opts;
+    ist->drop_frame_number = frame_number;
+    return 1;
+}
+
+/* grid index of pts, -1 if it is not on the grid */
+static int64_t drop_grid_index(InputStream *ist, int64_t pts)
+{
+    if (pts == AV_NOPTS_VALUE || pts < ist->drop_origin ||
+        (pts - ist->drop_origin) % ist->drop_step)
+        return -1;
+    return (pts - ist->drop_origin) / ist->drop_step;
+}
+
+/* Before decoding, in decode order: the frame of a packet is dropped if
+ * do_video_out() drops it after keeping or dropping every frame before it
+ * as predicted, which needs all of them demuxed already. */
+static int drop_predicted_packet(InputStream *ist, int64_t pts)
+{
+    int64_t sync_opts = ist->drop_sync_opts, frame_number = ist->drop_frame_number;
+    int64_t k, n;
+    uint64_t before;
+
+    if (!ist->drop_ost || ist->drop_off || ist->drop_origin == AV_NOPTS_VALUE ||
+        (k = drop_grid_index(ist, pts)) < ist->drop_next ||
+        (n = k - ist->drop_next) >= 64)
+        return 0;
+    ist->drop_pkt_seen |= 1ULL << n;
+    before = (1ULL << n) - 1;
+    if ((ist->drop_pkt_seen & before) != before || !drop_prediction_ready(ist))
+        return 0;
+    for (n = ist->drop_next; n < k; n++)
+        drop_replay(ist, n, &sync_opts, &frame_number);
+    return !drop_replay(ist, k, &sync_opts, &frame_number);
+}
+
+/* After decoding, in presentation order: replay do_video_out() for this
+ * frame, and for the ones before it the decoder skipped, which must be ones
+ * predicted as dropped. Anything off the grid ends the prediction. */
+static int drop_predicted_frame(InputStream *ist, AVFrame *frame, int64_t pts)
+{
+    int64_t sync_opts, frame_number, k, n;
+
+    if (!ist->drop_ost || ist->drop_off)
+        return 0;
+    if (ist->drop_origin == AV_NOPTS_VALUE) {
+        if (pts == AV_NOPTS_VALUE) {
+            drop_prediction_stop(ist, "the first frame has no timestamp");
+            return 0;
+        }
+        ist->drop_origin       = pts;
+        ist->drop_pkt_duration = av_frame_get_pkt_duration(frame);
+    }
+    if ((k = drop_grid_index(ist, pts)) < ist->drop_next ||
+        av_frame_get_pkt_duration(frame) != ist->drop_pkt_duration) {
+        drop_prediction_stop(ist, "the input frame rate is not constant");
+        return 0;
+    }
+    if (!drop_prediction_ready(ist)) {
+        if (k != ist->drop_next) {
+            drop_prediction_stop(ist, "the input frame rate is not constant");
+            return 0;
+        }
+        ist->drop_next++;
+        ist->drop_pkt_seen >>= 1;
+        return 0;
+    }
+
+    for (n = ist->drop_next; n < k; n++) {
+        sync_opts    = ist->drop_sync_opts;
+        frame_number = ist->drop_frame_number;
+        if (drop_replay(ist, n, &sync_opts, &frame_number)) {
+            drop_prediction_stop(ist, "a frame that is not dropped is missing");
+            return 0;
+        }
+    }
+    ist->drop_predict_skipped += k - ist->drop_next;
+    ist->drop_pkt_seen = k + 1 - ist->drop_next < 64 ?
+                         ist->drop_pkt_seen >> (k + 1 - ist->drop_next) : 0;
+    ist->drop_next = k + 1;
+    return !drop_replay(ist, k, &ist->drop_sync_opts, &ist->drop_frame_number);
+}
+
 static int init_input_stream(int ist_index, char *error, int error_len)
 {
     int ret;
@@ -477,12 +966,22 @@ static int init_input_stream(int ist_index, char *error, int error_len)
 
         av_dict_set(&ist->decoder_opts, "sub_text_format", "ass", AV_DICT_DONT_OVERWRITE);
 
+        /* -preview: decoder shortcuts the user did not set otherwise. Skipping
+         * the loop filter on reference frames lets errors drift until the
+         * next keyframe, which a preview can live with. */
+        if (preview_mode && ist->dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+            av_dict_set(&ist->decoder_opts, "skip_loop_filter", "all", AV_DICT_DONT_OVERWRITE);
+            av_dict_set(&ist->decoder_opts, "skip_idct", "nonref", AV_DICT_DONT_OVERWRITE);
+            av_dict_set(&ist->decoder_opts, "flags2", "+fast", AV_DICT_DONT_OVERWRITE);
+            if (av_codec_get_max_lowres(codec) > 0)
+                av_dict_set(&ist->decoder_opts, "lowres", "1", AV_DICT_DONT_OVERWRITE);
+        }
+
         /* Useful for subtitles retiming by lavf (FIXME), skipping samples in
          * audio, and video decoders such as cuvid or mediacodec */
         av_codec_set_pkt_timebase(ist->dec_ctx, ist->st->time_base);
 
-        if (!av_dict_get(ist->decoder_opts, "threads", NULL, 0))
-            av_dict_set(&ist->decoder_opts, "threads", "auto", 0);
+        set_default_threads(ist->dec_ctx, codec, &ist->decoder_opts);
 
         if ((ret = avcodec_open2(ist->dec_ctx, codec, &ist->decoder_opts)) < 0) {
             if (ret == AVERROR_EXPERIMENTAL)
@@ -495,6 +994,7 @@ static int init_input_stream(int ist_index, char *error, int error_len)
             return ret;
         }
         assert_avoptions(ist->decoder_opts);
+        init_drop_prediction(ist);
     }
 
     ist->next_pts = AV_NOPTS_VALUE;
@@ -770,6 +1270,29 @@ static void set_encoder_id(OutputFile *of, OutputStream *ost)
                 AV_DICT_DONT_STRDUP_VAL | AV_DICT_DONT_OVERWRITE);
 }
 
+/* move ost in the output heap after its muxed dts may have changed */
+static void update_output_key(OutputStream *ost)
+{
+    int64_t opts;
+
+    if (!output_heap.nb_entries)
+        return;
+    if (ost->st->cur_dts == AV_NOPTS_VALUE) {
+        av_log(NULL, AV_LOG_DEBUG, "cur_dts is invalid (this is harmless if it occurs once at the start per stream)\n");
+        opts = INT64_MIN;
+    } else {
+        opts = av_rescale_q(ost->st->cur_dts, ost->st->time_base, AV_TIME_BASE_Q);
+    }
+    sched_heap_update(&output_heap, output_files[ost->file_index]->ost_index + ost->index, opts);
+}
+
+static void set_unavailable(OutputStream *ost)
+{
+    if (!ost->unavailable)
+        nb_unavailable++;
+    ost->unavailable = 1;
+}
+
 static int init_output_stream(OutputStream *ost, char *error, int error_len)
 {
     int ret = 0;
@@ -793,8 +1316,7 @@ static int init_output_stream(OutputStream *ost, char *error, int error_len)
             memcpy(ost->enc_ctx->subtitle_header, dec->subtitle_header, dec->subtitle_header_size);
             ost->enc_ctx->subtitle_header_size = dec->subtitle_header_size;
         }
-        if (!av_dict_get(ost->encoder_opts, "threads", NULL, 0))
-            av_dict_set(&ost->encoder_opts, "threads", "auto", 0);
+        set_default_threads(ost->enc_ctx, codec, &ost->encoder_opts);
         if (ost->enc->type == AVMEDIA_TYPE_AUDIO &&
             !codec->defaults &&
             !av_dict_get(ost->encoder_opts, "b", NULL, 0) &&
@@ -819,9 +1341,14 @@ static int init_output_stream(OutputStream *ost, char *error, int error_len)
             return ret;
         }
         if (ost->enc->type == AVMEDIA_TYPE_AUDIO &&
-            !(ost->enc->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE))
-            av_buffersink_set_frame_size(ost->filter->filter,
-                                            ost->enc_ctx->frame_size);
+            !(ost->enc->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE)) {
+            /* the executor owns the graph, and holds it until this */
+            if (ost->filter->graph->thread)
+                fg_thread_set_frame_size(ost->filter, ost->enc_ctx->frame_size);
+            else
+                av_buffersink_set_frame_size(ost->filter->filter,
+                                             ost->enc_ctx->frame_size);
+        }
         assert_avoptions(ost->encoder_opts);
         if (ost->enc_ctx->bit_rate && ost->enc_ctx->bit_rate < 1000)
             av_log(NULL, AV_LOG_WARNING, "The bitrate parameter is set too low."
@@ -946,6 +1473,7 @@ static int init_output_stream(OutputStream *ost, char *error, int error_len)
         return ret;
 
     ost->initialized = 1;
+    update_output_key(ost);
 
     ret = check_init_output_file(output_files[ost->file_index], ost->file_index);
     if (ret < 0)
@@ -1015,14 +1543,390 @@ static void close_all_output_streams(OutputStream *ost, OSTFinished this_stream,
     }
 }
 
-static void print_report(int is_last_report, int64_t timer_start, int64_t cur_time)
+static double psnr(double d)
 {
-    //TODO
+    return -10.0 * log10(d);
 }
 
-static double psnr(double d)
+static void print_final_stats(int64_t total_size)
 {
-    return -10.0 * log10(d);
+    uint64_t video_size = 0, audio_size = 0, extra_size = 0, other_size = 0;
+    uint64_t subtitle_size = 0;
+    uint64_t data_size = 0;
+    float percent = -1.0;
+    int i, j;
+    int pass1_used = 1;
+
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        switch (ost->enc_ctx->codec_type) {
+            case AVMEDIA_TYPE_VIDEO: video_size += ost->data_size; break;
+            case AVMEDIA_TYPE_AUDIO: audio_size += ost->data_size; break;
+            case AVMEDIA_TYPE_SUBTITLE: subtitle_size += ost->data_size; break;
+            default:                 other_size += ost->data_size; break;
+        }
+        extra_size += ost->enc_ctx->extradata_size;
+        data_size  += ost->data_size;
+        if (   (ost->enc_ctx->flags & (AV_CODEC_FLAG_PASS1 | AV_CODEC_FLAG_PASS2))
+            != AV_CODEC_FLAG_PASS1)
+            pass1_used = 0;
+    }
+
+    if (data_size && total_size>0 && total_size >= data_size)
+        percent = 100.0 * (total_size - data_size) / data_size;
+
+    av_log(NULL, AV_LOG_INFO, "video:%1.0fkB audio:%1.0fkB subtitle:%1.0fkB other streams:%1.0fkB global headers:%1.0fkB muxing overhead: ",
+           video_size / 1024.0,
+           audio_size / 1024.0,
+           subtitle_size / 1024.0,
+           other_size / 1024.0,
+           extra_size / 1024.0);
+    if (percent >= 0.0)
+        av_log(NULL, AV_LOG_INFO, "%f%%", percent);
+    else
+        av_log(NULL, AV_LOG_INFO, "unknown");
+    av_log(NULL, AV_LOG_INFO, "\n");
+
+    /* print verbose per-stream stats */
+    for (i = 0; i < nb_input_files; i++) {
+        InputFile *f = input_files[i];
+        uint64_t total_packets = 0, total_size = 0;
+
+        av_log(NULL, AV_LOG_VERBOSE, "Input file #%d (%s):\n",
+               i, f->ctx->filename);
+
+        for (j = 0; j < f->nb_streams; j++) {
+            InputStream *ist = input_streams[f->ist_index + j];
+            enum AVMediaType type = ist->dec_ctx->codec_type;
+
+            total_size    += ist->data_size;
+            total_packets += ist->nb_packets;
+
+            av_log(NULL, AV_LOG_VERBOSE, "  Input stream #%d:%d (%s): ",
+                   i, j, media_type_string(type));
+            av_log(NULL, AV_LOG_VERBOSE, "%"PRIu64" packets read (%"PRIu64" bytes); ",
+                   ist->nb_packets, ist->data_size);
+
+            if (ist->decoding_needed) {
+                av_log(NULL, AV_LOG_VERBOSE, "%"PRIu64" frames decoded",
+                       ist->frames_decoded);
+                if (type == AVMEDIA_TYPE_AUDIO)
+                    av_log(NULL, AV_LOG_VERBOSE, " (%"PRIu64" samples)", ist->samples_decoded);
+                av_log(NULL, AV_LOG_VERBOSE, "; ");
+            }
+            if (ist->drop_ost) {
+                int64_t decode_us, filter_us;
+
+                drop_predict_saved(ist, &decode_us, &filter_us);
+                av_log(NULL, AV_LOG_VERBOSE, "%"PRIu64" predicted drops (%"PRIu64" not decoded, "
+                       "%"PRIu64" decoded as reference frames, none filtered, ~%"PRId64" us "
+                       "decoding and ~%"PRId64" us filtering saved); ",
+                       ist->drop_predict_skipped + ist->drop_predict_frames,
+                       ist->drop_predict_skipped, ist->drop_predict_frames, decode_us, filter_us);
+            }
+
+            av_log(NULL, AV_LOG_VERBOSE, "\n");
+        }
+
+        av_log(NULL, AV_LOG_VERBOSE, "  Total: %"PRIu64" packets (%"PRIu64" bytes) demuxed\n",
+               total_packets, total_size);
+    }
+
+    for (i = 0; i < nb_output_files; i++) {
+        OutputFile *of = output_files[i];
+        uint64_t total_packets = 0, total_size = 0;
+
+        av_log(NULL, AV_LOG_VERBOSE, "Output file #%d (%s):\n",
+               i, of->ctx->filename);
+
+        for (j = 0; j < of->ctx->nb_streams; j++) {
+            OutputStream *ost = output_streams[of->ost_index + j];
+            enum AVMediaType type = ost->enc_ctx->codec_type;
+
+            total_size    += ost->data_size;
+            total_packets += ost->packets_written;
+
+            av_log(NULL, AV_LOG_VERBOSE, "  Output stream #%d:%d (%s): ",
+                   i, j, media_type_string(type));
+            if (ost->encoding_needed) {
+                av_log(NULL, AV_LOG_VERBOSE, "%"PRIu64" frames encoded",
+                       ost->frames_encoded);
+                if (type == AVMEDIA_TYPE_AUDIO)
+                    av_log(NULL, AV_LOG_VERBOSE, " (%"PRIu64" samples)", ost->samples_encoded);
+                av_log(NULL, AV_LOG_VERBOSE, "; ");
+            }
+
+            av_log(NULL, AV_LOG_VERBOSE, "%"PRIu64" packets muxed (%"PRIu64" bytes); ",
+                   ost->packets_written, ost->data_size);
+
+            av_log(NULL, AV_LOG_VERBOSE, "\n");
+        }
+
+        av_log(NULL, AV_LOG_VERBOSE, "  Total: %"PRIu64" packets (%"PRIu64" bytes) muxed\n",
+               total_packets, total_size);
+    }
+    {
+        LoopStats s;
+
+        loop_get_stats(&s);
+        if (s.waits)
+            av_log(NULL, AV_LOG_VERBOSE, "Main loop: %"PRIu64" waits for input (%"PRIu64" woken early, "
+                   "%.3fs blocked)\n", s.waits, s.wakeups, s.wait_us / 1000000.0);
+        if (s.latency_count)
+            av_log(NULL, AV_LOG_VERBOSE, "Paced input latency: avg %.0fus, max %"PRId64"us over %"PRIu64" packets\n",
+                   (double)s.latency_sum_us / s.latency_count, s.latency_max_us, s.latency_count);
+    }
+    if (thread_pool_session) {
+        ThreadPoolStats s;
+
+        thread_pool_session_get_stats(thread_pool_session, &s);
+        av_log(NULL, AV_LOG_VERBOSE, "Thread pool: %d threads, %"PRIu64" batches, %"PRIu64" jobs "
+               "(%"PRIu64" on pool workers)\n", thread_pool_nb_threads(), s.batches, s.jobs, s.offloaded);
+    }
+    if (frame_pool) {
+        FramePoolStats s;
+
+        frame_pool_get_stats(frame_pool, &s);
+        av_log(NULL, AV_LOG_VERBOSE, "Frame pool: %"PRIu64" buffers served, %"PRIu64" allocated "
+               "(%"PRIu64" after warm-up, %"PRIu64" bytes), %"PRIu64" fallbacks, %d size classes\n",
+               s.requests, s.mallocs, s.steady_mallocs, s.bytes, s.fallbacks, s.nb_classes);
+        if (s.huge_mappings)
+            av_log(NULL, AV_LOG_VERBOSE, "Frame pool: %"PRIu64" huge page buffers (%"PRIu64" MAP_HUGETLB, "
+                   "%"PRIu64" bytes), ~%"PRIu64" page faults saved\n",
+                   s.huge_mappings, s.hugetlb_mappings, s.huge_bytes, s.faults_saved);
+    }
+    if(video_size + data_size + audio_size + subtitle_size + extra_size == 0){
+        av_log(NULL, AV_LOG_WARNING, "Output file is empty, nothing was encoded ");
+        if (pass1_used) {
+            av_log(NULL, AV_LOG_WARNING, "\n");
+        } else {
+            av_log(NULL, AV_LOG_WARNING, "(check -ss / -t / -frames parameters if used)\n");
+        }
+    }
+}
+
+static void print_report(int is_last_report, int64_t timer_start, int64_t cur_time)
+{
+    char buf[1024];
+    AVBPrint buf_script;
+    OutputStream *ost;
+    AVFormatContext *oc;
+    int64_t total_size;
+    AVCodecContext *enc;
+    int frame_number, vid, i;
+    double bitrate;
+    double speed;
+    int64_t pts = INT64_MIN + 1;
+    static int64_t last_time = -1;
+    static int qp_histogram[52];
+    int hours, mins, secs, us;
+    int ret;
+    float t;
+
+    /* this runs once per transcode_step(), so bail out before touching
+     * anything unless a report is actually due */
+    if (!print_stats && !is_last_report && !progress_avio)
+        return;
+
+    if (!is_last_report) {
+        if (last_time == -1) {
+            last_time = cur_time;
+            return;
+        }
+        if ((cur_time - last_time) < 500000)
+            return;
+        last_time = cur_time;
+    }
+
+    t = (cur_time-timer_start) / 1000000.0;
+
+
+    oc = output_files[0]->ctx;
+
+    total_size = avio_size(oc->pb);
+    if (total_size <= 0) // FIXME improve avio_size() so it works with non seekable output too
+        total_size = avio_tell(oc->pb);
+
+    buf[0] = '\0';
+    vid = 0;
+    av_bprint_init(&buf_script, 0, AV_BPRINT_SIZE_UNLIMITED);
+    for (i = 0; i < nb_output_streams; i++) {
+        float q = -1;
+        ost = output_streams[i];
+        enc = ost->enc_ctx;
+        if (!ost->stream_copy)
+            q = ost->quality / (float) FF_QP2LAMBDA;
+
+        if (vid && enc->codec_type == AVMEDIA_TYPE_VIDEO) {
+            snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), "q=%2.1f ", q);
+            av_bprintf(&buf_script, "stream_%d_%d_q=%.1f\n",
+                       ost->file_index, ost->index, q);
+        }
+        if (!vid && enc->codec_type == AVMEDIA_TYPE_VIDEO) {
+            float fps;
+
+            frame_number = ost->frame_number;
+            fps = t > 1 ? frame_number / t : 0;
+            snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), "frame=%5d fps=%3.*f q=%3.1f ",
+                     frame_number, fps < 9.95, fps, q);
+            av_bprintf(&buf_script, "frame=%d\n", frame_number);
+            av_bprintf(&buf_script, "fps=%.1f\n", fps);
+            av_bprintf(&buf_script, "stream_%d_%d_q=%.1f\n",
+                       ost->file_index, ost->index, q);
+            if (is_last_report)
+                snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), "L");
+            if (qp_hist) {
+                int j;
+                int qp = lrintf(q);
+                if (qp >= 0 && qp < FF_ARRAY_ELEMS(qp_histogram))
+                    qp_histogram[qp]++;
+                for (j = 0; j < 32; j++)
+                    snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), "%X", av_log2(qp_histogram[j] + 1));
+            }
+
+            if ((enc->flags & AV_CODEC_FLAG_PSNR) && (ost->pict_type != AV_PICTURE_TYPE_NONE || is_last_report)) {
+                int j;
+                double error, error_sum = 0;
+                double scale, scale_sum = 0;
+                double p;
+                char type[3] = { 'Y','U','V' };
+                snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), "PSNR=");
+                for (j = 0; j < 3; j++) {
+                    if (is_last_report) {
+                        error = enc->error[j];
+                        scale = enc->width * enc->height * 255.0 * 255.0 * frame_number;
+                    } else {
+                        error = ost->error[j];
+                        scale = enc->width * enc->height * 255.0 * 255.0;
+                    }
+                    if (j)
+                        scale /= 4;
+                    error_sum += error;
+                    scale_sum += scale;
+                    p = psnr(error / scale);
+                    snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), "%c:%2.2f ", type[j], p);
+                    av_bprintf(&buf_script, "stream_%d_%d_psnr_%c=%2.2f\n",
+                               ost->file_index, ost->index, type[j] | 32, p);
+                }
+                p = psnr(error_sum / scale_sum);
+                snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), "*:%2.2f ", psnr(error_sum / scale_sum));
+                av_bprintf(&buf_script, "stream_%d_%d_psnr_all=%2.2f\n",
+                           ost->file_index, ost->index, p);
+            }
+            vid = 1;
+        }
+        av_bprintf(&buf_script, "stream_%d_%d_frames=%"PRIu64"\n",
+                   ost->file_index, ost->index, ost->frames_encoded);
+        av_bprintf(&buf_script, "stream_%d_%d_packets=%"PRIu64"\n",
+                   ost->file_index, ost->index, ost->packets_written);
+        av_bprintf(&buf_script, "stream_%d_%d_size=%"PRIu64"\n",
+                   ost->file_index, ost->index, ost->data_size);
+        /* compute min output value */
+        if (av_stream_get_end_pts(ost->st) != AV_NOPTS_VALUE)
+            pts = FFMAX(pts, av_rescale_q(av_stream_get_end_pts(ost->st),
+                                          ost->st->time_base, AV_TIME_BASE_Q));
+    }
+
+    secs = FFABS(pts) / AV_TIME_BASE;
+    us = FFABS(pts) % AV_TIME_BASE;
+    mins = secs / 60;
+    secs %= 60;
+    hours = mins / 60;
+    mins %= 60;
+
+    bitrate = pts && total_size >= 0 ? total_size * 8 / (pts / 1000.0) : -1;
+    speed = t != 0.0 ? (double)pts / AV_TIME_BASE / t : -1;
+
+    if (total_size < 0) snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
+                                 "size=N/A time=");
+    else                snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
+                                 "size=%8.0fkB time=", total_size / 1024.0);
+    if (pts < 0)
+        snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), "-");
+    snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
+             "%02d:%02d:%02d.%02d ", hours, mins, secs,
+             (100 * us) / AV_TIME_BASE);
+
+    if (bitrate < 0) {
+        snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),"bitrate=N/A");
+        av_bprintf(&buf_script, "bitrate=N/A\n");
+    }else{
+        snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),"bitrate=%6.1fkbits/s", bitrate);
+        av_bprintf(&buf_script, "bitrate=%6.1fkbits/s\n", bitrate);
+    }
+
+    if (total_size < 0) av_bprintf(&buf_script, "total_size=N/A\n");
+    else                av_bprintf(&buf_script, "total_size=%"PRId64"\n", total_size);
+    av_bprintf(&buf_script, "out_time_ms=%"PRId64"\n", pts);
+    av_bprintf(&buf_script, "out_time=%02d:%02d:%02d.%06d\n",
+               hours, mins, secs, us);
+
+    if (nb_frames_dup || nb_frames_drop)
+        snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), " dup=%d drop=%d",
+                nb_frames_dup, nb_frames_drop);
+    av_bprintf(&buf_script, "dup_frames=%d\n", nb_frames_dup);
+    av_bprintf(&buf_script, "drop_frames=%d\n", nb_frames_drop);
+    av_bprintf(&buf_script, "mem_bytes=%lld\n", (long long)atomic_load(&mem_budget_session.used));
+    av_bprintf(&buf_script, "mem_peak=%lld\n", (long long)atomic_load(&mem_budget_session.peak));
+    if (nb_frames_budget_drop)
+        av_bprintf(&buf_script, "mem_drop_frames=%d\n", nb_frames_budget_drop);
+    if (drop_predict) {
+        uint64_t packets = 0, frames = 0;
+        int64_t decode_saved = 0, filter_saved = 0;
+
+        for (i = 0; i < nb_input_streams; i++) {
+            int64_t decode_us, filter_us;
+
+            packets += input_streams[i]->drop_predict_packets;
+            frames  += input_streams[i]->drop_predict_frames;
+            drop_predict_saved(input_streams[i], &decode_us, &filter_us);
+            decode_saved += decode_us;
+            filter_saved += filter_us;
+        }
+        av_bprintf(&buf_script, "drop_predict_packets=%"PRIu64"\n", packets);
+        av_bprintf(&buf_script, "drop_predict_decoded=%"PRIu64"\n", frames);
+        av_bprintf(&buf_script, "drop_predict_decode_saved_us=%"PRId64"\n", decode_saved);
+        av_bprintf(&buf_script, "drop_predict_filter_saved_us=%"PRId64"\n", filter_saved);
+    }
+    if (nb_filter_reinits) {
+        av_bprintf(&buf_script, "filter_reinits=%d\n", nb_filter_reinits);
+        av_bprintf(&buf_script, "filter_reinit_us=%"PRId64"\n", filter_reinit_time);
+    }
+
+    if (speed < 0) {
+        snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf)," speed=N/A");
+        av_bprintf(&buf_script, "speed=N/A\n");
+    } else {
+        snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf)," speed=%4.3gx", speed);
+        av_bprintf(&buf_script, "speed=%4.3gx\n", speed);
+    }
+
+    if (print_stats || is_last_report) {
+        const char end = is_last_report ? '\n' : '\r';
+        if (print_stats==1 && AV_LOG_INFO > av_log_get_level()) {
+            fprintf(stderr, "%s    %c", buf, end);
+        } else
+            av_log(NULL, AV_LOG_INFO, "%s    %c", buf, end);
+
+        fflush(stderr);
+    }
+
+    if (progress_avio) {
+        av_bprintf(&buf_script, "progress=%s\n",
+                   is_last_report ? "end" : "continue");
+        avio_write(progress_avio, buf_script.str,
+                   FFMIN(buf_script.len, buf_script.size - 1));
+        avio_flush(progress_avio);
+        if (is_last_report) {
+            if ((ret = avio_closep(&progress_avio)) < 0)
+                av_log(NULL, AV_LOG_ERROR,
+                       "Error closing progress log, loss of information possible: %s\n", av_err2str(ret));
+        }
+    }
+    av_bprint_finalize(&buf_script, NULL);
+
+    if (is_last_report)
+        print_final_stats(total_size);
 }
 
 
@@ -1030,6 +1934,7 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
 {
     AVFormatContext *s = of->ctx;
     AVStream *st = ost->st;
+    int64_t t;
     int ret;
 
     /*
@@ -1067,6 +1972,14 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
         ret = av_packet_ref(&tmp_pkt, pkt);
         if (ret < 0)
             exit_program(1);
+        if (mem_budget_charge(&mem_budget_session, mem_packet_size(&tmp_pkt))) {
+            const MemBudget *b = mem_budget_exceeded(&mem_budget_session);
+            av_log(NULL, AV_LOG_FATAL,
+                   "Exceeded the %s memory budget of %"PRId64" bytes while buffering "
+                   "packets for output stream %d:%d before the header could be written.\n",
+                   b->name, b->limit, ost->file_index, ost->st->index);
+            exit_program(1);
+        }
         av_fifo_generic_write(ost->muxing_queue, &tmp_pkt, sizeof(tmp_pkt), NULL);
         av_packet_unref(pkt);
         return;
@@ -1152,7 +2065,12 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
               );
     }
 
+    t = trace_begin();
+    update_benchmark(NULL, 0);
     ret = av_interleaved_write_frame(s, pkt);
+    update_benchmark(&ost->bench, BENCH_MUX);
+    update_output_key(ost);
+    trace_end("write_packet", t, ost->file_index, ost->index, ost->packets_written);
     if (ret < 0) {
         print_error("av_interleaved_write_frame()", ret);
         main_return_code = 1;
@@ -1185,6 +2103,8 @@ static int check_init_output_file(OutputFile *of, int file_index)
     }
     //assert_avoptions(of->opts);
     of->header_written = 1;
+    for (i = 0; i < of->ctx->nb_streams; i++)
+        update_output_key(output_streams[of->ost_index + i]);
 
     av_dump_format(of->ctx, file_index, of->ctx->filename, 1);
 
@@ -1202,6 +2122,7 @@ static int check_init_output_file(OutputFile *of, int file_index)
         while (av_fifo_size(ost->muxing_queue)) {
             AVPacket pkt;
             av_fifo_generic_read(ost->muxing_queue, &pkt, sizeof(pkt), NULL);
+            mem_budget_release(&mem_budget_session, mem_packet_size(&pkt));
             write_packet(of, &pkt, ost, 1);
         }
     }
@@ -1225,7 +2146,12 @@ static int need_output(void)
 {
     int i;
 
-    for (i = 0; i < nb_output_streams; i++) {
+    /* finished is never cleared, skip the streams known to be done */
+    while (first_unfinished < nb_output_streams &&
+           output_streams[first_unfinished]->finished)
+        first_unfinished++;
+
+    for (i = first_unfinished; i < nb_output_streams; i++) {
         OutputStream *ost    = output_streams[i];
         OutputFile *of       = output_files[ost->file_index];
         AVFormatContext *os  = output_files[ost->file_index]->ctx;
@@ -1332,43 +2258,76 @@ dump_format:
     return 0;
 }
 
+static int init_output_heap(void)
+{
+    int i, ret;
+
+    if ((ret = sched_heap_init(&output_heap, nb_output_streams)) < 0)
+        return ret;
+    for (i = 0; i < nb_output_streams; i++)
+        update_output_key(output_streams[i]);
+    return 0;
+}
+
 /**
  * Select the output stream to process.
  *
+ * Streams still waiting for initialization come first, in index order.
+ * After that the stream with the smallest muxed dts is taken from the
+ * output heap, which write_packet() keeps up to date.
+ *
  * @return  selected output stream, or NULL if none available
  */
 static OutputStream *choose_output(void)
 {
+    OutputStream *ost;
     int i;
-    int64_t opts_min = INT64_MAX;
-    OutputStream *ost_min = NULL;
-
-    for (i = 0; i < nb_output_streams; i++) {
-        OutputStream *ost = output_streams[i];
-        int64_t opts = ost->st->cur_dts == AV_NOPTS_VALUE ? INT64_MIN :
-                       av_rescale_q(ost->st->cur_dts, ost->st->time_base,
-                                    AV_TIME_BASE_Q);
-        if (ost->st->cur_dts == AV_NOPTS_VALUE)
-            av_log(NULL, AV_LOG_DEBUG, "cur_dts is invalid (this is harmless if it occurs once at the start per stream)\n");
 
+    /* initialized and inputs_done are never cleared */
+    for (i = first_pending_init; i < nb_output_streams; i++) {
+        ost = output_streams[i];
         if (!ost->initialized && !ost->inputs_done)
             return ost;
+        if (i == first_pending_init)
+            first_pending_init++;
+    }
 
-        if (!ost->finished && opts < opts_min) {
-            opts_min = opts;
-            ost_min  = ost->unavailable ? NULL : ost;
-        }
+    if (!output_heap.nb_entries && nb_output_streams && init_output_heap() < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Could not allocate the output stream heap\n");
+        exit_program(1);
     }
-    return ost_min;
+
+    /* finished streams leave the heap lazily */
+    while ((i = sched_heap_top(&output_heap)) >= 0 && output_streams[i]->finished)
+        sched_heap_remove(&output_heap, i);
+    if (i < 0)
+        return NULL;
+
+    ost = output_streams[i];
+    return ost->unavailable ? NULL : ost;
 }
 
 static int got_eagain(void)
 {
-    int i;
-    for (i = 0; i < nb_output_streams; i++)
-        if (output_streams[i]->unavailable)
-            return 1;
-    return 0;
+    return nb_unavailable > 0;
+}
+
+/*
+ * Block until an input may have data again: the next -re packet is due or
+ * a signal arrived. Demuxers returning EAGAIN give no hint, poll those
+ * with a backoff from 1 ms up to the old fixed 10 ms.
+ */
+static void wait_for_input(void)
+{
+    int64_t deadline = input_deadline;
+
+    if (eagain_unknown || deadline == INT64_MAX) {
+        eagain_backoff = av_clip64(eagain_backoff * 2, 1000, 10000);
+        deadline = FFMIN(deadline, av_gettime_relative() + eagain_backoff);
+    }
+    input_deadline = INT64_MAX;
+    eagain_unknown = 0;
+    loop_event_wait(deadline);
 }
 
 static void reset_eagain(void)
@@ -1376,8 +2335,12 @@ static void reset_eagain(void)
     int i;
     for (i = 0; i < nb_input_files; i++)
         input_files[i]->eagain = 0;
-    for (i = 0; i < nb_output_streams; i++)
+    /* called for every demuxed packet, only scan after an EAGAIN */
+    for (i = 0; nb_unavailable && i < nb_output_streams; i++) {
+        if (output_streams[i]->unavailable)
+            nb_unavailable--;
         output_streams[i]->unavailable = 0;
+    }
 }
 
 // Filters can be configured only if the formats of all inputs are known.
@@ -1392,6 +2355,14 @@ static int ifilter_has_all_input_formats(FilterGraph *fg)
     return 1;
 }
 
+// Only the executor may ask the buffersrc of a graph it runs.
+static int ifilter_failed_requests(InputFilter *ifilter)
+{
+    if (ifilter->graph->thread)
+        return fg_thread_failed_requests(ifilter);
+    return av_buffersrc_get_nb_failed_requests(ifilter->filter);
+}
+
 /**
  * Perform a step of transcoding for the specified filter graph.
  *
@@ -1407,9 +2378,27 @@ static int transcode_from_filter(FilterGraph *graph, InputStream **best_ist)
     InputStream *ist;
 
     *best_ist = NULL;
-    ret = avfilter_graph_request_oldest(graph->graph);
-    if (ret >= 0)
-        return reap_filters(0);
+    if (graph->thread) {
+        /* the executor runs the graph as far as its input allows by itself */
+        ret = fg_thread_poll(graph);
+        if (ret >= 0 || ret == AVERROR(EAGAIN)) {
+            int busy = ret < 0;
+            if ((ret = reap_filters(0)) < 0)
+                return ret;
+            if (busy) {
+                for (i = 0; i < graph->nb_outputs; i++)
+                    set_unavailable(graph->outputs[i]->ost);
+                return 0;
+            }
+            ret = AVERROR(EAGAIN);
+        }
+    } else {
+        ret = avfilter_graph_request_oldest(graph->graph);
+        if (ret >= 0) {
+            graph->pending = 1;
+            return reap_filters(0);
+        }
+    }
 
     if (ret == AVERROR_EOF) {
         ret = reap_filters(1);
@@ -1426,7 +2415,7 @@ static int transcode_from_filter(FilterGraph *graph, InputStream **best_ist)
         if (input_files[ist->file_index]->eagain ||
             input_files[ist->file_index]->eof_reached)
             continue;
-        nb_requests = av_buffersrc_get_nb_failed_requests(ifilter->filter);
+        nb_requests = ifilter_failed_requests(ifilter);
         if (nb_requests > nb_requests_max) {
             nb_requests_max = nb_requests;
             *best_ist = ist;
@@ -1435,7 +2424,7 @@ static int transcode_from_filter(FilterGraph *graph, InputStream **best_ist)
 
     if (!*best_ist)
         for (i = 0; i < graph->nb_outputs; i++)
-            graph->outputs[i]->ost->unavailable = 1;
+            set_unavailable(graph->outputs[i]->ost);
 
     return 0;
 }
@@ -1494,7 +2483,9 @@ static int sub2video_get_blank_frame(InputStream *ist)
     ist->sub2video.frame->width  = ist->dec_ctx->width  ? ist->dec_ctx->width  : ist->sub2video.w;
     ist->sub2video.frame->height = ist->dec_ctx->height ? ist->dec_ctx->height : ist->sub2video.h;
     ist->sub2video.frame->format = AV_PIX_FMT_RGB32;
-    if ((ret = av_frame_get_buffer(frame, 32)) < 0)
+    ret = frame_pool ? frame_pool_get_buffer(frame_pool, frame, 32) :
+                       av_frame_get_buffer(frame, 32);
+    if (ret < 0)
         return ret;
     memset(frame->data[0], 0, frame->height * frame->linesize[0]);
     return 0;
@@ -1531,6 +2522,42 @@ static void sub2video_copy_rect(uint8_t *dst, int dst_linesize, int w, int h,
     }
 }
 
+/*
+ * Push a frame into a filtergraph input, or queue it for the graph's
+ * executor thread. A full queue is drained by reaping what the executor
+ * produced meanwhile.
+ */
+static int filter_push_frame(InputFilter *ifilter, AVFrame *frame, int flags)
+{
+    FilterGraph *fg = ifilter->graph;
+    int ret;
+
+    if (!fg->thread) {
+        ret = av_buffersrc_add_frame_flags(ifilter->filter, frame, flags);
+        fg->pending = 1;
+        return ret;
+    }
+    while ((ret = fg_thread_send(ifilter, frame, flags)) == AVERROR(EAGAIN)) {
+        if ((ret = reap_filters(0)) < 0)
+            return ret;
+        loop_event_wait(av_gettime_relative() + 10000);
+    }
+    return ret;
+}
+
+/* wait until the executor of fg has filtered all queued input */
+static int filter_thread_sync(FilterGraph *fg)
+{
+    int ret;
+
+    while (fg->thread && fg_thread_poll(fg) == AVERROR(EAGAIN)) {
+        if ((ret = reap_filters(0)) < 0)
+            return ret;
+        loop_event_wait(av_gettime_relative() + 10000);
+    }
+    return 0;
+}
+
 static void sub2video_push_ref(InputStream *ist, int64_t pts)
 {
     AVFrame *frame = ist->sub2video.frame;
@@ -1539,9 +2566,8 @@ static void sub2video_push_ref(InputStream *ist, int64_t pts)
     av_assert1(frame->data[0]);
     ist->sub2video.last_pts = frame->pts = pts;
     for (i = 0; i < ist->nb_filters; i++)
-        av_buffersrc_add_frame_flags(ist->filters[i]->filter, frame,
-                                     AV_BUFFERSRC_FLAG_KEEP_REF |
-                                     AV_BUFFERSRC_FLAG_PUSH);
+        filter_push_frame(ist->filters[i], frame,
+                          AV_BUFFERSRC_FLAG_KEEP_REF | AV_BUFFERSRC_FLAG_PUSH);
 }
 
 void sub2video_update(InputStream *ist, AVSubtitle *sub)
@@ -1601,37 +2627,22 @@ static void sub2video_heartbeat(InputStream *ist, int64_t pts)
         if (pts2 >= ist2->sub2video.end_pts || !ist2->sub2video.frame->data[0])
             sub2video_update(ist2, NULL);
         for (j = 0, nb_reqs = 0; j < ist2->nb_filters; j++)
-            nb_reqs += av_buffersrc_get_nb_failed_requests(ist2->filters[j]->filter);
+            nb_reqs += ifilter_failed_requests(ist2->filters[j]);
         if (nb_reqs)
             sub2video_push_ref(ist2, pts2);
     }
 }
 
-static void update_benchmark(const char *fmt, ...)
-{
-    if (do_benchmark_all) {
-        int64_t t = getutime();
-        va_list va;
-        char buf[1024];
-
-        if (fmt) {
-            va_start(va, fmt);
-            vsnprintf(buf, sizeof(buf), fmt, va);
-            va_end(va);
-            av_log(NULL, AV_LOG_INFO, "bench: %8"PRIu64" %s \n", t - current_time, buf);
-        }
-        current_time = t;
-    }
-}
-
 static void output_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost)
 {
+    int64_t t = trace_begin();
     int ret = 0;
 
     /* apply the output bitstream filters, if any */
     if (ost->nb_bitstream_filters) {
         int idx;
 
+        update_benchmark(NULL, 0);
         ret = av_bsf_send_packet(ost->bsf_ctx[0], pkt);
         if (ret < 0)
             goto finish;
@@ -1640,6 +2651,7 @@ static void output_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost)
         while (idx) {
             /* get a packet from the previous filter up the chain */
             ret = av_bsf_receive_packet(ost->bsf_ctx[idx - 1], pkt);
+            update_benchmark(&ost->bench, BENCH_BSF);
             if (ret == AVERROR(EAGAIN)) {
                 ret = 0;
                 idx--;
@@ -1678,6 +2690,7 @@ static void output_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost)
         write_packet(of, pkt, ost, 0);
 
 finish:
+    trace_end("output_packet", t, ost->file_index, ost->index, ost->packets_written);
     if (ret < 0 && ret != AVERROR_EOF) {
         av_log(NULL, AV_LOG_ERROR, "Error applying bitstream filters to an output "
                "packet for stream #%d:%d.\n", ost->file_index, ost->index);
@@ -1797,6 +2810,14 @@ static void do_streamcopy(InputStream *ist, OutputStream *ost, const AVPacket *p
     }
 #endif
 
+    /* share the demuxer's buffer, a packet without one is copied by the
+     * muxing queue and the interleaver */
+    if (!opkt.buf && pkt->buf && opkt.data == pkt->data) {
+        opkt.buf = av_buffer_ref(pkt->buf);
+        if (!opkt.buf)
+            exit_program(1);
+    }
+
     output_packet(of, &opkt, ost);
 }
 
@@ -1808,11 +2829,21 @@ static int get_input_packet(InputFile *f, AVPacket *pkt)
             InputStream *ist = input_streams[f->ist_index + i];
             int64_t pts = av_rescale(ist->dts, 1000000, AV_TIME_BASE);
             int64_t now = av_gettime_relative() - ist->start;
-            if (pts > now)
+            if (pts > now) {
+                f->rate_emu_due = ist->start + pts;
+                input_deadline  = FFMIN(input_deadline, f->rate_emu_due);
                 return AVERROR(EAGAIN);
+            }
+        }
+        if (f->rate_emu_due) {
+            loop_record_latency(av_gettime_relative() - f->rate_emu_due);
+            f->rate_emu_due = 0;
         }
     }
 
+    if (pkttrace_is_replay(f->ctx))
+        return pkttrace_read(f->ctx, pkt);
+
 #if HAVE_PTHREADS
     if (nb_input_files > 1)
         //TODO
@@ -1864,10 +2895,54 @@ static void check_decode_result(InputStream *ist, int *got_output, int ret)
     }
 }
 
+/*
+ * Scale a video frame to the size and format the filtergraph input was
+ * configured with, so a resolution switch of the source does not tear
+ * down and rebuild the graph. The scaler is cached per input and only
+ * recreated when the source parameters change again.
+ */
+static int prescale_frame(InputFilter *ifilter, AVFrame *frame)
+{
+    AVFrame *tmp;
+    int ret;
+
+    ifilter->prescale = sws_getCachedContext(ifilter->prescale,
+                                             frame->width, frame->height, frame->format,
+                                             ifilter->width, ifilter->height, ifilter->format,
+                                             preview_mode ? SWS_FAST_BILINEAR : SWS_BICUBIC,
+                                             NULL, NULL, NULL);
+    if (!ifilter->prescale)
+        return AVERROR(EINVAL);
+
+    if (!(tmp = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    tmp->format = ifilter->format;
+    tmp->width  = ifilter->width;
+    tmp->height = ifilter->height;
+    ret = frame_pool ? frame_pool_get_buffer(frame_pool, tmp, 32) :
+                       av_frame_get_buffer(tmp, 32);
+    if (ret >= 0)
+        ret = av_frame_copy_props(tmp, frame);
+    if (ret < 0) {
+        av_frame_free(&tmp);
+        return ret;
+    }
+    sws_scale(ifilter->prescale, (const uint8_t * const *)frame->data, frame->linesize,
+              0, frame->height, tmp->data, tmp->linesize);
+    tmp->sample_aspect_ratio = ifilter->sample_aspect_ratio;
+
+    av_frame_unref(frame);
+    av_frame_move_ref(frame, tmp);
+    av_frame_free(&tmp);
+    nb_frames_prescaled++;
+    return 0;
+}
+
 static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
 {
     FilterGraph *fg = ifilter->graph;
     int need_reinit, ret, i;
+    int64_t reinit_start = 0;
 
 
     /* determine if the parameters for this input changed */
@@ -1888,6 +2963,17 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
         break;
     }
 
+    /* only software video frames of a running graph can be converted */
+    if (need_reinit && reinit_prescale && fg->graph &&
+        ifilter->type == AVMEDIA_TYPE_VIDEO && ifilter->format >= 0 &&
+        !ifilter->hw_frames_ctx && !frame->hw_frames_ctx) {
+        if ((ret = prescale_frame(ifilter, frame)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Error scaling frame for filtergraph #%d: %s\n",
+                   fg->index, av_err2str(ret));
+            return ret;
+        }
+        need_reinit = 0;
+    }
 
     if (need_reinit) {
         ret = ifilter_parameters_from_frame(ifilter, frame);
@@ -1900,13 +2986,33 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
         for (i = 0; i < fg->nb_inputs; i++) {
             if (!ifilter_has_all_input_formats(fg)) {
                 AVFrame *tmp = av_frame_clone(frame);
+                int64_t size;
                 if (!tmp)
                     return AVERROR(ENOMEM);
                 av_frame_unref(frame);
 
+                /* the other inputs of the graph may never deliver a frame,
+                 * drop rather than queue without bound */
+                size = mem_frame_size(tmp);
+                if (mem_budget_charge(&mem_budget_session, size)) {
+                    const MemBudget *b = mem_budget_exceeded(&mem_budget_session);
+
+                    nb_frames_budget_drop++;
+                    av_log(NULL, AV_LOG_WARNING, "%s memory budget of %"PRId64" bytes exceeded "
+                           "while waiting for all inputs of filtergraph %d, dropping a frame of "
+                           "input stream #%d:%d at pts %s (%d dropped)\n",
+                           b ? b->name : "A", b ? b->limit : 0, fg->index,
+                           ifilter->ist->file_index, ifilter->ist->st->index, av_ts2str(tmp->pts),
+                           nb_frames_budget_drop);
+                    mem_budget_release(&mem_budget_session, size);
+                    av_frame_free(&tmp);
+                    return 0;
+                }
+
                 if (!av_fifo_space(ifilter->frame_queue)) {
                     ret = av_fifo_realloc2(ifilter->frame_queue, 2 * av_fifo_size(ifilter->frame_queue));
                     if (ret < 0) {
+                        mem_budget_release(&mem_budget_session, size);
                         av_frame_free(&tmp);
                         return ret;
                     }
@@ -1916,7 +3022,10 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
             }
         }
 
-        ret = reap_filters(1);
+        if (fg->graph)
+            reinit_start = av_gettime_relative();
+        if ((ret = filter_thread_sync(fg)) >= 0)
+            ret = reap_filters(1);
         if (ret < 0 && ret != AVERROR_EOF) {
             char errbuf[128];
             av_strerror(ret, errbuf, sizeof(errbuf));
@@ -1930,9 +3039,19 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
             av_log(NULL, AV_LOG_ERROR, "Error reinitializing filters!\n");
             return ret;
         }
+        if (reinit_start) {
+            int64_t t = av_gettime_relative() - reinit_start;
+            nb_filter_reinits++;
+            filter_reinit_time += t;
+            filter_reinit_max   = FFMAX(filter_reinit_max, t);
+            av_log(NULL, AV_LOG_VERBOSE, "Filtergraph #%d reconfigured in %"PRId64" us\n",
+                   fg->index, t);
+        }
     }
 
-    ret = av_buffersrc_add_frame_flags(ifilter->filter, frame, AV_BUFFERSRC_FLAG_PUSH);
+    update_benchmark(NULL, 0);
+    ret = filter_push_frame(ifilter, frame, AV_BUFFERSRC_FLAG_PUSH);
+    update_benchmark(&ifilter->ist->bench, BENCH_FILTER);
     if (ret < 0) {
         av_log(NULL, AV_LOG_ERROR, "Error while filtering\n");
         return ret;
@@ -1944,6 +3063,7 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
 static int send_frame_to_filters(InputStream *ist, AVFrame *decoded_frame)
 {
     int i, ret;
+    int64_t t;
     AVFrame *f;
 
     av_assert1(ist->nb_filters > 0); /* ensure ret is initialized */
@@ -1956,7 +3076,9 @@ static int send_frame_to_filters(InputStream *ist, AVFrame *decoded_frame)
         } else{
             f = decoded_frame;
         }
+        t = trace_begin();
         ret = ifilter_send_frame(ist->filters[i], f);
+        trace_end("ifilter_send_frame", t, ist->file_index, ist->st->index, ist->frames_decoded);
         if (ret == AVERROR_EOF)
             ret = 0; /* ignore */
         if (ret < 0) {
@@ -1974,6 +3096,7 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output, int eo
     int i, ret = 0, err = 0;
     int64_t best_effort_timestamp;
     int64_t dts = AV_NOPTS_VALUE;
+    int64_t t;
     AVPacket avpkt;
 
     // With fate-indeo3-2, we're getting 0-sized packets before EOF for some
@@ -2004,9 +3127,22 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output, int eo
         ist->dts_buffer[ist->nb_dts_buffer++] = dts;
     }
 
-    update_benchmark(NULL);
+    /* non-reference frames are not decoded at all, the others are decoded
+     * for the frames that need them but not filtered, see below */
+    if (ist->drop_ost && !ist->drop_off && pkt) {
+        int drop = drop_predicted_packet(ist, pkt->pts);
+
+        ist->dec_ctx->skip_frame = drop ? FFMAX(ist->skip_frame, AVDISCARD_NONREF) :
+                                          ist->skip_frame;
+        ist->drop_predict_packets += drop;
+    }
+
+    update_benchmark(NULL, 0);
+    t = ist->drop_ost ? av_gettime_relative() : 0;
     ret = decode(ist->dec_ctx, decoded_frame, got_output, pkt ? &avpkt : NULL);
-    update_benchmark("decode_video %d.%d", ist->file_index, ist->st->index);
+    if (ist->drop_ost)
+        ist->drop_decode_us += av_gettime_relative() - t;
+    update_benchmark(&ist->bench, BENCH_DECODE);
     if (ret < 0)
         *decode_failed = 1;
 
@@ -2090,9 +3226,19 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output, int eo
                ist->st->time_base.num, ist->st->time_base.den);
     }
 
+    if (drop_predicted_frame(ist, decoded_frame, best_effort_timestamp)) {
+        ist->drop_predict_frames++;
+        goto fail;
+    }
+
     if (ist->st->sample_aspect_ratio.num)
         decoded_frame->sample_aspect_ratio = ist->st->sample_aspect_ratio;
+    t = ist->drop_ost ? av_gettime_relative() : 0;
     err = send_frame_to_filters(ist, decoded_frame);
+    if (ist->drop_ost) {
+        ist->drop_filter_us += av_gettime_relative() - t;
+        ist->drop_filter_frames++;
+    }
 
 fail:
     av_frame_unref(ist->filter_frame);
@@ -2114,9 +3260,9 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output, int *d
     decoded_frame = ist->decoded_frame;
 
 
-    update_benchmark(NULL);
+    update_benchmark(NULL, 0);
     ret = decode(avctx, decoded_frame, got_output, pkt);
-    update_benchmark("decode_audio %d.%d", ist->file_index, ist->st->index);
+    update_benchmark(&ist->bench, BENCH_DECODE);
     if (ret < 0)
         *decode_failed = 1;
 
@@ -2171,7 +3317,7 @@ static void sub2video_flush(InputStream *ist)
     if (ist->sub2video.end_pts < INT64_MAX)
         sub2video_update(ist, NULL);
     for (i = 0; i < ist->nb_filters; i++)
-        av_buffersrc_add_frame(ist->filters[i]->filter, NULL);
+        filter_push_frame(ist->filters[i], NULL, 0);
 }
 
 
@@ -2272,7 +3418,7 @@ static int ifilter_send_eof(InputFilter *ifilter)
     ifilter->eof = 1;
 
     if (ifilter->filter) {
-        ret = av_buffersrc_add_frame_flags(ifilter->filter, NULL, AV_BUFFERSRC_FLAG_PUSH);
+        ret = filter_push_frame(ifilter, NULL, AV_BUFFERSRC_FLAG_PUSH);
         if (ret < 0)
             return ret;
     } else {
@@ -2310,6 +3456,7 @@ static int process_input_packet(InputStream *ist, const AVPacket *pkt, int no_eo
     int ret = 0, i;
     int repeating = 0;
     int eof_reached = 0;
+    int64_t t;
 
     AVPacket avpkt;
     if (!ist->saw_first_ts) {
@@ -2357,8 +3504,10 @@ static int process_input_packet(InputStream *ist, const AVPacket *pkt, int no_eo
                                    &decode_failed);
             break;
         case AVMEDIA_TYPE_VIDEO:
+            t = trace_begin();
             ret = decode_video    (ist, repeating ? NULL : &avpkt, &got_output, !pkt,
                                    &decode_failed);
+            trace_end("decode_video", t, ist->file_index, ist->st->index, ist->frames_decoded);
             break;
             if (!repeating || !pkt || got_output) {
                 if (pkt && pkt->duration) {
@@ -2659,22 +3808,7 @@ static void do_video_out(OutputFile *of,
         nb0_frames = 0; // tracks the number of times the PREVIOUS frame should be duplicated, mostly for variable framerate (VFR)
         nb_frames = 1;
 
-        format_video_sync = video_sync_method;
-        if (format_video_sync == VSYNC_AUTO) {
-            if(!strcmp(of->ctx->oformat->name, "avi")) {
-                format_video_sync = VSYNC_VFR;
-            } else
-                format_video_sync = (of->ctx->oformat->flags & AVFMT_VARIABLE_FPS) ? ((of->ctx->oformat->flags & AVFMT_NOTIMESTAMPS) ? VSYNC_PASSTHROUGH : VSYNC_VFR) : VSYNC_CFR;
-            if (   ist
-                && format_video_sync == VSYNC_CFR
-                && input_files[ist->file_index]->ctx->nb_streams == 1
-                && input_files[ist->file_index]->input_ts_offset == 0) {
-                format_video_sync = VSYNC_VSCFR;
-            }
-            if (format_video_sync == VSYNC_CFR && copy_ts) {
-                format_video_sync = VSYNC_VSCFR;
-            }
-        }
+        format_video_sync = resolve_video_sync(of, ist);
         ost->is_cfr = (format_video_sync == VSYNC_CFR || format_video_sync == VSYNC_VSCFR);
 
         if (delta0 < 0 &&
@@ -2861,7 +3995,7 @@ static void do_video_out(OutputFile *of,
                 av_log(NULL, AV_LOG_DEBUG, "Forced keyframe at time %f\n", pts_time);
             }
 
-            update_benchmark(NULL);
+            update_benchmark(NULL, 0);
             if (debug_ts) {
                 av_log(NULL, AV_LOG_INFO, "encoder <- type:video "
                        "frame_pts:%s frame_pts_time:%s time_base:%d/%d\n",
@@ -2877,7 +4011,7 @@ static void do_video_out(OutputFile *of,
 
             while (1) {
                 ret = avcodec_receive_packet(enc, &pkt);
-                update_benchmark("encode_video %d.%d", ost->file_index, ost->index);
+                update_benchmark(&ost->bench, BENCH_ENCODE);
                 if (ret == AVERROR(EAGAIN))
                     break;
                 if (ret < 0)
@@ -2960,7 +4094,7 @@ static void do_audio_out(OutputFile *of, OutputStream *ost,
     ost->frames_encoded++;
 
     av_assert0(pkt.size || !pkt.data);
-    update_benchmark(NULL);
+    update_benchmark(NULL, 0);
     if (debug_ts) {
         av_log(NULL, AV_LOG_INFO, "encoder <- type:audio "
                "frame_pts:%s frame_pts_time:%s time_base:%d/%d\n",
@@ -2979,7 +4113,7 @@ static void do_audio_out(OutputFile *of, OutputStream *ost,
         if (ret < 0)
             goto error;
 
-        update_benchmark("encode_audio %d.%d", ost->file_index, ost->index);
+        update_benchmark(&ost->bench, BENCH_ENCODE);
 
         av_packet_rescale_ts(&pkt, enc->time_base, ost->mux_timebase);
 
@@ -3098,15 +4232,19 @@ static int process_input(int file_index)
     AVPacket pkt;
     int ret, i, j;
     int64_t duration;
+    int64_t t;
     int64_t pkt_dts;
 
     is  = ifile->ctx;
+    update_benchmark(NULL, 0);
     ret = get_input_packet(ifile, &pkt);
 
     if (ret == AVERROR(EAGAIN)) {
         ifile->eagain = 1;
+        eagain_unknown |= !ifile->rate_emu_due;
         return ret;
     }
+    eagain_backoff = 0;
 
     if (ret < 0 && ifile->loop) {
         if ((ret = seek_to_start(ifile, is)) < 0)
@@ -3151,6 +4289,12 @@ static int process_input(int file_index)
 
     reset_eagain();
 
+    if (ifile->pkttrace && (ret = pkttrace_writer_write(ifile->pkttrace, &pkt)) < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Error recording packets of input file #%d: %s\n",
+               file_index, av_err2str(ret));
+        exit_program(1);
+    }
+
     if (do_pkt_dump) {
         av_pkt_dump_log2(NULL, AV_LOG_INFO, &pkt, do_hex_dump,
                          is->streams[pkt.stream_index]);
@@ -3165,6 +4309,7 @@ static int process_input(int file_index)
     }
 
     ist = input_streams[ifile->ist_index + pkt.stream_index];
+    update_benchmark(&ist->bench, BENCH_DEMUX);
 
     ist->data_size += pkt.size;
     ist->nb_packets++;
@@ -3333,7 +4478,10 @@ static int process_input(int file_index)
     }
 
     sub2video_heartbeat(ist, pkt.pts);
+    trace_sample_packet();
+    t = trace_begin();
     process_input_packet(ist, &pkt, 0);
+    trace_end("process_input_packet", t, ist->file_index, ist->st->index, ist->nb_packets);
 
 discard_packet:
     av_packet_unref(&pkt);
@@ -3341,112 +4489,139 @@ discard_packet:
     return 0;
 }
 
-/**
- * Get and encode new output from any of the filtergraphs, without causing
- * activity.
- *
- * @return  0 for success, <0 for severe errors
- */
-static int reap_filters(int flush)
+/* Drain the buffer sink of one filtered output stream. */
+static int reap_output_stream(OutputStream *ost, int flush)
 {
-    AVFrame *filtered_frame = NULL;
-    int i;
-
-    /* Reap all buffers present in the buffer sinks */
-    for (i = 0; i < nb_output_streams; i++) {
-        OutputStream *ost = output_streams[i];
-        OutputFile    *of = output_files[ost->file_index];
-        AVFilterContext *filter;
-        AVCodecContext *enc = ost->enc_ctx;
-        int ret = 0;
+    OutputFile    *of = output_files[ost->file_index];
+    AVFilterContext *filter;
+    AVCodecContext *enc = ost->enc_ctx;
+    AVFrame *filtered_frame;
+    int64_t t;
+    int ret = 0;
 
-        if (!ost->filter || !ost->filter->graph->graph)
-            continue;
-        filter = ost->filter->filter;
+    if (!ost->filter || !ost->filter->graph->graph)
+        return 0;
+    filter = ost->filter->filter;
 
-        if (!ost->initialized) {
-            char error[1024] = "";
-            ret = init_output_stream(ost, error, sizeof(error));
-            if (ret < 0) {
-                av_log(NULL, AV_LOG_ERROR, "Error initializing output stream %d:%d -- %s\n",
-                       ost->file_index, ost->index, error);
-                exit_program(1);
-            }
+    if (!ost->initialized) {
+        char error[1024] = "";
+        ret = init_output_stream(ost, error, sizeof(error));
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Error initializing output stream %d:%d -- %s\n",
+                   ost->file_index, ost->index, error);
+            exit_program(1);
         }
+    }
 
-        if (!ost->filtered_frame && !(ost->filtered_frame = av_frame_alloc())) {
-            return AVERROR(ENOMEM);
-        }
-        filtered_frame = ost->filtered_frame;
+    if (!ost->filtered_frame && !(ost->filtered_frame = av_frame_alloc())) {
+        return AVERROR(ENOMEM);
+    }
+    filtered_frame = ost->filtered_frame;
 
-        while (1) {
-            double float_pts = AV_NOPTS_VALUE; // this is identical to filtered_frame.pts but with higher precision
+    while (1) {
+        double float_pts = AV_NOPTS_VALUE; // this is identical to filtered_frame.pts but with higher precision
+        update_benchmark(NULL, 0);
+        if (ost->filter->graph->thread)
+            ret = fg_thread_receive(ost->filter, filtered_frame);
+        else
             ret = av_buffersink_get_frame_flags(filter, filtered_frame,
                                                AV_BUFFERSINK_FLAG_NO_REQUEST);
-            if (ret < 0) {
-                if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
-                    av_log(NULL, AV_LOG_WARNING,
-                           "Error in av_buffersink_get_frame_flags(): %s\n", av_err2str(ret));
-                } else if (flush && ret == AVERROR_EOF) {
-                    if (av_buffersink_get_type(filter) == AVMEDIA_TYPE_VIDEO)
-                        do_video_out(of, ost, NULL, AV_NOPTS_VALUE);
-                }
-                break;
-            }
-            if (ost->finished) {
-                av_frame_unref(filtered_frame);
-                continue;
-            }
-            if (filtered_frame->pts != AV_NOPTS_VALUE) {
-                int64_t start_time = (of->start_time == AV_NOPTS_VALUE) ? 0 : of->start_time;
-                AVRational filter_tb = av_buffersink_get_time_base(filter);
-                AVRational tb = enc->time_base;
-                int extra_bits = av_clip(29 - av_log2(tb.den), 0, 16);
-
-                tb.den <<= extra_bits;
-                float_pts =
-                    av_rescale_q(filtered_frame->pts, filter_tb, tb) -
-                    av_rescale_q(start_time, AV_TIME_BASE_Q, tb);
-                float_pts /= 1 << extra_bits;
-                // avoid exact midoints to reduce the chance of rounding differences, this can be removed in case the fps code is changed to work with integers
-                float_pts += FFSIGN(float_pts) * 1.0 / (1<<17);
-
-                filtered_frame->pts =
-                    av_rescale_q(filtered_frame->pts, filter_tb, enc->time_base) -
-                    av_rescale_q(start_time, AV_TIME_BASE_Q, enc->time_base);
+        if (ret >= 0)
+            update_benchmark(&ost->bench, BENCH_FILTER);
+        if (ret < 0) {
+            if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+                av_log(NULL, AV_LOG_WARNING,
+                       "Error in av_buffersink_get_frame_flags(): %s\n", av_err2str(ret));
+            } else if (flush && ret == AVERROR_EOF) {
+                if (av_buffersink_get_type(filter) == AVMEDIA_TYPE_VIDEO)
+                    do_video_out(of, ost, NULL, AV_NOPTS_VALUE);
             }
-            //if (ost->source_index >= 0)
-            //    *filtered_frame= *input_streams[ost->source_index]->decoded_frame; //for me_threshold
+            break;
+        }
+        if (ost->finished) {
+            av_frame_unref(filtered_frame);
+            continue;
+        }
+        if (filtered_frame->pts != AV_NOPTS_VALUE) {
+            int64_t start_time = (of->start_time == AV_NOPTS_VALUE) ? 0 : of->start_time;
+            AVRational filter_tb = av_buffersink_get_time_base(filter);
+            AVRational tb = enc->time_base;
+            int extra_bits = av_clip(29 - av_log2(tb.den), 0, 16);
+
+            tb.den <<= extra_bits;
+            float_pts =
+                av_rescale_q(filtered_frame->pts, filter_tb, tb) -
+                av_rescale_q(start_time, AV_TIME_BASE_Q, tb);
+            float_pts /= 1 << extra_bits;
+            // avoid exact midoints to reduce the chance of rounding differences, this can be removed in case the fps code is changed to work with integers
+            float_pts += FFSIGN(float_pts) * 1.0 / (1<<17);
+
+            filtered_frame->pts =
+                av_rescale_q(filtered_frame->pts, filter_tb, enc->time_base) -
+                av_rescale_q(start_time, AV_TIME_BASE_Q, enc->time_base);
+        }
+        //if (ost->source_index >= 0)
+        //    *filtered_frame= *input_streams[ost->source_index]->decoded_frame; //for me_threshold
 
-            switch (av_buffersink_get_type(filter)) {
-            case AVMEDIA_TYPE_VIDEO:
-                if (!ost->frame_aspect_ratio.num)
-                    enc->sample_aspect_ratio = filtered_frame->sample_aspect_ratio;
+        switch (av_buffersink_get_type(filter)) {
+        case AVMEDIA_TYPE_VIDEO:
+            if (!ost->frame_aspect_ratio.num)
+                enc->sample_aspect_ratio = filtered_frame->sample_aspect_ratio;
 
-                if (debug_ts) {
-                    av_log(NULL, AV_LOG_INFO, "filter -> pts:%s pts_time:%s exact:%f time_base:%d/%d\n",
-                            av_ts2str(filtered_frame->pts), av_ts2timestr(filtered_frame->pts, &enc->time_base),
-                            float_pts,
-                            enc->time_base.num, enc->time_base.den);
-                }
+            if (debug_ts) {
+                av_log(NULL, AV_LOG_INFO, "filter -> pts:%s pts_time:%s exact:%f time_base:%d/%d\n",
+                        av_ts2str(filtered_frame->pts), av_ts2timestr(filtered_frame->pts, &enc->time_base),
+                        float_pts,
+                        enc->time_base.num, enc->time_base.den);
+            }
 
-                do_video_out(of, ost, filtered_frame, float_pts);
-                break;
-            case AVMEDIA_TYPE_AUDIO:
-                if (!(enc->codec->capabilities & AV_CODEC_CAP_PARAM_CHANGE) &&
-                    enc->channels != av_frame_get_channels(filtered_frame)) {
-                    av_log(NULL, AV_LOG_ERROR,
-                           "Audio filter graph output is not normalized and encoder does not support parameter changes\n");
-                    break;
-                }
-                do_audio_out(of, ost, filtered_frame);
+            t = trace_begin();
+            do_video_out(of, ost, filtered_frame, float_pts);
+            trace_end("do_video_out", t, ost->file_index, ost->index, ost->frame_number);
+            break;
+        case AVMEDIA_TYPE_AUDIO:
+            if (!(enc->codec->capabilities & AV_CODEC_CAP_PARAM_CHANGE) &&
+                enc->channels != av_frame_get_channels(filtered_frame)) {
+                av_log(NULL, AV_LOG_ERROR,
+                       "Audio filter graph output is not normalized and encoder does not support parameter changes\n");
                 break;
-            default:
-                // TODO support subtitle filters
-                av_assert0(0);
             }
+            do_audio_out(of, ost, filtered_frame);
+            break;
+        default:
+            // TODO support subtitle filters
+            av_assert0(0);
+        }
 
-            av_frame_unref(filtered_frame);
+        av_frame_unref(filtered_frame);
+    }
+
+    return 0;
+}
+
+/**
+ * Get and encode new output from any of the filtergraphs, without causing
+ * activity. Only the graphs that got input since the last call are reaped:
+ * without new input a sink only returns EAGAIN, so the other graphs are
+ * skipped unless flushing.
+ *
+ * @return  0 for success, <0 for severe errors
+ */
+static int reap_filters(int flush)
+{
+    int i, j, ret;
+
+    for (i = 0; i < nb_filtergraphs; i++) {
+        FilterGraph *fg = filtergraphs[i];
+
+        /* executor threads report new frames through their queues */
+        if (!fg->graph || (!flush && !fg->pending && !fg->thread))
+            continue;
+        fg->pending = 0;
+        for (j = 0; j < fg->nb_outputs; j++) {
+            OutputStream *ost = fg->outputs[j]->ost;
+            if (ost && (ret = reap_output_stream(ost, flush)) < 0)
+                return ret;
         }
     }
 
@@ -3461,6 +4636,7 @@ static int reap_filters(int flush)
 static int transcode_step(void)
 {
     int ret;
+    int64_t t;
     OutputStream *ost;
     InputStream  *ist = NULL;
 
@@ -3468,7 +4644,7 @@ static int transcode_step(void)
     if (!ost) {
         if (got_eagain()) {
             reset_eagain();
-            av_usleep(10000);
+            wait_for_input();
             return 0;
         }
         av_log(NULL, AV_LOG_VERBOSE, "No more inputs to read from, finishing.\n");
@@ -3512,14 +4688,16 @@ static int transcode_step(void)
     ret = process_input(ist->file_index);
     if (ret == AVERROR(EAGAIN)) {
         if (input_files[ist->file_index]->eagain)
-            ost->unavailable = 1;
+            set_unavailable(ost);
         return 0;
     }
 
     if (ret < 0)
         return ret == AVERROR_EOF ? 0 : ret;
 
-    return reap_filters(0);
+    t = trace_begin();
+    ret = reap_filters(0);
+    trace_end("reap_filters", t, ost->file_index, ost->index, ost->frame_number);
     return ret;
 }
 
@@ -3613,7 +4791,7 @@ static void flush_encoders(void)
                 pkt.data = NULL;
                 pkt.size = 0;
 
-                update_benchmark(NULL);
+                update_benchmark(NULL, 0);
 
                 while ((ret = avcodec_receive_packet(enc, &pkt)) == AVERROR(EAGAIN)) {
                     ret = avcodec_send_frame(enc, NULL);
@@ -3625,7 +4803,7 @@ static void flush_encoders(void)
                     }
                 }
 
-                update_benchmark("flush_%s %d.%d", desc, ost->file_index, ost->index);
+                update_benchmark(&ost->bench, BENCH_ENCODE);
                 if (ret < 0 && ret != AVERROR_EOF) {
                     av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
                            desc,
@@ -3704,6 +4882,11 @@ static int transcode(void)
         /* dump report by using the output first video and audio streams */
         print_report(0, timer_start, cur_time);
 
+        if (received_bench_dump) {
+            received_bench_dump = 0;
+            dump_benchmark_stats();
+        }
+
     }
 
 #if HAVE_PTHREADS
@@ -3741,6 +4924,7 @@ static int transcode(void)
 
      /* dump report by using the first video and audio streams */
     print_report(1, timer_start, av_gettime_relative());
+    dump_benchmark_stats();
 
     /* close each encoder */
     for (i = 0; i < nb_output_streams; i++) {
@@ -3800,8 +4984,188 @@ fail:
     return 0;
 }
 
+/* With -fast_remux, a single input copied into a single output with nothing
+ * that needs the full pipeline (trimming, filters, looping, bitstream
+ * filters other than the one remux picks itself, options remux does not
+ * carry over) goes through the remux fast path instead.
+ * Fills streams[] with the input stream indices in output order. */
+static int remux_eligible(int *streams)
+{
+    InputFile  *ifile = input_files[0];
+    OutputFile *of    = output_files[0];
+    int i, j;
+
+    if (!fast_remux || nb_input_files != 1 || nb_output_files != 1 || nb_filtergraphs ||
+        nb_output_streams > MAX_STREAMS || !nb_output_streams || do_benchmark_all)
+        return 0;
+    if (ifile->start_time != AV_NOPTS_VALUE || ifile->recording_time != INT64_MAX ||
+        ifile->loop || ifile->rate_emu || ifile->pkttrace)
+        return 0;
+    if (of->start_time != AV_NOPTS_VALUE || of->recording_time != INT64_MAX ||
+        of->limit_filesize != UINT64_MAX || of->shortest || av_dict_count(of->opts) ||
+        of->metadata_set || of->ctx->nb_chapters || !strcmp(of->ctx->oformat->name, "rtp"))
+        return 0;
+
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        InputStream  *ist;
+        const char *bsf;
+
+        if (!ost->stream_copy || ost->source_index < 0 || ost->attachment_filename ||
+            ost->max_frames != INT64_MAX || ost->disposition || ost->st->codecpar->codec_tag ||
+            ost->copy_initial_nonkeyframes != output_streams[0]->copy_initial_nonkeyframes)
+            return 0;
+        ist = input_streams[ost->source_index];
+        bsf = remux_annexb_bsf(ist->st->codecpar, of->ctx->oformat);
+        if (ost->nb_bitstream_filters > 1 ||
+            (ost->nb_bitstream_filters &&
+             (!bsf || strcmp(ost->bsf_ctx[0]->filter->name, bsf))))
+            return 0;
+        streams[i] = ist->st->index;
+        for (j = 0; j < i; j++)
+            if (streams[j] == streams[i])
+                return 0;
+    }
+    return 1;
+}
+
+typedef struct RemuxProgress {
+    int64_t start;          ///< when the job started, av_gettime_relative()
+    int64_t last_report;    ///< when the last -progress block was written
+    int64_t out_time;       ///< highest output time so far, AV_TIME_BASE units
+} RemuxProgress;
+
+/* the -progress block print_report() writes, from what remux knows */
+static void remux_report(RemuxJob *job, RemuxProgress *p, int is_last_report)
+{
+    int64_t t = av_gettime_relative() - p->start;
+    int64_t pts = FFMAX(p->out_time, 0);
+    int hours, mins, secs, us;
+    AVBPrint buf_script;
+    int ret;
+
+    secs  = pts / AV_TIME_BASE;
+    us    = pts % AV_TIME_BASE;
+    mins  = secs / 60;
+    secs %= 60;
+    hours = mins / 60;
+    mins %= 60;
+
+    av_bprint_init(&buf_script, 0, 1);
+    av_bprintf(&buf_script, "total_size=%"PRId64"\n", job->bytes);
+    av_bprintf(&buf_script, "out_time_ms=%"PRId64"\n", pts);
+    av_bprintf(&buf_script, "out_time=%02d:%02d:%02d.%06d\n", hours, mins, secs, us);
+    av_bprintf(&buf_script, "mem_bytes=%lld\n", (long long)atomic_load(&mem_budget_session.used));
+    av_bprintf(&buf_script, "mem_peak=%lld\n", (long long)atomic_load(&mem_budget_session.peak));
+    if (pts > 0 && t > 0)
+        av_bprintf(&buf_script, "speed=%4.3gx\n", (double)pts / t);
+    else
+        av_bprintf(&buf_script, "speed=N/A\n");
+    av_bprintf(&buf_script, "progress=%s\n", is_last_report ? "end" : "continue");
+    avio_write(progress_avio, (const unsigned char *)buf_script.str,
+               FFMIN(buf_script.len, buf_script.size - 1));
+    avio_flush(progress_avio);
+    av_bprint_finalize(&buf_script, NULL);
+    if (is_last_report && (ret = avio_closep(&progress_avio)) < 0)
+        av_log(NULL, AV_LOG_ERROR,
+               "Error closing progress log, loss of information possible: %s\n", av_err2str(ret));
+}
+
+static int remux_progress(void *opaque, RemuxJob *job, int64_t out_time)
+{
+    RemuxProgress *p = opaque;
+    int64_t now;
+
+    if (received_nb_signals)
+        return AVERROR_EXIT;
+    p->out_time = FFMAX(p->out_time, out_time);
+    now = av_gettime_relative();
+    if (progress_avio && now - p->last_report >= 500000) {
+        p->last_report = now;
+        remux_report(job, p, 0);
+    }
+    return 0;
+}
+
+static int run_remux(const int *streams)
+{
+    InputFile  *ifile = input_files[0];
+    OutputFile *of    = output_files[0];
+    RemuxJob job = { ifile->ctx->filename, of->ctx->filename, of->ctx->oformat->name };
+    RemuxProgress progress = { 0 };
+    int ret;
+
+    job.streams    = streams;
+    job.nb_streams = nb_output_streams;
+    job.ts_offset  = ifile->ts_offset;
+    job.copy_initial_nonkeyframes = output_streams[0]->copy_initial_nonkeyframes;
+    job.progress   = remux_progress;
+    job.opaque     = &progress;
+
+    av_log(NULL, AV_LOG_VERBOSE, "All streams are copied, remuxing '%s' directly\n",
+           ifile->ctx->filename);
+
+    /* open_output_file() already opened the output, remux reopens it */
+    if (!(of->ctx->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&of->ctx->pb);
+    progress.start = progress.last_report = av_gettime_relative();
+    ret = remux_context(ifile->ctx, &job);
+    if (progress_avio)
+        remux_report(&job, &progress, 1);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Remuxing '%s' failed: %s\n",
+               ifile->ctx->filename, av_err2str(ret));
+        return ret;
+    }
+    av_log(NULL, AV_LOG_VERBOSE, "Remuxed %"PRId64" packets, %"PRId64" bytes\n",
+           job.packets, job.bytes);
+    return 0;
+}
+
+/* -smart_cut: the range comes from -ss/-t on either side, the cut points are
+ * re-encoded with the source's settings; open_input_file() and
+ * open_output_file() already refused the options this would ignore */
+static int run_smart_cut(void)
+{
+    InputFile  *ifile = input_files[0];
+    OutputFile *of    = output_files[0];
+    SmartCutStats stats;
+    int64_t start, duration;
+    int ret;
+
+    if (nb_input_files != 1 || nb_output_files != 1 || nb_filtergraphs) {
+        av_log(NULL, AV_LOG_FATAL, "-smart_cut needs one input, one output and no filtergraphs\n");
+        return AVERROR(EINVAL);
+    }
+    if ((ifile->start_time != AV_NOPTS_VALUE && of->start_time != AV_NOPTS_VALUE) ||
+        (ifile->recording_time != INT64_MAX && of->recording_time != INT64_MAX)) {
+        av_log(NULL, AV_LOG_FATAL, "-smart_cut takes -ss and -t on the input or the output, not both\n");
+        return AVERROR(EINVAL);
+    }
+    if (strcmp(of->ctx->oformat->name, "mpegts")) {
+        av_log(NULL, AV_LOG_FATAL, "-smart_cut only writes MPEG-TS, not %s\n",
+               of->ctx->oformat->name);
+        return AVERROR(EINVAL);
+    }
+    start    = of->start_time != AV_NOPTS_VALUE ? of->start_time :
+               ifile->start_time != AV_NOPTS_VALUE ? ifile->start_time : 0;
+    duration = of->recording_time != INT64_MAX ? of->recording_time : ifile->recording_time;
+
+    /* open_output_file() already opened the output, smartcut_file() reopens it */
+    avio_closep(&of->ctx->pb);
+    if ((ret = smartcut_file(ifile->ctx->filename, of->ctx->filename, start, duration, &stats)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Smart cut of '%s' failed: %s\n",
+               ifile->ctx->filename, av_err2str(ret));
+        return ret;
+    }
+    av_log(NULL, AV_LOG_INFO, "smart cut: %"PRId64" frames re-encoded, %"PRId64" packets copied\n",
+           stats.frames_encoded, stats.packets_copied);
+    return 0;
+}
+
 int run_transcoding(int argc, char **argv, char *input_file, char *output_file)
 {
+    int remux_streams[MAX_STREAMS];
     int i, ret;
     int64_t ti;
 
@@ -3809,11 +5173,50 @@ int run_transcoding(int argc, char **argv, char *input_file, char *output_file)
     av_log_set_flags(AV_LOG_SKIP_REPEATED);
     register_ffmpeg();
 
+    /* option parsing and setup allocate from here, ffmpeg_cleanup()
+     * releases everything at once */
+    if (!session_arena && !(session_arena = arena_alloc(64 * 1024)))
+        exit_program(1);
+
     ret = ffmpeg_parse_options(argc, argv);
 
     if (ret < 0)
         exit_program(1);
 
+    trace_init();
+    if ((ret = loop_event_init()) < 0)
+        av_log(NULL, AV_LOG_WARNING, "Cannot create the main loop wakeup event, "
+               "falling back to sleeping: %s\n", av_err2str(ret));
+
+    if (do_benchmark_perf) {
+        do_benchmark_all = 1;
+        bench_perf_enabled = bench_perf_init() >= 0;
+    }
+
+    /* before anything allocates frames or starts threads, both inherit it */
+    if (cpu_set_list && (ret = numa_bind_cpus(cpu_set_list)) < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Cannot pin the session to CPUs %s: %s\n",
+               cpu_set_list, av_err2str(ret));
+        exit_program(1);
+    }
+    if (numa_placement) {
+        int node = numa_pick_node(numa_placement, NULL);
+
+        if (node < 0 || (ret = numa_bind_node(node)) < 0) {
+            av_log(NULL, AV_LOG_FATAL, "Cannot place the session on NUMA node %s\n", numa_placement);
+            exit_program(1);
+        }
+        av_log(NULL, AV_LOG_VERBOSE, "Session placed on NUMA node %d of %d\n",
+               node, numa_nb_nodes());
+    }
+
+    if ((use_frame_pool || frame_pool_hugepages) &&
+        !(frame_pool = frame_pool_alloc(frame_pool_hugepages ? FRAME_POOL_FLAG_HUGEPAGES : 0)))
+        exit_program(1);
+    if (thread_pool_size && (thread_pool_init(thread_pool_size) < 0 ||
+                             !(thread_pool_session = thread_pool_session_alloc())))
+        exit_program(1);
+
     if (nb_output_files <= 0 && nb_input_files == 0) {
         show_usage();
         av_log(NULL, AV_LOG_WARNING, "Use -h to get full help or, even better, run 'man %s'\n", 
@@ -3832,7 +5235,19 @@ int run_transcoding(int argc, char **argv, char *input_file, char *output_file)
             want_sdp = 0;
     }
 
-    current_time = ti = getutime();
+    if (smart_cut) {
+        if (run_smart_cut() < 0)
+            exit_program(1);
+        exit_program(received_nb_signals ? 255 : main_return_code);
+    }
+    if (remux_eligible(remux_streams)) {
+        if (run_remux(remux_streams) < 0)
+            exit_program(1);
+        exit_program(received_nb_signals ? 255 : main_return_code);
+    }
+
+    ti = getutime();
+    current_time = av_gettime_relative();
     if (transcode() < 0)
         exit_program(1);
     ti = getutime() - ti;
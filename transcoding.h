@@ -10,6 +10,17 @@
 #endif
 
 #include "cmdutils.h"
+#include "ffmpeg_arena.h"
+#include "ffmpeg_bench.h"
+#include "ffmpeg_fgthread.h"
+#include "ffmpeg_loop.h"
+#include "ffmpeg_mem.h"
+#include "ffmpeg_numa.h"
+#include "ffmpeg_pkttrace.h"
+#include "ffmpeg_pool.h"
+#include "ffmpeg_sched.h"
+#include "ffmpeg_threadpool.h"
+#include "ffmpeg_threadtune.h"
 
 #include <libavformat/avformat.h>
 #include <libavformat/avio.h>
@@ -29,6 +40,8 @@
 
 #include <libswresample/swresample.h>
 
+#include <libswscale/swscale.h>
+
 #define AVCONV_DATADIR "./"
 #define VSYNC_AUTO       -1
 #define VSYNC_PASSTHROUGH 0
@@ -125,6 +138,7 @@ typedef struct OptionsContext {
     int rate_emu;
     int accurate_seek;
     int thread_queue_size;
+    char *record_packets;
 
     SpecifierOpt *ts_scale;
     int        nb_ts_scale;
@@ -234,6 +248,14 @@ typedef struct OptionsContext {
     int        nb_time_bases;
     SpecifierOpt *enc_time_bases;
     int        nb_enc_time_bases;
+    SpecifierOpt *copy_if_compatible;
+    int        nb_copy_if_compatible;
+    SpecifierOpt *copy_profiles;
+    int        nb_copy_profiles;
+    SpecifierOpt *copy_max_levels;
+    int        nb_copy_max_levels;
+    SpecifierOpt *copy_max_bitrates;
+    int        nb_copy_max_bitrates;
 } OptionsContext;
 
 typedef struct InputFilter {
@@ -257,6 +279,9 @@ typedef struct InputFilter {
 
     AVBufferRef *hw_frames_ctx;
 
+    /* -reinit_prescale: converts frames back to the configured parameters */
+    struct SwsContext *prescale;
+
     int eof;
 } InputFilter;
 
@@ -289,6 +314,8 @@ typedef struct FilterGraph {
 
     AVFilterGraph *graph;
     int reconfiguration;
+    int pending;        /* frames were pushed since the last reap_filters() */
+    FilterGraphThread *thread;  /* executor with -filter_complex_parallel, else NULL */
 
     InputFilter   **inputs;
     int          nb_inputs;
@@ -317,7 +344,9 @@ typedef struct InputFile {
                              from ctx.nb_streams if new streams appear during av_read_frame() */
     int nb_streams_warn;  /* number of streams that the user was warned of */
     int rate_emu;
+    int64_t rate_emu_due; /* when the packet held back by -re is due, 0 if none */
     int accurate_seek;
+    PacketTraceWriter *pkttrace;    /* -record_packets */
 
 #if HAVE_PTHREADS
     AVThreadMessageQueue *in_thread_queue;
@@ -396,6 +425,24 @@ typedef struct InputStream {
 
     int reinit_filters;
 
+    /* -drop_predict: do_video_out() of the only output fed by this stream,
+     * replayed on the frame grid of the constant rate input */
+    struct OutputStream *drop_ost; ///< NULL if not predicting
+    int drop_off;               ///< the input left the grid, predicting stopped
+    int drop_ready;             ///< the parameters below the encoder decides are set
+    int drop_vsync;             ///< format_video_sync do_video_out() resolves
+    int64_t drop_step;          ///< input frame duration, in st->time_base
+    int64_t drop_origin;        ///< pts of grid frame 0, the first decoded one
+    int64_t drop_pkt_duration;  ///< pkt_duration of every frame
+    AVRational drop_filter_tb;  ///< buffersink time base
+    AVRational drop_enc_tb;
+    double drop_duration;       ///< do_video_out() frame duration, in drop_enc_tb
+    int64_t drop_next;          ///< next grid frame to come out of the decoder
+    uint64_t drop_pkt_seen;     ///< bit n: grid frame drop_next + n was demuxed
+    int64_t drop_sync_opts;     ///< the output's sync_opts and frame_number
+    int64_t drop_frame_number;  ///< after grid frame drop_next - 1
+    enum AVDiscard skip_frame;  ///< the decoder's own skip_frame setting
+
     /* hwaccel options */
     enum HWAccelID hwaccel_id;
     char  *hwaccel_device;
@@ -419,6 +466,17 @@ typedef struct InputStream {
     // number of frames/samples retrieved from the decoder
     uint64_t frames_decoded;
     uint64_t samples_decoded;
+    // -drop_predict: packets decoded with skip_frame=nonref, frames decoded
+    // but not sent to the filters, and frames the decoder skipped
+    uint64_t drop_predict_packets;
+    uint64_t drop_predict_frames;
+    uint64_t drop_predict_skipped;
+    // time spent decoding, and sending the frames that were to the filters
+    int64_t drop_decode_us;
+    int64_t drop_filter_us;
+    uint64_t drop_filter_frames;
+    // per-stage latency histograms, filled with -benchmark_all
+    BenchStats bench;
 
     int64_t *dts_buffer;
     int nb_dts_buffer;
@@ -510,6 +568,7 @@ typedef struct OutputStream {
     const char *attachment_filename;
     int copy_initial_nonkeyframes;
     int copy_prior_start;
+    int auto_copy;          /* stream copy chosen by -copy_if_compatible */
     char *disposition;
 
     int keep_pix_fmt;
@@ -539,6 +598,9 @@ typedef struct OutputStream {
 
     /* frame encode sum of squared error values */
     int64_t error[4];
+
+    // per-stage latency histograms, filled with -benchmark_all
+    BenchStats bench;
 } OutputStream;
 
 typedef struct OutputFile {
@@ -550,6 +612,7 @@ typedef struct OutputFile {
     uint64_t limit_filesize; /* filesize limit expressed in bytes */
 
     int shortest;
+    int metadata_set;        ///< -metadata or -map_metadata was given
 
     int header_written;
 } OutputFile;
@@ -579,8 +642,16 @@ extern int audio_volume;
 extern int audio_sync_method;
 extern int video_sync_method;
 extern float frame_drop_threshold;
+extern int drop_predict;
+extern int preview_mode;
+extern int smart_cut;
+extern int fast_remux;
 extern int do_benchmark;
 extern int do_benchmark_all;
+extern int do_benchmark_perf;
+extern char *benchmark_filename;
+extern int use_frame_pool;
+extern int frame_pool_hugepages;
 extern int do_deinterlace;
 extern int do_hex_dump;
 extern int do_pkt_dump;
@@ -600,6 +671,14 @@ extern char *videotoolbox_pixfmt;
 
 extern int filter_nbthreads;
 extern int filter_complex_nbthreads;
+extern int filter_complex_parallel;
+extern int reinit_prescale;
+extern int thread_pool_size;
+extern int auto_threads;
+extern int auto_threads_jobs;
+extern char *numa_placement;
+extern char *cpu_set_list;
+extern ThreadPoolSession *thread_pool_session;
 extern int vstats_version;
 
 extern const AVIOInterruptCB int_cb;
@@ -622,6 +701,15 @@ static int reap_filters(int flush);
 void remove_avoptions(AVDictionary **a, AVDictionary *b);
 void assert_avoptions(AVDictionary *m);
 int guess_input_channel_layout(InputStream *ist);
+
+void check_filter_outputs(void);
+int configure_output_filter(FilterGraph *fg, OutputFilter *ofilter, AVFilterInOut *out);
+int configure_filtergraph(FilterGraph *fg);
+int ifilter_parameters_from_frame(InputFilter *ifilter, const AVFrame *frame);
+int init_simple_filtergraph(InputStream *ist, OutputStream *ost);
+int init_complex_filtergraph(FilterGraph *fg);
+int filtergraph_is_simple(FilterGraph *fg);
+
 int run_transcoding(int argc, char **argv, char *input_file, char *output_file);
 void register_exit(void (*cb)(int ret));
 